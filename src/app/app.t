@@ -97,6 +97,7 @@ function App:init_ecs()
   end
   ECS:add_system(graphics.RenderSystem())
   if self.stats then ECS:add_system(graphics.DebugTextStats()) end
+  truss.on_quit(function() ECS:release() end)
 end
 
 -- this creates a basic forward pbr pipeline; if you want something fancier,
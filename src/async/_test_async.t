@@ -5,6 +5,7 @@ local m = {}
 
 function m.run(test)
   test("async", m.test_async)
+  test("jobs", m.test_jobs)
 end
 
 function m.test_async(t)
@@ -208,4 +209,77 @@ function m.test_async(t)
   t.expect(p.value, 12, "update separate loop did dispatch")
 end
 
-return m
\ No newline at end of file
+function m.test_jobs(t)
+  local async = require("async")
+  local jobs = require("async/jobs.t")
+  local atomic = require("substrate/atomic.t")
+
+  -- deque ordering (on one thread)
+  local deque = terralib.new(jobs.JobDeque)
+  deque:init()
+  local function fake_job(n) return terralib.cast(&jobs.Job, n) end
+  for n = 1, 3 do deque:push(fake_job(n)) end
+  t.ok(deque:pop() == fake_job(3), "deque: owner pops LIFO")
+  t.ok(deque:steal() == fake_job(1), "deque: thieves steal FIFO")
+  t.ok(deque:pop() == fake_job(2), "deque: pops the last job")
+  t.ok(deque:pop() == nil and deque:steal() == nil, "deque: empty")
+  local npushed = 0
+  while deque:push(fake_job(1)) and npushed <= jobs.DEQUE_CAPACITY do
+    npushed = npushed + 1
+  end
+  t.expect(npushed, jobs.DEQUE_CAPACITY, "deque: push fails when full")
+  deque:release()
+
+  local struct Counter {
+    count: int32;
+    seen_by_continuation: int32;
+  }
+  local NCHILDREN = 1000
+  local terra count_one(job: &jobs.Job, arg: &opaque)
+    atomic.fetch_add(&[&Counter](arg).count, 1)
+  end
+  local terra count_range(job: &jobs.Job, arg: &opaque, first: uint64, last: uint64)
+    atomic.fetch_add(&[&Counter](arg).count, last - first)
+  end
+  local terra spawn_children(job: &jobs.Job, arg: &opaque)
+    for i = 0, NCHILDREN do
+      jobs.spawn_child(job, count_one, arg)
+    end
+    jobs.spawn_range(job, count_range, arg, NCHILDREN, 7)
+  end
+  local terra record_count(job: &jobs.Job, arg: &opaque)
+    var counter = [&Counter](arg)
+    counter.seen_by_continuation = atomic.load(&counter.count)
+  end
+
+  local js = jobs.JobSystem({threads = 3})
+  local counter = terralib.new(Counter, {0, 0})
+  local root = js:create(spawn_children, counter)
+  local cont = js:create(record_count, counter)
+  js.native:set_continuation(root, cont)
+  js.native:retain(cont)
+  js.native:submit(root)
+  js:wait(cont)
+  js:release_job(cont)
+  t.expect(counter.count, 2*NCHILDREN, "jobs: all children ran")
+  t.expect(counter.seen_by_continuation, 2*NCHILDREN,
+           "jobs: continuation ran after every child finished")
+
+  local ok = pcall(function() js:create(function() end, nil) end)
+  t.ok(not ok, "jobs: Lua functions are rejected")
+
+  -- promise bridge
+  async.clear()
+  counter.count = 0
+  local resolved = false
+  js:run(spawn_children, counter):next(function() resolved = true end)
+  for _ = 1, 100000 do
+    if resolved then break end
+    async.update()
+  end
+  t.ok(resolved, "jobs: promise resolves")
+  t.expect(counter.count, 2*NCHILDREN, "jobs: promise resolves after the job")
+  js:release()
+end
+
+return m
@@ -0,0 +1,415 @@
+-- async/jobs.t
+--
+-- a native work-stealing job system
+--
+-- Jobs are terra functions (job: &Job, arg: &opaque) run by a pool of
+-- worker threads, each with its own Chase-Lev deque: workers push
+-- and pop their own work LIFO, and idle workers steal FIFO from the
+-- others. A job only counts as finished once every child job it
+-- spawned (spawn_child) has also finished; at that point its
+-- continuation (if any) is queued and its parent is notified, so
+-- dependent work needs no blocking waits or fibers.
+--
+-- From Lua, JobSystem:run(fn, arg) returns a Promise which the async
+-- event loop resolves once the job has finished, so it can be
+-- async.await'ed. Jobs must not call back into Lua.
+
+local class = require("class")
+local libc = require("substrate/libc.t")
+local atomic = require("substrate/atomic.t")
+local threads = require("osnative/threads.t")
+local timing = require("osnative/timing.t")
+local async = require("./async.t")
+local m = {}
+
+local DEQUE_CAPACITY = 4096 -- must be a power of two
+m.DEQUE_CAPACITY = DEQUE_CAPACITY
+local MAIN_THREAD = 0 -- the main thread owns deque 0
+
+local struct Job {
+  fn: {&Job, &opaque} -> {};
+  arg: &opaque;
+  system: &opaque;
+  parent: &Job;
+  continuation: &Job;
+  unfinished: int32; -- 1 for the job itself + 1 per unfinished child
+  refs: int32;
+  finished: uint32;
+  worker: int32; -- which thread ran it (0 = main thread)
+  t_start: int64;
+  t_end: int64;
+}
+m.Job = Job
+
+local JobFn = {&Job, &opaque} -> {}
+m.JobFn = JobFn
+
+-- a fixed-capacity Chase-Lev deque: only the owning thread may
+-- push/pop, but any thread may steal
+local struct JobDeque {
+  top: int64;
+  bottom: int64;
+  jobs: &&Job;
+}
+m.JobDeque = JobDeque
+
+terra JobDeque:init()
+  self.top, self.bottom = 0, 0
+  self.jobs = [&&Job](libc.std.malloc(DEQUE_CAPACITY * sizeof([&Job])))
+end
+
+terra JobDeque:release()
+  libc.std.free(self.jobs)
+  self.jobs = nil
+end
+
+-- returns false if the deque is full
+terra JobDeque:push(job: &Job): bool
+  var b = atomic.load(&self.bottom)
+  var t = atomic.load(&self.top)
+  if b - t >= DEQUE_CAPACITY then return false end
+  self.jobs[b and (DEQUE_CAPACITY - 1)] = job
+  atomic.fence()
+  atomic.exchange(&self.bottom, b + 1)
+  return true
+end
+
+terra JobDeque:pop(): &Job
+  var b = atomic.load(&self.bottom) - 1
+  atomic.exchange(&self.bottom, b)
+  atomic.fence()
+  var t = atomic.load(&self.top)
+  if t > b then
+    atomic.exchange(&self.bottom, b + 1)
+    return nil
+  end
+  var job = self.jobs[b and (DEQUE_CAPACITY - 1)]
+  if t == b then
+    -- last job: race any thieves for it
+    if not atomic.compare_exchange(&self.top, t, t + 1) then job = nil end
+    atomic.exchange(&self.bottom, b + 1)
+  end
+  return job
+end
+
+terra JobDeque:steal(): &Job
+  var t = atomic.load(&self.top)
+  atomic.fence()
+  var b = atomic.load(&self.bottom)
+  if t >= b then return nil end
+  var job = self.jobs[t and (DEQUE_CAPACITY - 1)]
+  if not atomic.compare_exchange(&self.top, t, t + 1) then return nil end
+  return job
+end
+
+local struct WorkerArg {
+  system: &opaque;
+  idx: uint32;
+}
+
+local struct NativeJobSystem {
+  nthreads: uint32;
+  running: uint32;
+  deques: &JobDeque; -- [nthreads + 1], 0 is the main thread's
+  threads: &threads.Thread;
+  args: &WorkerArg;
+}
+m.NativeJobSystem = NativeJobSystem
+
+-- creates a job, which isn't run until it's submitted (or made a
+-- continuation of another job)
+terra NativeJobSystem:create(fn: JobFn, arg: &opaque): &Job
+  var job = [&Job](libc.std.malloc(sizeof(Job)))
+  job.fn = fn
+  job.arg = arg
+  job.system = self
+  job.parent = nil
+  job.continuation = nil
+  job.unfinished = 1
+  job.refs = 1 -- released by the system when the job finishes
+  job.finished = 0
+  job.worker = -1
+  job.t_start, job.t_end = 0, 0
+  return job
+end
+
+-- keeps a job alive past its completion (e.g., to poll it)
+terra NativeJobSystem:retain(job: &Job)
+  atomic.fetch_add(&job.refs, 1)
+end
+
+terra NativeJobSystem:release(job: &Job)
+  if atomic.fetch_sub(&job.refs, 1) == 1 then
+    libc.std.free(job)
+  end
+end
+
+terra NativeJobSystem:is_finished(job: &Job): bool
+  return atomic.load(&job.finished) ~= 0
+end
+
+-- cont will be queued once job (and all its children) has finished;
+-- must be set before job is submitted
+terra NativeJobSystem:set_continuation(job: &Job, cont: &Job)
+  job.continuation = cont
+end
+
+terra NativeJobSystem:_run(job: &Job, worker: uint32)
+  job.worker = worker
+  job.t_start = timing.get_counter()
+  job.fn(job, job.arg)
+  job.t_end = timing.get_counter()
+  self:_finish(job, worker)
+end
+
+-- (calling thread must own deque [worker])
+terra NativeJobSystem:_push(job: &Job, worker: uint32)
+  if not self.deques[worker]:push(job) then
+    self:_run(job, worker)
+  end
+end
+
+terra NativeJobSystem:_finish(job: &Job, worker: uint32)
+  if atomic.fetch_sub(&job.unfinished, 1) ~= 1 then return end
+  var parent, cont = job.parent, job.continuation
+  atomic.exchange(&job.finished, 1)
+  if cont ~= nil then self:_push(cont, worker) end
+  if parent ~= nil then self:_finish(parent, worker) end
+  self:release(job)
+end
+
+-- (from the main thread only; inside a job, use spawn_child)
+terra NativeJobSystem:submit(job: &Job)
+  self:_push(job, MAIN_THREAD)
+end
+
+-- own deque first, then steal round the others
+terra NativeJobSystem:_take(worker: uint32): &Job
+  var job = self.deques[worker]:pop()
+  if job ~= nil then return job end
+  var ndeques = self.nthreads + 1
+  for k = 1, ndeques do
+    job = self.deques[(worker + k) % ndeques]:steal()
+    if job ~= nil then return job end
+  end
+  return nil
+end
+
+-- runs one available job on the calling thread; returns false if
+-- there was nothing to do
+terra NativeJobSystem:help(worker: uint32): bool
+  var job = self:_take(worker)
+  if job == nil then return false end
+  self:_run(job, worker)
+  return true
+end
+
+-- blocks until job has finished, running other jobs in the meantime
+-- (job must be retained; from the main thread, worker is 0)
+terra NativeJobSystem:wait(job: &Job, worker: uint32)
+  while not self:is_finished(job) do
+    if not self:help(worker) then threads.yield() end
+  end
+end
+
+local terra worker_main(p: &opaque)
+  var arg = [&WorkerArg](p)
+  var system, idx = [&NativeJobSystem](arg.system), arg.idx
+  var idle: uint32 = 0
+  while atomic.load(&system.running) ~= 0 do
+    if system:help(idx) then
+      idle = 0
+    else
+      -- back off gradually whenever there is nothing to steal (even if
+      -- other jobs are still running), so that a few long jobs don't
+      -- keep every other worker spinning on a whole core
+      idle = idle + 1
+      if idle < 64 then
+        -- spin
+      elseif idle < 1024 then
+        threads.yield()
+      else
+        threads.sleep_ms(1)
+      end
+    end
+  end
+end
+
+-- returns how many worker threads were actually started (which is
+-- fewer than nthreads if the OS refused to spawn some)
+terra NativeJobSystem:init(nthreads: uint32): uint32
+  self.nthreads = nthreads
+  self.running = 1
+  self.deques = [&JobDeque](libc.std.malloc((nthreads + 1) * sizeof(JobDeque)))
+  self.threads = [&threads.Thread](libc.std.malloc(nthreads * sizeof(threads.Thread)))
+  self.args = [&WorkerArg](libc.std.malloc(nthreads * sizeof(WorkerArg)))
+  for idx = 0, nthreads + 1 do
+    self.deques[idx]:init()
+  end
+  for idx = 0, nthreads do
+    self.args[idx] = WorkerArg{self, idx + 1}
+    self.threads[idx] = threads.spawn(worker_main, &self.args[idx])
+    if not self.threads[idx]:is_valid() then
+      -- run with the workers we have: the rest of the deques are
+      -- never pushed to, since only their (missing) workers would
+      for k = idx + 1, nthreads + 1 do
+        self.deques[k]:release()
+      end
+      self.nthreads = idx
+      break
+    end
+  end
+  return self.nthreads
+end
+
+-- (any jobs still queued are dropped)
+terra NativeJobSystem:release()
+  if self.deques == nil then return end
+  atomic.exchange(&self.running, 0)
+  for idx = 0, self.nthreads do
+    self.threads[idx]:join()
+  end
+  for idx = 0, self.nthreads + 1 do
+    self.deques[idx]:release()
+  end
+  libc.std.free(self.deques)
+  libc.std.free(self.threads)
+  libc.std.free(self.args)
+  self.deques = nil
+end
+
+-- from inside a running job: spawns a child job that the parent's
+-- completion waits on (the child may already have run and been freed
+-- by the time this returns, so it isn't returned)
+terra m.spawn_child(parent: &Job, fn: JobFn, arg: &opaque)
+  var system = [&NativeJobSystem](parent.system)
+  var child = system:create(fn, arg)
+  child.parent = parent
+  atomic.fetch_add(&parent.unfinished, 1)
+  system:_push(child, parent.worker)
+end
+
+-- from inside a running job: splits [0, n) into chunks of at most
+-- chunk_size, run as child jobs; fn is called as fn(job, arg) with
+-- the range in the JobRange passed as arg
+local struct JobRange {
+  fn: {&Job, &opaque, uint64, uint64} -> {};
+  arg: &opaque;
+  first: uint64;
+  last: uint64;
+}
+m.JobRange = JobRange
+
+local terra run_range(job: &Job, p: &opaque)
+  var range = [&JobRange](p)
+  range.fn(job, range.arg, range.first, range.last)
+  libc.std.free(range)
+end
+
+terra m.spawn_range(parent: &Job, fn: {&Job, &opaque, uint64, uint64} -> {},
+                    arg: &opaque, n: uint64, chunk_size: uint64)
+  if chunk_size < 1 then chunk_size = 1 end
+  var first: uint64 = 0
+  while first < n do
+    var last = first + chunk_size
+    if last > n then last = n end
+    var range = [&JobRange](libc.std.malloc(sizeof(JobRange)))
+    @range = JobRange{fn, arg, first, last}
+    m.spawn_child(parent, run_range, range)
+    first = last
+  end
+end
+
+local JobSystem = class("JobSystem")
+m.JobSystem = JobSystem
+
+-- options.threads: number of worker threads (default: one fewer
+-- than the number of cores); with 0 threads, jobs only run when
+-- the main thread waits on or helps with them
+function JobSystem:init(options)
+  options = options or {}
+  local nthreads = options.threads or (threads.hardware_concurrency() - 1)
+  self.nthreads = math.max(nthreads, 0)
+  self.native = terralib.new(NativeJobSystem)
+  local started = self.native:init(self.nthreads)
+  if started < self.nthreads then
+    truss.log.warn("JobSystem: only started " .. started .. " of "
+                   .. self.nthreads .. " worker threads")
+    self.nthreads = started
+  end
+end
+
+-- (jobs run on the worker threads, so they can't be Lua functions)
+local function as_fn(fn)
+  if not terralib.isfunction(fn) then
+    truss.error("Jobs must be terra functions, got " .. tostring(fn))
+  end
+  return fn:getpointer()
+end
+
+function JobSystem:create(fn, arg)
+  return self.native:create(as_fn(fn), arg)
+end
+
+-- submits a job and returns it (retained: :release it when done)
+function JobSystem:submit(fn, arg)
+  local job = self:create(fn, arg)
+  self.native:retain(job)
+  self.native:submit(job)
+  return job
+end
+
+-- returns a promise that resolves (via the async event loop) when a
+-- retained job has finished, releasing it
+function JobSystem:promise(job)
+  local native, nthreads = self.native, self.nthreads
+  return async.run(function()
+    async.await_condition(function()
+      -- without workers, the main thread has to do the work
+      if nthreads == 0 then native:help(MAIN_THREAD) end
+      return native:is_finished(job)
+    end)
+    native:release(job)
+  end)
+end
+
+-- e.g., async.await(jobs:run(kernel, data))
+function JobSystem:run(fn, arg)
+  return self:promise(self:submit(fn, arg))
+end
+
+-- blocks the main thread until a retained job finishes, helping out
+-- with queued jobs in the meantime
+function JobSystem:wait(job)
+  self.native:wait(job, MAIN_THREAD)
+end
+
+-- runs one queued job on the main thread (or yields if there is
+-- nothing to do), e.g., while polling for completion
+function JobSystem:help()
+  if not self.native:help(MAIN_THREAD) then threads.yield() end
+end
+
+function JobSystem:is_finished(job)
+  return self.native:is_finished(job)
+end
+
+function JobSystem:release_job(job)
+  self.native:release(job)
+end
+
+function JobSystem:release()
+  if self.native then
+    self.native:release()
+    self.native = nil
+  end
+end
+
+local _default_jobs = nil
+-- the shared job system (created on first use)
+function m.default_job_system()
+  if not _default_jobs then _default_jobs = JobSystem() end
+  return _default_jobs
+end
+
+return m
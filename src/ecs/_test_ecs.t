@@ -293,6 +293,61 @@ local function test_scenegraph(t)
   end, "creating a cycle throws an error")
 end
 
+local function test_transformstore(t)
+  local math = require("math")
+  local TransformStore = require("ecs/transformstore.t").TransformStore
+  local Entity3d = ecs.Entity3d
+  local ECS = make_test_ecs()
+  local a = ECS.scene:create_child(Entity3d, "a")
+  local b = a:create_child(Entity3d, "b")
+  local c = b:create_child(Entity3d, "c")
+  local d = ECS.scene:create_child(Entity3d, "d")
+  local ents = {a, b, c, d}
+  for idx, ent in ipairs(ents) do
+    ent.position:set(idx, -idx, idx * 0.5)
+    ent.quaternion:euler({x = 0.1 * idx, y = 0.2, z = -0.3 * idx})
+    ent.scale:set(1.0 + idx * 0.25, 1.0, 0.5)
+    ent:update_matrix()
+  end
+
+  -- world matrices from the store vs. from walking the tree
+  local function store_matches()
+    local flat = {}
+    for idx, ent in ipairs(ents) do flat[idx] = ent.matrix_world:to_array() end
+    ECS.scene:recursive_update_world_mat(math.Matrix4():identity())
+    for idx, ent in ipairs(ents) do
+      local expected = ent.matrix_world:to_array()
+      for k = 1, 16 do
+        if not t.approx_eq(flat[idx][k], expected[k]) then return false end
+      end
+    end
+    return true
+  end
+
+  local store = TransformStore(ECS.scene)
+  t.ok(store:update() == 5, "Every entity computed on first update")
+  t.ok(store_matches(), "World matrices match recursive update")
+  t.ok(store:update() == 0, "Nothing recomputed when nothing changed")
+
+  b.position:set(3, 2, 1)
+  b:update_matrix()
+  t.ok(store:update() == 2, "Only the changed subtree is recomputed")
+  t.ok(store_matches(), "World matrices match after a local change")
+
+  c.matrix:identity()
+  c:transform_changed()
+  store:update()
+  t.ok(store_matches(), "World matrices match after a direct write")
+
+  d:set_parent(c)
+  store:update()
+  t.ok(store_matches(), "World matrices match after reparenting")
+
+  store:release()
+  t.ok(d._tf_store == nil, "Entities unbound on release")
+  t.ok(store_matches(), "Matrices usable after release")
+end
+
 local function test_components(t)
   local ECS = make_test_ecs()
   local Comp = ecs.Component:extend("Comp")
@@ -313,11 +368,160 @@ local function test_components(t)
   t.ok(instance.bleh.done_thing, "Promoted component function called")
 end
 
+local function test_archetypes(t)
+  local ECS = ecs.ECS()
+  local sys = ECS:add_system(ecs.ArchetypeSystem("particles",
+    {{"x", float}, {"v", float}},
+    function(DataType)
+      return terra(data: &DataType)
+        for row = 0, data:size() do
+          data.x.data[row] = data.x.data[row] + data.v.data[row]
+        end
+      end
+    end, "particle_update"))
+  local function x_of(handle)
+    local x = sys:get(handle, "x")
+    return x and x[0]
+  end
+
+  -- handles stay valid across removes
+  local handles = {}
+  for idx = 1, 5 do
+    handles[idx] = sys:add_row({x = idx, v = 1})
+  end
+  sys:remove_row(handles[2])
+  sys:remove_row(handles[4])
+  t.ok(sys:num_rows() == 3, "Removed rows aren't counted")
+  t.ok(x_of(handles[2]) == nil, "Removed row isn't visible")
+  t.ok(x_of(handles[5]) == 5, "Other rows unaffected by removes")
+  ECS:update()
+  t.ok(t.eq({x_of(handles[1]), x_of(handles[3]), x_of(handles[5])}, {2, 4, 6}),
+       "Kernel updates remaining rows through stable handles")
+  t.ok(sys.data:size() == 3, "Dead rows compacted on update")
+
+  -- adds and removes from components during the update
+  local Spawner = ecs.Component:extend("Spawner")
+  function Spawner:init()
+    self.mount_name = "spawner"
+  end
+  function Spawner:mount()
+    Spawner.super.mount(self)
+    self:add_to_systems({"particles"})
+    self:wake()
+  end
+  function Spawner:particle_update()
+    if self.done then return end
+    self.done = true
+    -- added and removed in the same update
+    self.transient = sys:add_row({x = 100, v = 0})
+    sys:remove_row(self.transient)
+    self.kept = sys:add_row({x = 10, v = 0})
+    sys:remove_row(handles[1])
+    t.ok(x_of(handles[1]) == 3, "Removes deferred during update")
+  end
+  local spawner = ECS.scene:create_child(ecs.Entity):add_component(Spawner())
+  ECS:update()
+  t.ok(sys:num_rows() == 3, "Deferred adds and removes applied")
+  t.ok(x_of(spawner.transient) == nil, "Row added and removed in one update is gone")
+  t.ok(x_of(spawner.kept) == 10, "Row added during update is present")
+  t.ok(x_of(handles[1]) == nil, "Row removed during update is gone")
+  t.ok(x_of(handles[3]) == 5, "Remaining rows still updated")
+
+  -- bulk removes
+  local many = {}
+  for idx = 1, 1000 do many[idx] = sys:add_row({x = idx, v = 0}) end
+  for idx = 1, 1000, 2 do sys:remove_row(many[idx]) end
+  ECS:update()
+  t.ok(sys:num_rows() == 503, "Bulk removes")
+  t.ok(x_of(many[1000]) == 1000, "Handles stable after bulk removes")
+  sys:release()
+end
+
+local function test_scheduler(t)
+  local jobs = require("async/jobs.t")
+  local ECS = ecs.ECS()
+  local run_order = {}
+  local RecordSystem = ecs.System:extend("RecordSystem")
+  function RecordSystem:init(name, reads, writes)
+    RecordSystem.super.init(self, name)
+    self.reads, self.writes = reads, writes
+  end
+  function RecordSystem:update()
+    table.insert(run_order, self.mount_name)
+  end
+  ECS:add_system(RecordSystem("a", {}, {"pos"}))
+  ECS:add_system(RecordSystem("b", {"pos"}, {}))
+  ECS:add_system(RecordSystem("c", {"vel"}, {"color"}))
+  ECS:add_system(RecordSystem("d")) -- undeclared: conflicts with all
+  ECS:add_system(RecordSystem("e", {"color"}, {}))
+  ECS:add_system(RecordSystem("f", {"vel"}, {}))
+
+  local scheduler = ecs.SystemScheduler()
+  scheduler:_build_graph(ECS._update_order)
+  local ndeps = {}
+  for idx, node in ipairs(scheduler._nodes) do ndeps[idx] = node.ndeps end
+  t.ok(t.eq(ndeps, {0, 1, 0, 3, 2, 1}),
+       "Only read/write conflicts (and undeclared systems) are ordered")
+
+  ECS:set_scheduler(scheduler)
+  ECS:update()
+  local pos = {}
+  for idx, name in ipairs(run_order) do pos[name] = idx end
+  t.ok(#run_order == 6, "Every system updated once")
+  t.ok(pos.a < pos.b and pos.c < pos.e, "Writers run before readers")
+  t.ok(pos.a < pos.d and pos.b < pos.d and pos.c < pos.d and pos.d < pos.e
+       and pos.d < pos.f, "Undeclared system keeps its update order")
+
+  -- a native system's job finishes before dependent systems run
+  local job_system = jobs.JobSystem({threads = 1})
+  local ECS2 = ecs.ECS()
+  local counter = terralib.new(int32[1])
+  local NativeSystem = ecs.System:extend("NativeSystem")
+  function NativeSystem:init()
+    NativeSystem.super.init(self, "native")
+    self.writes = {"counter"}
+  end
+  local terra native_task(arg: &opaque)
+    var counter = [&int32](arg)
+    @counter = @counter + 41
+  end
+  function NativeSystem:parallel_task()
+    return native_task, counter
+  end
+  function NativeSystem:finish_parallel_task()
+    self.finished = true
+  end
+  local native = ECS2:add_system(NativeSystem())
+  local ReadSystem = ecs.System:extend("ReadSystem")
+  function ReadSystem:init()
+    ReadSystem.super.init(self, "reader")
+    self.reads = {"counter"}
+  end
+  function ReadSystem:update()
+    self.seen = counter[0]
+  end
+  local reader = ECS2:add_system(ReadSystem())
+  counter[0] = 1
+  ECS2:set_scheduler(ecs.SystemScheduler({jobs = job_system}))
+  ECS2:update()
+  t.ok(native.finished, "Native task finished on the main thread")
+  t.ok(reader.seen == 42, "Reader ran after the native writer")
+  local timed = false
+  for _, evt in ipairs(ECS2.timings) do
+    if evt.name == "native" and evt.dt >= 0 then timed = true end
+  end
+  t.ok(timed, "Native task timed")
+  job_system:release()
+end
+
 function m.run(test)
   test("ECS scenegraph", test_scenegraph)
   test("ECS events", test_events)
   test("ECS systems", test_systems)
   test("ECS components", test_components)
+  test("ECS archetypes", test_archetypes)
+  test("ECS scheduler", test_scheduler)
+  test("ECS transform store", test_transformstore)
 end
 
 return m
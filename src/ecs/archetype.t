@@ -0,0 +1,286 @@
+-- ecs/archetype.t
+--
+-- dense (struct-of-arrays) component storage, for systems whose
+-- components are plain terra data and which update them with a
+-- compiled kernel rather than per-component Lua calls
+--
+-- Rows are addressed through stable integer handles. Adds and
+-- removes requested while the system is updating are deferred until
+-- the update finishes. Removed rows are only marked dead (and stop
+-- being visible through their handles) until the next flush compacts
+-- them away stably, so iteration order is always insertion order.
+
+local substrate = require("substrate")
+local System = require("./system.t").System
+local Component = require("./component.t").Component
+local m = {}
+
+-- columns: list of {name, terra type}
+function m.ArchetypeData(columns)
+  local Vec = substrate.Vec
+  local derive = substrate.derive
+
+  local struct ArchetypeData {
+    next_handle: uint32;
+    ndead: uint32;
+    handles: Vec(uint32);
+    dead: Vec(uint8);
+    rows: substrate.HashMap(uint32, uint32);
+  }
+  local names = {}
+  for idx, col in ipairs(columns) do
+    local name, T = col[1], col[2]
+    assert(type(name) == "string" and T, "column " .. idx .. " should be {name, type}")
+    assert(derive.is_plain_data(T), "archetype column " .. name .. " is not plain data")
+    ArchetypeData.entries:insert({field = name, type = Vec(T)})
+    names[idx] = name
+  end
+  derive.derive_init(ArchetypeData)
+  derive.derive_release(ArchetypeData)
+
+  local function each_column(f)
+    local statements = {}
+    for _, name in ipairs(names) do
+      table.insert(statements, f(name))
+    end
+    return statements
+  end
+
+  terra ArchetypeData:size(): uint32
+    return self.handles.size
+  end
+
+  terra ArchetypeData:reserve_handle(): uint32
+    var h = self.next_handle
+    self.next_handle = self.next_handle + 1
+    return h
+  end
+
+  -- appends a zeroed row for a handle from :reserve_handle; returns row
+  terra ArchetypeData:add_row(handle: uint32): uint32
+    var row = self.handles.size
+    self.handles:push_val(handle)
+    self.dead:push_val(0)
+    [each_column(function(name)
+      return quote self.[name]:push_new() end
+    end)]
+    self.rows:put_val(handle, row)
+    return row
+  end
+
+  terra ArchetypeData:add(): uint32
+    var h = self:reserve_handle()
+    self:add_row(h)
+    return h
+  end
+
+  -- returns -1 if the handle isn't (or is no longer) present
+  terra ArchetypeData:row_of(handle: uint32): int64
+    var row = self.rows:find_val(handle)
+    if row == nil or self.dead.data[@row] ~= 0 then return -1 end
+    return @row
+  end
+
+  -- rows which haven't been marked dead
+  terra ArchetypeData:live_size(): uint32
+    return self.handles.size - self.ndead
+  end
+
+  -- the row is only actually removed on :compact
+  terra ArchetypeData:mark_dead(handle: uint32): bool
+    var row = self:row_of(handle)
+    if row < 0 then return false end
+    self.dead.data[row] = 1
+    self.ndead = self.ndead + 1
+    return true
+  end
+
+  -- stably removes dead rows
+  terra ArchetypeData:compact()
+    if self.ndead == 0 then return end
+    var n = self.handles.size
+    var dest: uint32 = 0
+    for src = 0, n do
+      var handle = self.handles.data[src]
+      if self.dead.data[src] ~= 0 then
+        self.rows:remove_val(handle)
+      else
+        if dest ~= src then
+          self.handles.data[dest] = handle
+          [each_column(function(name)
+            return quote self.[name].data[dest] = self.[name].data[src] end
+          end)]
+          @(self.rows:find_val(handle)) = dest
+        end
+        self.dead.data[dest] = 0
+        dest = dest + 1
+      end
+    end
+    self.handles:resize(dest)
+    self.dead:resize(dest)
+    [each_column(function(name)
+      return quote self.[name]:resize(dest) end
+    end)]
+    self.ndead = 0
+  end
+
+  ArchetypeData.column_names = names
+  return ArchetypeData
+end
+
+local ArchetypeSystem = System:extend("ArchetypeSystem")
+m.ArchetypeSystem = ArchetypeSystem
+
+-- columns: list of {name, terra type}
+-- kernel_builder(DataType) should return a terra function taking
+-- (data: &DataType) which updates all rows
+-- funcname (optional): also call this on any ordinary components
+-- registered with the system, like a plain System
+function ArchetypeSystem:init(mount_name, columns, kernel_builder, funcname)
+  ArchetypeSystem.super.init(self, mount_name)
+  self.funcname = funcname
+  self.DataType = m.ArchetypeData(columns)
+  self.data = terralib.new(self.DataType)
+  self.data:init()
+  if kernel_builder then
+    self.kernel = kernel_builder(self.DataType)
+  end
+  self._pending_adds = {}
+  self._pending_removes = {}
+end
+
+-- adds a row, optionally setting initial column values
+-- (values: {colname = value}); returns its handle
+function ArchetypeSystem:add_row(values)
+  local handle = self.data:reserve_handle()
+  if self._iterating then
+    table.insert(self._pending_adds, {handle, values})
+  else
+    self:_add_row(handle, values)
+  end
+  return handle
+end
+
+function ArchetypeSystem:_add_row(handle, values)
+  local row = self.data:add_row(handle)
+  if values then
+    for name, val in pairs(values) do
+      self.data[name].data[row] = val
+    end
+  end
+end
+
+-- (outside of an update the row is marked dead right away, but only
+-- compacted away on the next flush, so that bulk removes stay linear)
+function ArchetypeSystem:remove_row(handle)
+  if self._iterating then
+    table.insert(self._pending_removes, handle)
+  else
+    self.data:mark_dead(handle)
+  end
+end
+
+-- pointer to a row's value in a column (or nil); only valid until
+-- the next add/remove is applied
+function ArchetypeSystem:get(handle, colname)
+  local row = self.data:row_of(handle)
+  if row < 0 then return nil end
+  return self.data[colname].data + row
+end
+
+function ArchetypeSystem:num_rows()
+  return self.data:live_size()
+end
+
+-- applies deferred adds and then removes (so that a row added and
+-- removed during the same update is removed), and compacts
+function ArchetypeSystem:_flush()
+  local adds = self._pending_adds
+  self._pending_adds = {}
+  for _, add in ipairs(adds) do
+    self:_add_row(add[1], add[2])
+  end
+  for _, handle in ipairs(self._pending_removes) do
+    self.data:mark_dead(handle)
+  end
+  self._pending_removes = {}
+  self.data:compact()
+end
+
+function ArchetypeSystem:update()
+  self:_flush()
+  self._iterating = true
+  if self.kernel then self.kernel(self.data) end
+  self._iterating = false
+  ArchetypeSystem.super.update(self)
+  self:_flush()
+end
+
+-- (see scheduler.t) the kernel runs on a worker thread, while
+-- adds and removes are deferred as they are during :update
+function ArchetypeSystem:parallel_task()
+  if not self.kernel then return nil end
+  if not self._task_fn then
+    local DataType, kernel = self.DataType, self.kernel
+    self._task_fn = terra(arg: &opaque)
+      kernel([&DataType](arg))
+    end
+  end
+  self:_flush()
+  self._iterating = true
+  return self._task_fn, terralib.cast(&opaque, self.data)
+end
+
+function ArchetypeSystem:finish_parallel_task()
+  self._iterating = false
+  ArchetypeSystem.super.update(self)
+  self:_flush()
+end
+
+function ArchetypeSystem:release()
+  self.data:release()
+end
+
+-- a component that owns one row in an ArchetypeSystem, so that
+-- archetype data can be attached to entities like any component
+local ArchetypeComponent = Component:extend("ArchetypeComponent")
+m.ArchetypeComponent = ArchetypeComponent
+
+function ArchetypeComponent:init(system_name, values)
+  self.mount_name = self.mount_name or system_name
+  self._system_name = system_name
+  self._initial_values = values
+end
+
+function ArchetypeComponent:mount(compname)
+  ArchetypeComponent.super.mount(self, compname)
+  self._system = self.ecs.systems[self._system_name]
+  if not self._system then
+    truss.error("No archetype system named " .. self._system_name)
+  end
+  self.handle = self._system:add_row(self._initial_values)
+  self._initial_values = nil
+end
+
+function ArchetypeComponent:get(colname)
+  return self._system:get(self.handle, colname)
+end
+
+function ArchetypeComponent:_remove_row()
+  if self._system and self.handle then
+    self._system:remove_row(self.handle)
+    self.handle = nil
+  end
+end
+
+function ArchetypeComponent:unmount()
+  self:_remove_row()
+  ArchetypeComponent.super.unmount(self)
+end
+
+function ArchetypeComponent:destroy()
+  self:_remove_row()
+  ArchetypeComponent.super.destroy(self)
+end
+
+return m
@@ -47,9 +47,26 @@ function ECS:add_system(system, name)
   if self.systems[name] then truss.error("System name " .. name .. "taken!") end
   self.systems[name] = system
   table.insert(self._update_order, system)
+  if self.scheduler then self.scheduler:invalidate() end
   return system
 end
 
+-- releases any native resources held by systems (in reverse update
+-- order); the ECS shouldn't be updated afterwards
+function ECS:release()
+  for idx = #self._update_order, 1, -1 do
+    local system = self._update_order[idx]
+    if system.release then system:release() end
+  end
+end
+
+-- scheduler: e.g., a scheduler.SystemScheduler to run systems in
+-- parallel, or nil to go back to updating them serially
+function ECS:set_scheduler(scheduler)
+  self.scheduler = scheduler
+  if scheduler then scheduler:invalidate() end
+end
+
 function ECS:_start_timing()
   if self.timing_enabled == false then return end
 
@@ -59,23 +76,41 @@ function ECS:_start_timing()
   self._lastdt = 0
 end
 
-function ECS:insert_timing_event(evt_type, evt_info)
+-- thread, t_start, t_end (optional): for events that were timed
+-- separately (e.g., jobs), the worker index that ran it (0 is the
+-- main thread) along with the start and end counters (timing.tic)
+function ECS:insert_timing_event(evt_type, evt_info, thread, t_start, t_end)
   if self.timing_enabled == false then return end
 
+  if t_start then
+    local freq = tonumber(timing.get_freq())
+    local dt = tonumber(t_end - t_start) / freq
+    local cumulative_dt = tonumber(t_end - self._t0) / freq
+    table.insert(self._current_timings, {name = evt_type, info = evt_info,
+                                         dt = dt, cdt = cumulative_dt,
+                                         thread = thread or 0})
+    return
+  end
+
   local cumulative_dt = timing.toc(self._t0)
   local dt = cumulative_dt - self._lastdt
   self._lastdt = cumulative_dt
   table.insert(self._current_timings, {name = evt_type, info = evt_info,
-                                       dt = dt, cdt = cumulative_dt})
+                                       dt = dt, cdt = cumulative_dt,
+                                       thread = 0})
 end
 
 function ECS:update()
   self:insert_timing_event("frame_start")
 
   -- update systems
-  for _, system in ipairs(self._update_order) do
-    system:update(self)
-    self:insert_timing_event(system.mount_name)
+  if self.scheduler then
+    self.scheduler:update(self)
+  else
+    for _, system in ipairs(self._update_order) do
+      system:update(self)
+      self:insert_timing_event(system.mount_name)
+    end
   end
 
   self:insert_timing_event("frame_end")
@@ -86,6 +86,9 @@ end
 -- if the operation would cause a cycle, an error is thrown
 function Entity:set_parent(parent)
   if parent == self.parent then return end
+  -- flattened transform stores need to rebuild on topology changes
+  if self._tf_store then self._tf_store:invalidate() end
+  if parent and parent._tf_store then parent._tf_store:invalidate() end
   if self.parent then
     self.parent.children[self] = nil
   end
@@ -266,6 +269,13 @@ end
 
 function Entity3d:update_matrix()
   self.matrix:compose(self.position, self.quaternion, self.scale)
+  if self._tf_store then self._tf_store:mark_dirty(self) end
+end
+
+-- call after modifying .matrix directly, so that a TransformStore
+-- (see ecs/transformstore.t) knows to recompute this subtree
+function Entity3d:transform_changed()
+  if self._tf_store then self._tf_store:mark_dirty(self) end
 end
 
 -- recursively calculate world matrices
@@ -10,7 +10,9 @@ modutils.include_submodules({
   "ecs/component.t",
   "ecs/system.t",
   "ecs/event.t",
-  "ecs/ecs.t"
+  "ecs/ecs.t",
+  "ecs/archetype.t",
+  "ecs/scheduler.t"
 }, ecs)
 
 return ecs
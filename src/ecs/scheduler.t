@@ -0,0 +1,179 @@
+-- ecs/scheduler.t
+--
+-- runs ECS systems in parallel based on declared read/write sets
+--
+-- Systems declare the component types they touch:
+--   system.reads = {"transform", "velocity"}
+--   system.writes = {"position"}
+-- Two systems conflict if either writes something the other reads
+-- or writes; a system that declares neither conflicts with everything.
+-- Conflicting systems keep their ECS update order, and everything
+-- else is free to overlap.
+--
+-- Only terra code can run off the main thread. A system that
+-- provides :parallel_task() -> (terra function(&opaque), &opaque)
+-- has that run as a job (then :finish_parallel_task() is
+-- called back on the main thread, if present); all other systems
+-- just have :update(ecs) called on the main thread.
+
+local class = require("class")
+local jobs = require("async/jobs.t")
+local timing = require("osnative/timing.t")
+local m = {}
+
+-- adapts a system's (fn, arg) task into a job
+local struct TaskRecord {
+  fn: {&opaque} -> {};
+  arg: &opaque;
+}
+m.TaskRecord = TaskRecord
+
+local terra run_task(job: &jobs.Job, arg: &opaque)
+  var task = [&TaskRecord](arg)
+  task.fn(task.arg)
+end
+
+local SystemScheduler = class("SystemScheduler")
+m.SystemScheduler = SystemScheduler
+
+-- options.jobs: the async/jobs.t JobSystem to run parallel tasks on
+-- (default: the shared one)
+function SystemScheduler:init(options)
+  options = options or {}
+  self.jobs = options.jobs or jobs.default_job_system()
+  self._graph_dirty = true
+end
+
+function SystemScheduler:invalidate()
+  self._graph_dirty = true
+end
+
+local function to_set(list)
+  if not list then return nil end
+  local ret = {}
+  for _, name in ipairs(list) do ret[name] = true end
+  return ret
+end
+
+local function intersects(a, b)
+  for k, _ in pairs(a) do
+    if b[k] then return true end
+  end
+  return false
+end
+
+local function conflicts(a, b)
+  if not (a.reads and b.reads) then return true end
+  return intersects(a.writes, b.reads) or intersects(a.writes, b.writes)
+      or intersects(b.writes, a.reads)
+end
+
+function SystemScheduler:_build_graph(systems)
+  local nodes = {}
+  for idx, system in ipairs(systems) do
+    local declared = system.reads or system.writes
+    nodes[idx] = {
+      system = system,
+      reads = declared and to_set(system.reads or {}),
+      writes = declared and to_set(system.writes or {}),
+      dependents = {},
+      ndeps = 0,
+      task = terralib.new(TaskRecord)
+    }
+  end
+  -- edges always point forward in update order, so the graph is acyclic
+  for j = 1, #nodes do
+    for i = 1, j - 1 do
+      if conflicts(nodes[i], nodes[j]) then
+        table.insert(nodes[i].dependents, j)
+        nodes[j].ndeps = nodes[j].ndeps + 1
+      end
+    end
+  end
+  self._nodes = nodes
+  self._graph_dirty = false
+end
+
+function SystemScheduler:_start_task(node)
+  local fn, arg = node.system:parallel_task()
+  if not fn then return false end
+  local task = node.task
+  task.fn = fn:getpointer()
+  task.arg = arg
+  node.job = self.jobs:submit(run_task, task)
+  return true
+end
+
+function SystemScheduler:_finish_task(ecs, node)
+  local system = node.system
+  if system.finish_parallel_task then system:finish_parallel_task() end
+  local job = node.job
+  ecs:insert_timing_event(system.mount_name, nil, job.worker,
+                          job.t_start, job.t_end)
+  self.jobs:release_job(job)
+  node.job = nil
+end
+
+function SystemScheduler:update(ecs)
+  if self._graph_dirty then self:_build_graph(ecs._update_order) end
+  local nodes = self._nodes
+  local remaining, ready, running = {}, {}, {}
+  for idx, node in ipairs(nodes) do
+    remaining[idx] = node.ndeps
+    if node.ndeps == 0 then table.insert(ready, idx) end
+  end
+
+  local ndone = 0
+  local function complete(idx)
+    ndone = ndone + 1
+    for _, dep in ipairs(nodes[idx].dependents) do
+      remaining[dep] = remaining[dep] - 1
+      if remaining[dep] == 0 then table.insert(ready, dep) end
+    end
+  end
+
+  while ndone < #nodes do
+    -- start every ready native system first, so that they overlap
+    -- with the main thread ones
+    local main_ready = {}
+    table.sort(ready)
+    for _, idx in ipairs(ready) do
+      local node = nodes[idx]
+      if node.system.parallel_task and self:_start_task(node) then
+        table.insert(running, idx)
+      else
+        table.insert(main_ready, idx)
+      end
+    end
+    ready = {}
+
+    -- (timed individually, since the main thread may also have been
+    -- helping with jobs since the last event)
+    for _, idx in ipairs(main_ready) do
+      local system = nodes[idx].system
+      local t_start = timing.tic()
+      system:update(ecs)
+      ecs:insert_timing_event(system.mount_name, nil, 0,
+                              t_start, timing.tic())
+      complete(idx)
+    end
+
+    local still_running = {}
+    for _, idx in ipairs(running) do
+      local node = nodes[idx]
+      if self.jobs:is_finished(node.job) then
+        self:_finish_task(ecs, node)
+        complete(idx)
+      else
+        table.insert(still_running, idx)
+      end
+    end
+    running = still_running
+
+    if #ready == 0 and #running > 0 then
+      self.jobs:help()
+    end
+  end
+end
+
+return m
@@ -0,0 +1,168 @@
+-- ecs/transformstore.t
+--
+-- flat storage for the world matrices of an Entity3d tree
+--
+-- The local/world matrices of every entity under a root are kept in
+-- packed arrays in parent-before-child order, and the entities'
+-- .matrix/.matrix_world are rebound to view into those arrays. World
+-- matrices are then recomputed in one linear pass that only touches
+-- entities whose local matrix (or some ancestor's) has been marked
+-- dirty (Entity3d:update_matrix does this automatically; if you write
+-- .matrix directly, call ent:transform_changed()).
+--
+-- Reparenting anything in the tree triggers a full rebuild on the
+-- next update. Don't replace the .matrix/.matrix_world objects of
+-- bound entities.
+
+local class = require("class")
+local substrate = require("substrate")
+local matrix = require("math/matrix.t")
+local batch = require("math/batch.t")
+local m = {}
+
+local scalar_ = require("math/types.t").scalar_
+
+-- (built lazily, since building substrate types freezes its config)
+m.build_arrays = terralib.memoize(function()
+  local Vec = substrate.Vec
+
+  local struct TransformArrays {
+    locals: Vec(scalar_);
+    worlds: Vec(scalar_);
+    parents: Vec(int32);
+    dirty: Vec(uint8);
+  }
+  substrate.derive.derive_init(TransformArrays)
+  substrate.derive.derive_release(TransformArrays)
+
+  terra TransformArrays:resize(n: uint32)
+    self.locals:resize(n*16)
+    self.worlds:resize(n*16)
+    self.parents:resize(n)
+    self.dirty:resize(n)
+  end
+
+  terra TransformArrays:mark_all_dirty()
+    substrate.intrinsics.memset(self.dirty.data, 1, self.dirty.size)
+  end
+
+  -- recomputes dirty world matrices; returns how many were recomputed
+  terra TransformArrays:update(root_world: &scalar_): uint32
+    var n = self.parents.size
+    var parents, dirty = self.parents.data, self.dirty.data
+    var locals, worlds = self.locals.data, self.worlds.data
+    var nupdated: uint32 = 0
+    for i = 0, n do
+      var p = parents[i]
+      -- parents always come before their children, so the parent's
+      -- flag already accounts for all of its ancestors
+      if p >= 0 and dirty[p] ~= 0 then dirty[i] = 1 end
+      if dirty[i] ~= 0 then
+        var parent_world = root_world
+        if p >= 0 then parent_world = worlds + p*16 end
+        batch.left_multiply_matrices(worlds + i*16, parent_world, locals + i*16, 1)
+        nupdated = nupdated + 1
+      end
+    end
+    if nupdated > 0 then
+      substrate.intrinsics.memset(dirty, 0, n)
+    end
+    return nupdated
+  end
+
+  return TransformArrays
+end)
+
+local TransformStore = class("TransformStore")
+m.TransformStore = TransformStore
+
+function TransformStore:init(root)
+  self.root = root
+  self._arrays = terralib.new(m.build_arrays())
+  self._arrays:init()
+  self._root_world = terralib.new(scalar_[16])
+  matrix.set_identity_matrix(self._root_world)
+  self._entities = {}
+  self._topology_dirty = true
+  self.last_update_count = 0
+end
+
+-- forces a rebuild of the flattened tree on the next update
+function TransformStore:invalidate()
+  self._topology_dirty = true
+end
+
+function TransformStore:mark_dirty(ent)
+  if self._topology_dirty then return end -- rebuild marks everything
+  self._arrays.dirty.data[ent._tf_index] = 1
+end
+
+function TransformStore:_unbind_all()
+  for _, ent in ipairs(self._entities) do
+    if ent._tf_store == self then
+      ent.matrix:bind_storage(nil)
+      ent.matrix_world:bind_storage(nil)
+      ent._tf_store = nil
+      ent._tf_index = nil
+    end
+  end
+  self._entities = {}
+end
+
+-- (same traversal rules as the renderer: stop at entities without matrices)
+local function flatten(ent, order)
+  if not (ent.matrix and ent.matrix_world) then return end
+  table.insert(order, ent)
+  for _, child in pairs(ent.children) do
+    flatten(child, order)
+  end
+end
+
+function TransformStore:rebuild()
+  self:_unbind_all()
+  local order = {}
+  flatten(self.root, order)
+  local arrays = self._arrays
+  arrays:resize(#order)
+  local parents = arrays.parents.data
+  local locals, worlds = arrays.locals.data, arrays.worlds.data
+  for idx, ent in ipairs(order) do
+    local i = idx - 1
+    if ent._tf_store and ent._tf_store ~= self then
+      -- e.g., a subtree that used to have its own store
+      ent._tf_store:_unbind_all()
+      ent._tf_store:invalidate()
+    end
+    ent._tf_store = self
+    ent._tf_index = i
+    local parent_idx = ent.parent and ent.parent._tf_store == self and ent.parent._tf_index
+    parents[i] = (ent ~= self.root and parent_idx) or -1
+    ent.matrix:bind_storage(locals + i*16)
+    ent.matrix_world:bind_storage(worlds + i*16)
+  end
+  self._entities = order
+  arrays:mark_all_dirty()
+  self._topology_dirty = false
+end
+
+-- sets the transform that the root is relative to (default identity)
+function TransformStore:set_root_transform(mat)
+  matrix.copy_matrix(self._root_world, mat.data)
+  if not self._topology_dirty then
+    self._arrays.dirty.data[0] = 1
+  end
+end
+
+function TransformStore:update()
+  if self._topology_dirty then self:rebuild() end
+  self.last_update_count = self._arrays:update(self._root_world)
+  return self.last_update_count
+end
+
+function TransformStore:release()
+  self:_unbind_all()
+  self._arrays:release()
+  self._topology_dirty = true
+end
+
+return m
@@ -0,0 +1,111 @@
+-- native .obj parser tests
+
+local m = {}
+
+local function test_obj(jape)
+  local obj = require("./obj.t")
+  local test, expect = jape.test, jape.expect
+
+  local function indices_of(mesh)
+    local ret = {}
+    for i = 0, tonumber(mesh:n_indices()) - 1 do
+      ret[i + 1] = mesh.indices.data[i]
+    end
+    return ret
+  end
+
+  local function floats_of(vec)
+    local ret = {}
+    for i = 0, tonumber(vec.size) - 1 do ret[i + 1] = vec.data[i] end
+    return ret
+  end
+
+  test("relative indices across chunks", function()
+    local src = table.concat({
+      "# a quad",
+      "v 0 0 0",
+      "v 1 0 0",
+      "v 1 1 0",
+      "v 0 1 0",
+      "f -4 -3 -2 -1",
+      "v 2 2 2",
+      "f 5 -2 -1"
+    }, "\n")
+    -- (one line per chunk, so the faces refer back into other chunks)
+    for _, n_chunks in ipairs({1, 3, 8}) do
+      local mesh = obj.parse_obj_native(src, {chunks = n_chunks})
+      expect(tonumber(mesh:n_vertices())):to_be(5)
+      expect(indices_of(mesh)):to_equal({0, 1, 2, 0, 2, 3, 4, 3, 4})
+      expect(floats_of(mesh.positions)):to_equal(
+        {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 2, 2, 2})
+      expect(tonumber(mesh.normals.size)):to_be(0)
+      expect(tonumber(mesh.uvs.size)):to_be(0)
+      mesh:release()
+    end
+  end)
+
+  test("corner forms", function()
+    local src = table.concat({
+      "v 1.5e1 -2.25 .5",
+      "v 1 0 0",
+      "v 0 1 0",
+      "vt 0.5 0.25",
+      "vn 0 0 1",
+      "f 1/1 2/1 3/1",
+      "f 1//1 2//1 3//1",
+      "f 1/1/1 2/1/1 3/1/1",
+      "f 1 2 3"
+    }, "\n")
+    local mesh = obj.parse_obj_native(src, {chunks = 4})
+    -- each distinct (position, uv, normal) is its own vertex
+    expect(tonumber(mesh:n_vertices())):to_be(12)
+    expect(indices_of(mesh)):to_equal({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11})
+    local p, t, n = mesh.positions.data, mesh.uvs.data, mesh.normals.data
+    expect({p[0], p[1], p[2]}):to_equal({15.0, -2.25, 0.5})
+    -- v/t
+    expect({t[0], t[1]}):to_equal({0.5, 0.25})
+    expect({n[0], n[1], n[2]}):to_equal({0, 0, 0})
+    -- v//n
+    expect({t[6], t[7]}):to_equal({0, 0})
+    expect({n[9], n[10], n[11]}):to_equal({0, 0, 1})
+    -- v/t/n
+    expect({t[12], t[13]}):to_equal({0.5, 0.25})
+    expect({n[18], n[19], n[20]}):to_equal({0, 0, 1})
+    -- v
+    expect({t[18], t[19]}):to_equal({0, 0})
+    expect({n[27], n[28], n[29]}):to_equal({0, 0, 0})
+    mesh:release()
+  end)
+
+  test("shared corners are welded", function()
+    local src = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvn 0 0 1\n"
+                .. "f 1//1 2//1 3//1 4//1\n"
+    local mesh = obj.parse_obj_native(src)
+    expect(tonumber(mesh:n_vertices())):to_be(4)
+    expect(indices_of(mesh)):to_equal({0, 1, 2, 0, 2, 3})
+    mesh:release()
+  end)
+
+  test("out of range indices", function()
+    local mesh, err = obj.parse_obj_native("v 0 0 0\nv 1 0 0\nf 1 2 3\n")
+    expect(mesh):to_be(nil)
+    expect(err):to_be_truthy()
+    mesh, err = obj.parse_obj_native("v 0 0 0\nf -1 -2 -1\n", {chunks = 2})
+    expect(mesh):to_be(nil)
+    mesh, err = obj.parse_obj_native("v 0 0 0\nvn 0 0 1\nf 1//1 1//2 1//1\n")
+    expect(mesh):to_be(nil)
+  end)
+
+  test("invert", function()
+    local src = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n"
+    local mesh = obj.parse_obj_native(src, {invert = true})
+    expect(indices_of(mesh)):to_equal({0, 2, 1, 0, 3, 2})
+    mesh:release()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("obj", test_obj)
+end
+
+return m
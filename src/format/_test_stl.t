@@ -0,0 +1,100 @@
+-- binary STL loader tests
+
+local m = {}
+
+local ffi = require("ffi")
+
+local function test_stl(jape)
+  local stl = require("./stl.t")
+  local test, expect = jape.test, jape.expect
+
+  -- an in-memory binary STL of triangles {{x,y,z}, {x,y,z}, {x,y,z}}
+  -- (stored normals are left zeroed, as many writers do)
+  local function make_stl(tris, ntris_header)
+    local len = 84 + 50 * #tris
+    local data = terralib.new(uint8[len])
+    ffi.fill(data, len, 0)
+    ffi.cast("uint32_t*", data + 80)[0] = ntris_header or #tris
+    for t, tri in ipairs(tris) do
+      local floats = ffi.cast("float*", data + 84 + 50 * (t - 1))
+      for c = 1, 3 do
+        for k = 1, 3 do floats[c * 3 + k - 1] = tri[c][k] end
+      end
+    end
+    return data, len
+  end
+
+  local quad = {
+    {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}},
+    {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}}
+  }
+
+  test("validation", function()
+    local data, len = make_stl(quad)
+    expect(stl.validate_binary_stl(data, len)):to_be(2)
+    expect(stl.validate_binary_stl(data, len - 50)):to_be(nil)
+    -- trailing bytes are fine
+    expect(stl.validate_binary_stl(make_stl(quad, 1))):to_be(1)
+
+    local ntris, err = stl.validate_binary_stl(data, 40)
+    expect(ntris):to_be(nil)
+    expect(err:find("too short")):to_be_truthy()
+
+    ntris, err = stl.validate_binary_stl(make_stl(quad, 3))
+    expect(ntris):to_be(nil)
+    expect(err:find("truncated")):to_be_truthy()
+
+    local ascii = "solid cube\n  facet normal 0 0 1\n" .. (" "):rep(80)
+    ntris, err = stl.validate_binary_stl(terralib.cast(&uint8, ascii), #ascii)
+    expect(ntris):to_be(nil)
+    expect(err:find("ASCII")):to_be_truthy()
+  end)
+
+  local Vert = terralib.types.newstruct("stl_test_vertex")
+  Vert.entries = {{"position", float[3]}, {"normal", float[3]}}
+  Vert:complete()
+
+  local function convert(weld, invert)
+    local data = make_stl(quad)
+    local verts = terralib.new(Vert[6])
+    local indices = terralib.new(uint32[6])
+    local vertex_map = terralib.new(stl.PositionMap)
+    vertex_map:init()
+    local nverts = stl._convert_fn(Vert, uint32, weld)(data, 2, invert or false,
+                                                      verts, indices, vertex_map)
+    vertex_map:release()
+    local idx = {}
+    for i = 0, 5 do idx[i + 1] = indices[i] end
+    return nverts, idx, verts
+  end
+
+  test("unwelded conversion", function()
+    local nverts, indices, verts = convert(false)
+    expect(nverts):to_be(6)
+    expect(indices):to_equal({0, 1, 2, 3, 4, 5})
+    expect({verts[4].position[0], verts[4].position[1]}):to_equal({1, 1})
+    -- normals come from the positions, not the (zeroed) stored ones
+    for i = 0, 5 do
+      expect(verts[i].normal[2]):to_be_close(1.0)
+    end
+    nverts, indices, verts = convert(false, true)
+    expect(indices):to_equal({0, 2, 1, 3, 5, 4})
+    expect(verts[0].normal[2]):to_be_close(-1.0)
+  end)
+
+  test("welded conversion", function()
+    local nverts, indices, verts = convert(true)
+    expect(nverts):to_be(4)
+    expect(indices):to_equal({0, 1, 2, 0, 2, 3})
+    for i = 0, 3 do
+      expect(verts[i].normal[0]):to_be_close(0.0)
+      expect(verts[i].normal[2]):to_be_close(1.0)
+    end
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("stl", test_stl)
+end
+
+return m
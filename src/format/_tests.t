@@ -0,0 +1,10 @@
+local m = {}
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("format", function(jape)
+    require("./_test_obj.t").init(jape)
+    require("./_test_stl.t").init(jape)
+  end)
+end
+
+return m
@@ -196,6 +196,613 @@ function m.parse_obj(objstring, invert)
   return ret
 end
 
+-- native parser --
+--
+-- The source is split into line-aligned chunks which are parsed in
+-- parallel (as async/jobs.t jobs) into per-chunk attribute and face
+-- arrays; these are then stitched together into flat position/normal/uv
+-- and uint32 index arrays, which can be copied straight into a
+-- StaticGeometry. Polygons are triangulated as fans.
+
+local substrate = require("substrate")
+local jobs = require("async/jobs.t")
+local Vec = substrate.Vec
+
+local FloatVec = Vec(float)
+
+-- don't bother splitting files into chunks smaller than this
+m.MIN_CHUNK_BYTES = 2^16
+
+local CH_NEWLINE, CH_SPACE, CH_TAB = 10, 32, 9
+local CH_ZERO, CH_NINE = ("0"):byte(), ("9"):byte()
+local CH_PLUS, CH_MINUS, CH_DOT = ("+"):byte(), ("-"):byte(), ("."):byte()
+local CH_SLASH = ("/"):byte()
+local CH_LOWER_E, CH_UPPER_E = ("e"):byte(), ("E"):byte()
+local CH_V, CH_N, CH_T, CH_F = ("v"):byte(), ("n"):byte(), ("t"):byte(),
+                               ("f"):byte()
+
+local POW10 = terralib.constant(double[23], (function()
+  local p = {}
+  for i = 0, 22 do p[i + 1] = 10^i end
+  return p
+end)())
+
+local terra is_blank(c: uint8): bool
+  return c == CH_SPACE or c == CH_TAB
+end
+
+local terra is_digit(c: uint8): bool
+  return c >= CH_ZERO and c <= CH_NINE
+end
+
+local terra skip_blank(p: &uint8, stop: &uint8): &uint8
+  while p < stop and is_blank(@p) do p = p + 1 end
+  return p
+end
+
+-- returns the start of the next line
+local terra next_line(p: &uint8, stop: &uint8): &uint8
+  while p < stop and @p ~= CH_NEWLINE do p = p + 1 end
+  if p < stop then p = p + 1 end
+  return p
+end
+
+-- reads a decimal float ([+-]digits[.digits][(e|E)[+-]digits]) at @pp,
+-- advancing it; returns 0 if there is no number there. Up to 19
+-- significant digits are kept (plenty for a float), and the mantissa
+-- is scaled by an exactly representable power of ten when possible.
+local terra parse_float(pp: &&uint8, stop: &uint8): float
+  var p = skip_blank(@pp, stop)
+  var negative = false
+  if p < stop and (@p == CH_MINUS or @p == CH_PLUS) then
+    negative = (@p == CH_MINUS)
+    p = p + 1
+  end
+  var mantissa: uint64 = 0
+  var exponent: int32 = 0
+  var ndigits = 0
+  while p < stop and is_digit(@p) do
+    if ndigits < 19 then
+      mantissa = mantissa*10 + (@p - CH_ZERO)
+      if mantissa > 0 then ndigits = ndigits + 1 end
+    else
+      exponent = exponent + 1
+    end
+    p = p + 1
+  end
+  if p < stop and @p == CH_DOT then
+    p = p + 1
+    while p < stop and is_digit(@p) do
+      if ndigits < 19 then
+        mantissa = mantissa*10 + (@p - CH_ZERO)
+        exponent = exponent - 1
+        if mantissa > 0 then ndigits = ndigits + 1 end
+      end
+      p = p + 1
+    end
+  end
+  if p < stop and (@p == CH_LOWER_E or @p == CH_UPPER_E) then
+    var q = p + 1
+    var exp_negative = false
+    if q < stop and (@q == CH_MINUS or @q == CH_PLUS) then
+      exp_negative = (@q == CH_MINUS)
+      q = q + 1
+    end
+    -- (an 'e' without digits isn't part of the number)
+    if q < stop and is_digit(@q) then
+      var e: int32 = 0
+      while q < stop and is_digit(@q) do
+        if e < 10000 then e = e*10 + (@q - CH_ZERO) end
+        q = q + 1
+      end
+      if exp_negative then e = -e end
+      exponent = exponent + e
+      p = q
+    end
+  end
+  @pp = p
+  var value = [double](mantissa)
+  if mantissa ~= 0 then
+    while exponent > 22 do
+      value = value * 1e22
+      exponent = exponent - 22
+    end
+    while exponent < -22 do
+      value = value / 1e22
+      exponent = exponent + 22
+    end
+    if exponent > 0 then
+      value = value * POW10[exponent]
+    elseif exponent < 0 then
+      value = value / POW10[-exponent]
+    end
+  end
+  if negative then value = -value end
+  return value
+end
+
+-- reads a decimal integer at @pp, advancing it; 0 if there is none
+local terra parse_int(pp: &&uint8, stop: &uint8): int64
+  var p = @pp
+  var negative = false
+  if p < stop and (@p == CH_MINUS or @p == CH_PLUS) then
+    negative = (@p == CH_MINUS)
+    p = p + 1
+  end
+  var val: int64 = 0
+  while p < stop and is_digit(@p) do
+    val = val*10 + (@p - CH_ZERO)
+    p = p + 1
+  end
+  @pp = p
+  if negative then val = -val end
+  return val
+end
+
+-- Face indices are stored 0-based. A chunk doesn't know how many
+-- attributes came before it, so negative (relative) indices are stored
+-- as RELATIVE + (index within the chunk), and resolved against the
+-- chunk's base once all the chunks have been parsed.
+local MISSING = -1
+local INVALID = -2
+local RELATIVE = terralib.constant(int64, -(2^60))
+
+local terra local_index(idx: int64, count: uint64): int64
+  if idx > 0 then
+    return idx - 1
+  elseif idx < 0 then
+    return RELATIVE + [int64](count) + idx
+  else
+    return MISSING
+  end
+end
+
+local terra resolve_index(idx: int64, base: uint64): int64
+  if idx < RELATIVE / 2 then
+    idx = idx - RELATIVE + [int64](base)
+    if idx < 0 then return INVALID end
+  end
+  return idx
+end
+
+local struct corner_t {
+  p: int64;
+  t: int64;
+  n: int64;
+}
+
+local struct obj_chunk {
+  start: &uint8;
+  stop: &uint8;
+  positions: FloatVec; -- 3 per v
+  normals: FloatVec; -- 3 per vn
+  uvs: FloatVec; -- 2 per vt
+  corners: Vec(corner_t); -- 3 per triangle
+  uses_normals: bool; -- whether any face corner has a normal index
+  uses_uvs: bool;
+  position_base: uint64; -- number of each attribute in previous chunks
+  normal_base: uint64;
+  uv_base: uint64;
+  n_polygons: uint64; -- faces with more than 3 corners (triangulated)
+  n_degenerate: uint64; -- faces with fewer than 3 corners (skipped)
+}
+-- (the Vecs own their data, and start/stop point into the source)
+obj_chunk.substrate = {allow_move_by_memcpy = true}
+
+terra obj_chunk:init()
+  self.start, self.stop = nil, nil
+  self.positions:init()
+  self.normals:init()
+  self.uvs:init()
+  self.corners:init()
+  self.uses_normals, self.uses_uvs = false, false
+  self.position_base, self.normal_base, self.uv_base = 0, 0, 0
+  self.n_polygons, self.n_degenerate = 0, 0
+end
+
+terra obj_chunk:release()
+  self.positions:release()
+  self.normals:release()
+  self.uvs:release()
+  self.corners:release()
+  self:init()
+end
+
+terra obj_chunk:_push_floats(dest: &FloatVec, count: uint32,
+                             p: &uint8, stop: &uint8): &uint8
+  dest:fit_capacity(dest.size + count)
+  for i = 0, count do
+    dest.data[dest.size + i] = parse_float(&p, stop)
+  end
+  dest.size = dest.size + count
+  return p
+end
+
+terra obj_chunk:_parse_face(p: &uint8, stop: &uint8): &uint8
+  var npos = self.positions.size / 3
+  var nnormals = self.normals.size / 3
+  var nuvs = self.uvs.size / 2
+  var first: corner_t, prev: corner_t
+  var ncorners = 0
+  while true do
+    p = skip_blank(p, stop)
+    if p >= stop or not (is_digit(@p) or @p == CH_MINUS or @p == CH_PLUS) then
+      break
+    end
+    -- v, v/t, v//n or v/t/n
+    var c = corner_t{local_index(parse_int(&p, stop), npos), MISSING, MISSING}
+    if p < stop and @p == CH_SLASH then
+      p = p + 1
+      c.t = local_index(parse_int(&p, stop), nuvs)
+      if p < stop and @p == CH_SLASH then
+        p = p + 1
+        c.n = local_index(parse_int(&p, stop), nnormals)
+      end
+    end
+    self.uses_uvs = self.uses_uvs or (c.t ~= MISSING)
+    self.uses_normals = self.uses_normals or (c.n ~= MISSING)
+    if ncorners == 0 then
+      first = c
+    elseif ncorners >= 2 then
+      self.corners:push_val(first)
+      self.corners:push_val(prev)
+      self.corners:push_val(c)
+    end
+    prev = c
+    ncorners = ncorners + 1
+  end
+  if ncorners > 3 then
+    self.n_polygons = self.n_polygons + 1
+  elseif ncorners < 3 then
+    self.n_degenerate = self.n_degenerate + 1
+  end
+  return p
+end
+
+terra obj_chunk:parse()
+  var p, stop = self.start, self.stop
+  while p < stop do
+    p = skip_blank(p, stop)
+    if p + 1 < stop then
+      var c, c1 = p[0], p[1]
+      if c == CH_V and is_blank(c1) then
+        p = self:_push_floats(&self.positions, 3, p + 1, stop)
+      elseif c == CH_V and c1 == CH_N and p + 2 < stop and is_blank(p[2]) then
+        p = self:_push_floats(&self.normals, 3, p + 2, stop)
+      elseif c == CH_V and c1 == CH_T and p + 2 < stop and is_blank(p[2]) then
+        p = self:_push_floats(&self.uvs, 2, p + 2, stop)
+      elseif c == CH_F and is_blank(c1) then
+        p = self:_parse_face(p + 1, stop)
+      end
+      -- (anything else, e.g., comments, groups and materials, is skipped)
+    end
+    p = next_line(p, stop)
+  end
+end
+
+terra obj_chunk:resolve(c: &corner_t): corner_t
+  return corner_t{resolve_index(c.p, self.position_base),
+                  resolve_index(c.t, self.uv_base),
+                  resolve_index(c.n, self.normal_base)}
+end
+
+-- flat vertex arrays (normals and uvs are empty if the faces don't use
+-- them) and 3 indices per triangle
+local struct obj_mesh {
+  positions: FloatVec;
+  normals: FloatVec;
+  uvs: FloatVec;
+  indices: Vec(uint32);
+}
+m.obj_mesh = obj_mesh
+
+terra obj_mesh:init()
+  self.positions:init()
+  self.normals:init()
+  self.uvs:init()
+  self.indices:init()
+end
+
+terra obj_mesh:release()
+  self.positions:release()
+  self.normals:release()
+  self.uvs:release()
+  self.indices:release()
+end
+
+terra obj_mesh:n_vertices(): uint64
+  return self.positions.size / 3
+end
+
+terra obj_mesh:n_indices(): uint64
+  return self.indices.size
+end
+
+local struct obj_parse {
+  chunks: Vec(obj_chunk);
+  positions: FloatVec; -- every chunk's attributes, concatenated
+  normals: FloatVec;
+  uvs: FloatVec;
+  n_polygons: uint64;
+  n_degenerate: uint64;
+  bad_index: bool;
+}
+
+-- splits data into n_chunks chunks, each ending at a line end
+terra obj_parse:init(data: &uint8, len: uint64, n_chunks: uint32)
+  self.chunks:init()
+  self.positions:init()
+  self.normals:init()
+  self.uvs:init()
+  self.n_polygons, self.n_degenerate = 0, 0
+  self.bad_index = false
+  self.chunks:resize(n_chunks)
+  var pos: uint64 = 0
+  for k = 0, n_chunks do
+    var stop = len * (k + 1) / n_chunks
+    if stop < pos then stop = pos end
+    while stop < len and data[stop] ~= CH_NEWLINE do stop = stop + 1 end
+    if stop < len then stop = stop + 1 end
+    var chunk = self.chunks:get_ref(k)
+    chunk.start, chunk.stop = data + pos, data + stop
+    pos = stop
+  end
+end
+
+terra obj_parse:release()
+  self.chunks:release()
+  self.positions:release()
+  self.normals:release()
+  self.uvs:release()
+end
+
+local terra parse_chunk_range(job: &jobs.Job, arg: &opaque, first: uint64, last: uint64)
+  var par = [&obj_parse](arg)
+  for k = first, last do
+    par.chunks.data[k]:parse()
+  end
+end
+
+local terra parse_chunks(job: &jobs.Job, arg: &opaque)
+  var par = [&obj_parse](arg)
+  jobs.spawn_range(job, parse_chunk_range, arg, par.chunks.size, 1)
+end
+
+-- concatenates one attribute of every chunk into dest, recording each
+-- chunk's base (in elements of width floats)
+local function gather_attribute(field, base_field, width)
+  return terra(par: &obj_parse, dest: &FloatVec)
+    var total: uint64 = 0
+    for k = 0, par.chunks.size do
+      var chunk = par.chunks:get_ref(k)
+      chunk.[base_field] = total / width
+      total = total + chunk.[field].size
+    end
+    dest:resize(total)
+    var pos: uint64 = 0
+    for k = 0, par.chunks.size do
+      var src = &par.chunks.data[k].[field]
+      if src.size > 0 then
+        substrate.intrinsics.memcpy(dest.data + pos, src.data, src:size_bytes())
+      end
+      pos = pos + src.size
+    end
+  end
+end
+local gather_positions = gather_attribute("positions", "position_base", 3)
+local gather_normals = gather_attribute("normals", "normal_base", 3)
+local gather_uvs = gather_attribute("uvs", "uv_base", 2)
+
+local terra copy_floats(dest: &FloatVec, src: &FloatVec, idx: int64, width: uint32)
+  if idx < 0 then
+    for k = 0, width do dest:push_val(0.0f) end
+  else
+    for k = 0, width do dest:push_val(src.data[idx*width + k]) end
+  end
+end
+
+-- stitches the parsed chunks into mesh; returns false if a face has an
+-- out of range index
+terra obj_parse:merge(mesh: &obj_mesh, invert: bool): bool
+  var uses_normals, uses_uvs = false, false
+  var ncorners: uint64 = 0
+  for k = 0, self.chunks.size do
+    var chunk = self.chunks:get_ref(k)
+    uses_normals = uses_normals or chunk.uses_normals
+    uses_uvs = uses_uvs or chunk.uses_uvs
+    ncorners = ncorners + chunk.corners.size
+    self.n_polygons = self.n_polygons + chunk.n_polygons
+    self.n_degenerate = self.n_degenerate + chunk.n_degenerate
+  end
+  var welding = uses_normals or uses_uvs
+  mesh.positions:clear()
+  mesh.normals:clear()
+  mesh.uvs:clear()
+  mesh.indices:resize(ncorners)
+
+  -- with only position indices, the positions are the vertices;
+  -- otherwise each distinct (position, uv, normal) is a vertex
+  var positions = &self.positions
+  if not welding then positions = &mesh.positions end
+  gather_positions(self, positions)
+  gather_normals(self, &self.normals)
+  gather_uvs(self, &self.uvs)
+  var npos = [int64](positions.size / 3)
+  var nnormals = [int64](self.normals.size / 3)
+  var nuvs = [int64](self.uvs.size / 2)
+
+  var vertex_map: substrate.HashMap(corner_t, uint32)
+  vertex_map:init()
+  if welding then
+    vertex_map:reserve(ncorners / 2)
+    mesh.positions:fit_capacity(ncorners / 2 * 3)
+  end
+  var nverts: uint32 = 0
+  var idx: uint64 = 0
+  for k = 0, self.chunks.size do
+    var chunk = self.chunks:get_ref(k)
+    for i = 0, chunk.corners.size do
+      var c = chunk:resolve(&chunk.corners.data[i])
+      if c.p < 0 or c.p >= npos or c.t < MISSING or c.t >= nuvs
+         or c.n < MISSING or c.n >= nnormals then
+        self.bad_index = true
+        vertex_map:release()
+        return false
+      end
+      var vidx: uint32
+      if welding then
+        -- (new entries start out as 0, so the map holds index + 1)
+        var slot = vertex_map:get_or_insert_val(c)
+        if @slot == 0 then
+          copy_floats(&mesh.positions, positions, c.p, 3)
+          if uses_normals then copy_floats(&mesh.normals, &self.normals, c.n, 3) end
+          if uses_uvs then copy_floats(&mesh.uvs, &self.uvs, c.t, 2) end
+          nverts = nverts + 1
+          @slot = nverts
+        end
+        vidx = @slot - 1
+      else
+        vidx = c.p
+      end
+      -- inverting swaps the last two corners of each triangle
+      var dest = idx
+      if invert and idx % 3 ~= 0 then
+        if idx % 3 == 1 then dest = idx + 1 else dest = idx - 1 end
+      end
+      mesh.indices.data[dest] = vidx
+      idx = idx + 1
+    end
+  end
+  vertex_map:release()
+  return true
+end
+
+-- parses .obj source (a string) into an obj_mesh (which the caller
+-- should :release), or returns nil and an error message
+-- options.jobs: JobSystem to parse on (default: the shared one)
+-- options.chunks: number of chunks (default: 4 per thread, but none
+-- smaller than MIN_CHUNK_BYTES)
+-- options.invert: flip the triangle winding
+function m.parse_obj_native(src, options)
+  options = options or {}
+  local job_system = options.jobs or jobs.default_job_system()
+  local n_chunks = options.chunks
+  if not n_chunks then
+    n_chunks = math.min((job_system.nthreads + 1) * 4,
+                        math.ceil(#src / m.MIN_CHUNK_BYTES))
+  end
+  n_chunks = math.max(1, n_chunks)
+
+  local par = terralib.new(obj_parse)
+  par:init(terralib.cast(&uint8, src), #src, n_chunks)
+  local job = job_system:submit(parse_chunks, par)
+  job_system:wait(job)
+  job_system:release_job(job)
+
+  local mesh = terralib.new(obj_mesh)
+  mesh:init()
+  local ok = par:merge(mesh, options.invert or false)
+  local n_polygons, n_degenerate = tonumber(par.n_polygons), tonumber(par.n_degenerate)
+  par:release()
+  if not ok then
+    mesh:release()
+    return nil, "face index out of range"
+  end
+  if n_degenerate > 0 then
+    log.warn("Warning: model contained " .. n_degenerate
+                .. " faces with fewer than 3 vertices, which were ignored!")
+  end
+  if m.verbose then
+    log.debug("#polygons (triangulated): " .. n_polygons)
+    log.debug("#triangles: " .. tonumber(mesh:n_indices()) / 3)
+    log.debug("#vertices: " .. tonumber(mesh:n_vertices()))
+  end
+  return mesh
+end
+
+m._copy_mesh_fn = terralib.memoize(function(VertType, IndexType)
+  local has_field = {}
+  for _, entry in ipairs(VertType.entries) do
+    has_field[entry.field or entry[1]] = true
+  end
+  local attributes = {{"position", "positions", 3},
+                      {"normal", "normals", 3},
+                      {"texcoord0", "uvs", 2}}
+  return terra(mesh: &obj_mesh, verts: &VertType, indices: &IndexType)
+    for i = 0, mesh:n_vertices() do
+      escape
+        for _, attr in ipairs(attributes) do
+          local vfield, mfield, width = unpack(attr)
+          if has_field[vfield] then emit(quote
+            var src = &mesh.[mfield]
+            for k = 0, width do
+              if src.size > 0 then
+                verts[i].[vfield][k] = src.data[i*width + k]
+              else
+                verts[i].[vfield][k] = 0.0f
+              end
+            end
+          end) end
+        end
+      end
+    end
+    for i = 0, mesh.indices.size do
+      indices[i] = mesh.indices.data[i]
+    end
+  end
+end)
+
+-- copies an obj_mesh into a StaticGeometry, creating one with
+-- whichever attributes the mesh has if target is nil (an existing
+-- target is (re)uploaded)
+function m.mesh_to_geo(mesh, target)
+  local n_verts, n_indices = tonumber(mesh:n_vertices()), tonumber(mesh:n_indices())
+  if n_indices == 0 then return nil end
+  local created_target = (not target)
+  if created_target then
+    local gfx = require("gfx")
+    local attributes = {"position"}
+    if mesh.normals.size > 0 then table.insert(attributes, "normal") end
+    if mesh.uvs.size > 0 then table.insert(attributes, "texcoord0") end
+    local vtype = gfx.create_basic_vertex_type(attributes)
+    target = gfx.StaticGeometry():allocate(n_verts, n_indices, vtype)
+  elseif target.n_verts < n_verts or target.n_indices < n_indices then
+    truss.error("Target geometry too small for mesh: needs " .. n_verts
+                .. " verts, " .. n_indices .. " indices")
+  end
+  local copy = m._copy_mesh_fn(target.vertinfo.ttype, target.index_type)
+  copy(mesh, target.verts, target.indices)
+  if created_target then
+    target:commit()
+  else
+    target:set_slice(0, n_verts, 0, n_indices)
+    target:update()
+  end
+  return target
+end
+
+-- loads an .obj straight into a StaticGeometry (see parse_obj_native
+-- for options; options.target: existing geometry to copy into)
+function m.load_obj_geo(filename, options)
+  options = options or {}
+  local starttime = timing.tic()
+  local srcstr = truss.read_file(filename)
+  if not srcstr then
+    log.error("Error: unable to open file " .. filename)
+    return nil
+  end
+  local mesh, err = m.parse_obj_native(srcstr, options)
+  if not mesh then
+    log.error("Error: unable to parse " .. filename .. ": " .. err)
+    return nil
+  end
+  local geo = m.mesh_to_geo(mesh, options.target)
+  mesh:release()
+  local dtime = timing.toc(starttime)
+  log.info("Loaded " .. filename .. " in " .. (dtime*1000.0) .. " ms")
+  return geo
+end
+
 local ObjDumper = class("ObjDumper")
 function ObjDumper:init()
   self.v = {}
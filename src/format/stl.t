@@ -1,8 +1,9 @@
--- stlloader.t
+-- format/stl.t
 --
 -- loads binary STL files
 
 local m = {}
+local ffi = require("ffi")
 local math = require("math")
 local timing = require("osnative/timing.t")
 local Vector = math.Vector
@@ -14,8 +15,10 @@ m.MAXFACES = 21845 -- each face needs 3 vertices, to fit into 16 bit index
 
 local tic, toc = timing.tic, timing.toc
 
-function m.load_stl(filename, invert)
-  error("Not ported to truss 0.3+ yet!")
+-- loads a binary STL into a StaticGeometry (see stl_to_geo for options;
+-- options can also just be a boolean invert)
+function m.load_stl(filename, options)
+  if type(options) ~= "table" then options = {invert = options} end
   local starttime = tic()
   local srcdata = truss.read_file(filename)
   if not srcdata then
@@ -23,7 +26,11 @@ function m.load_stl(filename, invert)
     return nil
   end
 
-  local ret = m.parse_binary_stl(src_message.data, src_message.data_length, invert)
+  local ret, err = m.stl_to_geo(terralib.cast(&uint8, srcdata), #srcdata, options)
+  if not ret then
+    log.error("Error: unable to load " .. filename .. ": " .. err)
+    return nil
+  end
   local dtime = toc(starttime)
   log.info("Loaded " .. filename .. " in " .. (dtime*1000.0) .. " ms")
   return ret
@@ -156,6 +163,197 @@ function m.parse_binary_stl(databuf, datalength, invert)
           color = {defaultR, defaultG, defaultB, alpha}}
 end
 
+-- native loader --
+--
+-- Converts the triangle array of a binary STL straight into a
+-- StaticGeometry in a single pass, optionally welding vertices which
+-- share a position.
+
+local substrate = require("substrate")
+local mem = require("core/memory.t")
+local cmath = require("substrate/libc.t").math
+
+local STL_HEADER_SIZE = 84 -- 80 byte comment + uint32 triangle count
+local STL_TRI_SIZE = 50 -- normal, 3 vertices (12 floats), attribute uint16
+
+-- checks that data (len bytes) holds a complete binary STL; returns its
+-- triangle count, or nil and an error message
+function m.validate_binary_stl(data, len)
+  len = tonumber(len)
+  if len < STL_HEADER_SIZE then
+    return nil, "too short (" .. len .. " bytes) for an STL header"
+  end
+  local ntris = m.read_uint32_le(data, 80)
+  local expected = STL_HEADER_SIZE + STL_TRI_SIZE * ntris
+  if len < expected then
+    if ffi.string(data, 5) == "solid" then
+      return nil, "ASCII STL files are not supported"
+    end
+    return nil, ("truncated: header gives %d triangles (%d bytes), but "
+                 .. "there are only %d bytes"):format(ntris, expected, len)
+  end
+  if len > expected and m.verbose then
+    log.debug("Ignoring " .. (len - expected) .. " trailing bytes in STL")
+  end
+  return ntris
+end
+
+local struct stl_position {
+  x: float;
+  y: float;
+  z: float;
+}
+local PositionMap = substrate.HashMap(stl_position, uint32)
+m.PositionMap = PositionMap
+
+-- converts ntris triangles into verts/indices and returns the number of
+-- vertices written. Unwelded, every triangle gets its own three vertices
+-- with its face normal; welded (into vertex_map), vertices are shared
+-- between triangles and get area weighted smooth normals.
+m._convert_fn = terralib.memoize(function(VertType, IndexType, weld)
+  local has_normal = false
+  for _, entry in ipairs(VertType.entries) do
+    if (entry.field or entry[1]) == "normal" then has_normal = true end
+  end
+
+  local function set_vertex(v, pos, normal)
+    return quote
+      for k = 0, 3 do v.position[k] = pos[k] end
+      escape
+        if has_normal then emit(quote
+          for k = 0, 3 do v.normal[k] = normal[k] end
+        end) end
+      end
+    end
+  end
+
+  return terra(data: &uint8, ntris: uint32, invert: bool, verts: &VertType,
+               indices: &IndexType, vertex_map: &PositionMap): uint32
+    var nverts: uint32 = 0
+    var zero = arrayof(float, 0.0f, 0.0f, 0.0f)
+    for t = 0, ntris do
+      -- (triangles are only 2 byte aligned)
+      var f: float[12]
+      substrate.intrinsics.memcpy([&uint8](&f[0]),
+                                  data + STL_HEADER_SIZE + [uint64](t)*STL_TRI_SIZE, 48)
+      for k = 0, 12 do f[k] = sanitize_nan(f[k]) end
+      if invert then
+        for k = 0, 3 do f[k] = -f[k] end
+      end
+      escape if has_normal then emit(quote
+        -- face normal from the positions (many writers leave the stored
+        -- one zeroed), unit length unless it's being accumulated
+        var e1: float[3], e2: float[3], n: float[3]
+        for k = 0, 3 do
+          e1[k] = f[6 + k] - f[3 + k]
+          e2[k] = f[9 + k] - f[3 + k]
+        end
+        n[0] = e1[1]*e2[2] - e1[2]*e2[1]
+        n[1] = e1[2]*e2[0] - e1[0]*e2[2]
+        n[2] = e1[0]*e2[1] - e1[1]*e2[0]
+        if invert then
+          for k = 0, 3 do n[k] = -n[k] end
+        end
+        escape if weld then emit(quote
+          for k = 0, 3 do f[k] = n[k] end
+        end) else emit(quote
+          -- (degenerate triangles keep the stored normal)
+          var len = cmath.sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2])
+          if len > 0.0f then
+            for k = 0, 3 do f[k] = n[k] / len end
+          end
+        end) end end
+      end) end end
+      for c = 0, 3 do
+        var pos = &f[3 + 3*c]
+        -- inverting swaps the last two corners
+        var corner = c
+        if invert and c > 0 then corner = 3 - c end
+        var vidx: uint32
+        escape if weld then emit(quote
+          -- (+ 0 so that -0 and 0 are the same key)
+          var key = stl_position{pos[0] + 0.0f, pos[1] + 0.0f, pos[2] + 0.0f}
+          -- (new entries start out as 0, so the map holds index + 1)
+          var slot = vertex_map:get_or_insert_val(key)
+          if @slot == 0 then
+            [set_vertex(`verts[nverts], pos, zero)]
+            nverts = nverts + 1
+            @slot = nverts
+          end
+          vidx = @slot - 1
+          escape if has_normal then emit(quote
+            for k = 0, 3 do verts[vidx].normal[k] = verts[vidx].normal[k] + f[k] end
+          end) end end
+        end) else emit(quote
+          vidx = t*3 + c
+          [set_vertex(`verts[vidx], pos, `&f[0])]
+          nverts = nverts + 1
+        end) end end
+        indices[t*3 + corner] = vidx
+      end
+    end
+    escape if weld and has_normal then emit(quote
+      for i = 0, nverts do
+        var n = &verts[i].normal[0]
+        var len = cmath.sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2])
+        if len > 0.0f then
+          for k = 0, 3 do n[k] = n[k] / len end
+        end
+      end
+    end) end end
+    return nverts
+  end
+end)
+
+m._copy_indices_fn = terralib.memoize(function(IndexType)
+  return terra(src: &uint32, dest: &IndexType, n: uint32)
+    for i = 0, n do dest[i] = src[i] end
+  end
+end)
+
+-- converts a binary STL in memory into a StaticGeometry, or returns
+-- nil and an error message
+-- options.invert: flip the triangle winding (and normals)
+-- options.weld: share vertices between triangles with the same position
+-- options.vertex_type: (default: position + normal)
+function m.stl_to_geo(data, len, options)
+  options = options or {}
+  local ntris, err = m.validate_binary_stl(data, len)
+  if not ntris then return nil, err end
+  if ntris == 0 then return nil, "STL has no triangles" end
+  local gfx = require("gfx")
+  local vtype = options.vertex_type
+                or gfx.create_basic_vertex_type{"position", "normal"}
+  local invert = options.invert or false
+  local n_indices = ntris * 3
+
+  if not options.weld then
+    local geo = gfx.StaticGeometry():allocate(n_indices, n_indices, vtype)
+    local convert = m._convert_fn(vtype.ttype, geo.index_type, false)
+    convert(data, ntris, invert, geo.verts, geo.indices, nil)
+    return geo:commit()
+  end
+
+  -- the welded vertex count (and so the index type) is only known
+  -- afterwards, so this goes through scratch buffers
+  local verts = mem.allocate(vtype.ttype[n_indices])
+  local indices = mem.allocate(uint32[n_indices])
+  local vertex_map = terralib.new(PositionMap)
+  vertex_map:init()
+  vertex_map:reserve((ntris - ntris % 2) / 2)
+  local convert = m._convert_fn(vtype.ttype, uint32, true)
+  local n_verts = convert(data, ntris, invert, verts, indices, vertex_map)
+  vertex_map:release()
+  if m.verbose then
+    log.debug("Welded " .. n_indices .. " STL vertices into " .. n_verts)
+  end
+
+  local geo = gfx.StaticGeometry():allocate(n_verts, n_indices, vtype)
+  ffi.copy(geo.verts, verts, terralib.sizeof(vtype.ttype) * n_verts)
+  m._copy_indices_fn(geo.index_type)(indices, geo.indices, n_indices)
+  return geo:commit()
+end
+
 local struct STLHeader {
   comment: int8[80];
   tricount: uint32;
@@ -191,8 +389,6 @@ terra Tri:init()
   self.attrib_byte_count = 0 -- this is just always 0
 end
 
-local STL_TRI_SIZE = 50
-
 local terra put_triangle(target: &int8, tri: &Tri)
   var src = [&int8](tri)
   for idx = 0, STL_TRI_SIZE do
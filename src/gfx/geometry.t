@@ -535,6 +535,13 @@ function StaticGeometry:uncommit()
   self.committed = false
 end
 
+-- uploads the current data; static buffers can't be updated in place,
+-- so they are recreated (DynamicGeometry:update updates them instead)
+function StaticGeometry:update()
+  if self.committed then self:uncommit() end
+  return self:commit()
+end
+
 function DynamicGeometry:uncommit()
   if self._vbh then bgfx.destroy_dynamic_vertex_buffer(self._vbh) end
   if self._ibh then bgfx.destroy_dynamic_index_buffer(self._ibh) end
@@ -11,6 +11,10 @@ function RenderSystem:init(options)
   RenderSystem.super.init(self)
   options = options or {}
   self.auto_frame_advance = (options.auto_frame_advance ~= false)
+  -- compute world matrices with a flat TransformStore per scene root,
+  -- rather than multiplying through the tree during traversal
+  self.flat_transforms = options.flat_transforms
+  self._transform_stores = {}
   self.mount_name = "render" -- allow direct use of a RenderSystem as a system
   self._identity_mat = math.Matrix4():identity()
   if not options.roots then 
@@ -74,7 +78,9 @@ function RenderSystem:_tree_render(entity, parentmat)
   if not entity.matrix then return end
 
   local mw = entity.matrix_world
-  mw:multiply(parentmat, entity.matrix)
+  if not entity._tf_store then
+    mw:multiply(parentmat, entity.matrix)
+  end
   if entity._post_transform then
     entity:_post_transform(mw)
   end
@@ -91,6 +97,26 @@ function RenderSystem:_tree_render(entity, parentmat)
   end
 end
 
+function RenderSystem:_update_transform_store(scene_name, scene_root)
+  local store = self._transform_stores[scene_name]
+  if store and store.root ~= scene_root then
+    store:release()
+    store = nil
+  end
+  if not store then
+    store = require("ecs/transformstore.t").TransformStore(scene_root)
+    self._transform_stores[scene_name] = store
+  end
+  store:update()
+end
+
+function RenderSystem:release()
+  for _, store in pairs(self._transform_stores) do
+    store:release()
+  end
+  self._transform_stores = {}
+end
+
 function RenderSystem:update()
   if not self.pipeline then return end
   self.pipeline:bind(0, 0xffff)
@@ -104,6 +130,9 @@ function RenderSystem:update()
   for scene_name, scene_root in pairs(self._roots) do
     self:_clear_op_cache()
     self._scene_stages = self.pipeline:match_scene(scene_name)
+    if self.flat_transforms then
+      self:_update_transform_store(scene_name, scene_root)
+    end
     self:_tree_render(scene_root, self._identity_mat)
   end
   self.ecs:insert_timing_event("render_traverse")
@@ -298,6 +298,35 @@ function Socket:send(data, data_len)
 end
 Socket.send_string = Socket.send
 
+-- encodes a protobuf message (a ProtoGen message, see protobuf/gen.t)
+-- straight into a zmq-owned buffer of exactly the right size, and sends
+-- it; state is a sized_encode_state_t (optional)
+function Socket:send_message(Msg, src, state)
+  if not self._sock then return false, "No socket" end
+  if not state then
+    if not self._encode_state then
+      local wf = require("protobuf/wireformat.t")
+      self._encode_state = terralib.new(wf.sized_encode_state_t)
+      self._encode_state:init()
+    end
+    state = self._encode_state
+  end
+  if not self._send_msg then self._send_msg = terralib.new(C.msg_t) end
+  local msg = self._send_msg
+  local size = Msg.compute_size(state, src)
+  local happy, err = ok(C.msg_init_size(msg, size))
+  if not happy then return false, err end
+  state:target(C.msg_data(msg), size)
+  if Msg.encode_sized(state, src) < 0 then
+    C.msg_close(msg)
+    return false, "Encoding failed"
+  end
+  happy, err = ok(C.msg_send(msg, self._sock, 0))
+  -- (a sent message belongs to zmq, an unsent one is still ours)
+  if not happy then C.msg_close(msg) end
+  return happy, err
+end
+
 function Socket:bind(url)
   if not self._sock then return false, "No socket" end
   return ok(C.bind(self._sock, url))
@@ -327,6 +356,10 @@ function Socket:close()
     C.msg_close(self._msg)
     self._msg = nil
   end
+  if self._encode_state then
+    self._encode_state:release()
+    self._encode_state = nil
+  end
   return true
 end
 
@@ -5,6 +5,113 @@ local m = {}
 
 function m.run(test)
   test("intersection", m.test_intersection)
+  test("batch", m.test_batch)
+end
+
+-- the SIMD kernels should match the scalar matrix.t ones, including
+-- for counts that aren't a multiple of the vector width
+function m.test_batch(t)
+  local batch = require("math/batch.t")
+  local matrix = require("math/matrix.t")
+  local mathtypes = require("math/types.t")
+  local scalar_, vec4_ = mathtypes.scalar_, mathtypes.vec4_
+
+  local seed = 1
+  local function rand()
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed / 2147483648 * 2.0 - 1.0
+  end
+  local function rand_array(n)
+    local ret = terralib.new(scalar_[n])
+    for i = 0, n-1 do ret[i] = rand() end
+    return ret
+  end
+  local function arrays_match(a, b, n)
+    for i = 0, n-1 do
+      if not t.approx_eq(a[i], b[i]) then return false end
+    end
+    return true
+  end
+
+  for _, n in ipairs({1, 3, 8, 13}) do
+    local a, b = rand_array(n*16), rand_array(n*16)
+    local dest, expected = rand_array(n*16), rand_array(n*16)
+    batch.multiply_matrices(dest, a, b, n)
+    for i = 0, n-1 do
+      matrix.multiply_matrices(expected + i*16, a + i*16, b + i*16)
+    end
+    t.ok(arrays_match(dest, expected, n*16), "multiply_matrices, n = " .. n)
+
+    batch.left_multiply_matrices(dest, a, b, n)
+    for i = 0, n-1 do
+      matrix.multiply_matrices(expected + i*16, a, b + i*16)
+    end
+    t.ok(arrays_match(dest, expected, n*16), "left_multiply_matrices, n = " .. n)
+
+    local vecs = terralib.new(vec4_[n])
+    local vdest, vexpected = terralib.new(vec4_[n]), terralib.new(vec4_[n])
+    for i = 0, n-1 do
+      vecs[i].x, vecs[i].y, vecs[i].z, vecs[i].w = rand(), rand(), rand(), rand()
+      matrix.multiply_matrix_vector(a, vecs + i, vexpected + i)
+    end
+    batch.transform_vectors(vdest, a, vecs, n)
+    local same = true
+    for i = 0, n-1 do
+      same = same and t.approx_eq(vdest[i].x, vexpected[i].x)
+                  and t.approx_eq(vdest[i].y, vexpected[i].y)
+                  and t.approx_eq(vdest[i].z, vexpected[i].z)
+                  and t.approx_eq(vdest[i].w, vexpected[i].w)
+    end
+    t.ok(same, "transform_vectors, n = " .. n)
+
+    local xs, ys, zs = rand_array(n), rand_array(n), rand_array(n)
+    local ox, oy, oz = rand_array(n), rand_array(n), rand_array(n)
+    batch.transform_points_soa(ox, oy, oz, a, xs, ys, zs, n)
+    same = true
+    for i = 0, n-1 do
+      local v = terralib.new(vec4_[1], {{xs[i], ys[i], zs[i], 1.0}})
+      matrix.multiply_matrix_vector(a, v, v)
+      same = same and t.approx_eq(ox[i], v[0].x) and t.approx_eq(oy[i], v[0].y)
+                  and t.approx_eq(oz[i], v[0].z)
+    end
+    t.ok(same, "transform_points_soa, n = " .. n)
+
+    -- TRS compose, AoS and SoA, against quaternion_to_matrix etc.
+    local pos, quat, scale = terralib.new(vec4_[n]), terralib.new(vec4_[n]),
+                             terralib.new(vec4_[n])
+    local soa = {}
+    for c = 1, 10 do soa[c] = terralib.new(scalar_[n]) end
+    for i = 0, n-1 do
+      local q = {rand(), rand(), rand(), rand()}
+      local qlen = math.sqrt(q[1]^2 + q[2]^2 + q[3]^2 + q[4]^2)
+      pos[i].x, pos[i].y, pos[i].z, pos[i].w = rand(), rand(), rand(), 1.0
+      quat[i].x, quat[i].y, quat[i].z, quat[i].w =
+        q[1]/qlen, q[2]/qlen, q[3]/qlen, q[4]/qlen
+      scale[i].x, scale[i].y, scale[i].z, scale[i].w =
+        rand() + 2.0, rand() + 2.0, rand() + 2.0, 1.0
+      local e = expected + i*16
+      matrix.quaternion_to_matrix(quat + i, e)
+      matrix.scale_matrix(e, scale + i)
+      matrix.set_matrix_position(e, pos + i)
+      local vals = {pos[i].x, pos[i].y, pos[i].z,
+                    quat[i].x, quat[i].y, quat[i].z, quat[i].w,
+                    scale[i].x, scale[i].y, scale[i].z}
+      for c = 1, 10 do soa[c][i] = vals[c] end
+    end
+    batch.compose_matrices(dest, pos, quat, scale, n)
+    t.ok(arrays_match(dest, expected, n*16), "compose_matrices, n = " .. n)
+
+    local pos_ptrs = terralib.new((&scalar_)[3], {soa[1], soa[2], soa[3]})
+    local quat_ptrs = terralib.new((&scalar_)[4], {soa[4], soa[5], soa[6], soa[7]})
+    local scale_ptrs = terralib.new((&scalar_)[3], {soa[8], soa[9], soa[10]})
+    batch.compose_matrices_soa(dest, pos_ptrs, quat_ptrs, scale_ptrs, n)
+    t.ok(arrays_match(dest, expected, n*16), "compose_matrices_soa, n = " .. n)
+
+    -- nil scale is unit scale for both layouts
+    batch.compose_matrices(expected, pos, quat, nil, n)
+    batch.compose_matrices_soa(dest, pos_ptrs, quat_ptrs, nil, n)
+    t.ok(arrays_match(dest, expected, n*16), "compose_matrices_soa nil scale, n = " .. n)
+  end
 end
 
 function m.test_intersection(t)
@@ -0,0 +1,190 @@
+-- math/batch.t
+--
+-- batched (SIMD) versions of the matrix.t kernels, for transforming
+-- many matrices/points in one call
+--
+-- matrices are column-major float[16], packed contiguously (AoS);
+-- the *_soa variants take separate x/y/z... arrays and process
+-- eight entities at a time
+
+local m = {}
+local mathtypes = require("math/types.t")
+
+local scalar_ = mathtypes.scalar_
+local vec4_ = mathtypes.vec4_
+
+local vec4f = vector(scalar_, 4)
+local vec8f = vector(scalar_, 8)
+m.vec4f = vec4f
+m.vec8f = vec8f
+
+-- inputs are only guaranteed scalar-aligned, so use unaligned
+-- vector loads/stores rather than casting to &vector directly
+local ALIGN = terralib.sizeof(scalar_)
+
+local function loader(VT)
+  return macro(function(ptr)
+    return `terralib.attrload([&VT](ptr), {align = ALIGN})
+  end)
+end
+
+local function storer(VT)
+  return macro(function(ptr, val)
+    return quote terralib.attrstore([&VT](ptr), val, {align = ALIGN}) end
+  end)
+end
+
+local load4, store4 = loader(vec4f), storer(vec4f)
+local load8, store8 = loader(vec8f), storer(vec8f)
+m.load4, m.store4, m.load8, m.store8 = load4, store4, load8, store8
+
+-- dest = a * b for a single matrix, with b's columns broadcast
+-- against a's column vectors
+local terra mul_mat_cols(dest: &scalar_, a0: vec4f, a1: vec4f, a2: vec4f, a3: vec4f, b: &scalar_)
+  escape
+    for col = 0, 3 do
+      local o = col*4
+      emit(quote
+        store4(dest + o, a0*b[o+0] + a1*b[o+1] + a2*b[o+2] + a3*b[o+3])
+      end)
+    end
+  end
+end
+mul_mat_cols:setinlined(true)
+
+-- dest[i] = a[i] * b[i] for i in [0, n)
+-- (safe for dest == a or dest == b)
+terra m.multiply_matrices(dest: &scalar_, a: &scalar_, b: &scalar_, n: uint32)
+  for i = 0, n do
+    var o = i*16
+    var a0, a1, a2, a3 = load4(a+o), load4(a+o+4), load4(a+o+8), load4(a+o+12)
+    var bb: scalar_[16]
+    for k = 0, 16 do bb[k] = b[o+k] end
+    mul_mat_cols(dest+o, a0, a1, a2, a3, &bb[0])
+  end
+end
+
+-- dest[i] = lhs * src[i]: e.g., applying one parent transform to many
+-- children (safe for dest == src)
+terra m.left_multiply_matrices(dest: &scalar_, lhs: &scalar_, src: &scalar_, n: uint32)
+  var a0, a1, a2, a3 = load4(lhs), load4(lhs+4), load4(lhs+8), load4(lhs+12)
+  for i = 0, n do
+    var o = i*16
+    var bb: scalar_[16]
+    for k = 0, 16 do bb[k] = src[o+k] end
+    mul_mat_cols(dest+o, a0, a1, a2, a3, &bb[0])
+  end
+end
+
+-- dest[i] = mat * src[i] for vec4s (w is used as given)
+-- (safe for dest == src)
+terra m.transform_vectors(dest: &vec4_, mat: &scalar_, src: &vec4_, n: uint32)
+  var c0, c1, c2, c3 = load4(mat), load4(mat+4), load4(mat+8), load4(mat+12)
+  for i = 0, n do
+    var v = src[i]
+    store4(&dest[i], c0*v.x + c1*v.y + c2*v.z + c3*v.w)
+  end
+end
+
+-- out[i] = mat * (xs[i], ys[i], zs[i], 1) for points given as
+-- separate x/y/z arrays (safe for in place)
+terra m.transform_points_soa(out_x: &scalar_, out_y: &scalar_, out_z: &scalar_,
+                             mat: &scalar_,
+                             xs: &scalar_, ys: &scalar_, zs: &scalar_, n: uint32)
+  var nvec = n / 8
+  for vi = 0, nvec do
+    var o = vi*8
+    var x, y, z = load8(xs+o), load8(ys+o), load8(zs+o)
+    store8(out_x+o, x*mat[0] + y*mat[4] + z*mat[ 8] + mat[12])
+    store8(out_y+o, x*mat[1] + y*mat[5] + z*mat[ 9] + mat[13])
+    store8(out_z+o, x*mat[2] + y*mat[6] + z*mat[10] + mat[14])
+  end
+  for i = nvec*8, n do
+    var x, y, z = xs[i], ys[i], zs[i]
+    out_x[i] = x*mat[0] + y*mat[4] + z*mat[ 8] + mat[12]
+    out_y[i] = x*mat[1] + y*mat[5] + z*mat[ 9] + mat[13]
+    out_z[i] = x*mat[2] + y*mat[6] + z*mat[10] + mat[14]
+  end
+end
+
+-- generates the body of a TRS compose over (scalar or vector) type T;
+-- same result as quaternion_to_matrix + scale_matrix + set_matrix_position
+local function compose_trs(T, px, py, pz, qx, qy, qz, qw, sx, sy, sz, store)
+  return quote
+    var x2, y2, z2 = qx + qx, qy + qy, qz + qz
+    var xx, xy, xz = qx * x2, qx * y2, qx * z2
+    var yy, yz, zz = qy * y2, qy * z2, qz * z2
+    var wx, wy, wz = qw * x2, qw * y2, qw * z2
+    var one, zero = [T](1.0f), [T](0.0f)
+    [store(0, `(one - (yy + zz)) * sx)]
+    [store(1, `(xy + wz) * sx)]
+    [store(2, `(xz - wy) * sx)]
+    [store(3, zero)]
+    [store(4, `(xy - wz) * sy)]
+    [store(5, `(one - (xx + zz)) * sy)]
+    [store(6, `(yz + wx) * sy)]
+    [store(7, zero)]
+    [store(8, `(xz + wy) * sz)]
+    [store(9, `(yz - wx) * sz)]
+    [store(10, `(one - (xx + yy)) * sz)]
+    [store(11, zero)]
+    [store(12, px)]
+    [store(13, py)]
+    [store(14, pz)]
+    [store(15, one)]
+  end
+end
+
+-- composes n matrices from AoS position/quaternion/scale vec4s
+-- (scale may be nil for unit scale)
+terra m.compose_matrices(dest: &scalar_, pos: &vec4_, quat: &vec4_, scale: &vec4_, n: uint32)
+  for i = 0, n do
+    var p, q = pos[i], quat[i]
+    var s = vec4_{1.0f, 1.0f, 1.0f, 1.0f}
+    if scale ~= nil then s = scale[i] end
+    var mat = dest + i*16
+    [compose_trs(scalar_, `p.x, `p.y, `p.z, `q.x, `q.y, `q.z, `q.w, `s.x, `s.y, `s.z,
+      function(idx, val) return quote mat[idx] = val end end)]
+  end
+end
+
+-- composes n matrices from SoA inputs, eight at a time:
+-- pos, quat and scale each point to [n] arrays per component
+-- (pos: x,y,z; quat: x,y,z,w; scale: x,y,z; scale may be nil for
+-- unit scale, as with compose_matrices)
+terra m.compose_matrices_soa(dest: &scalar_, pos: &(&scalar_), quat: &(&scalar_),
+                             scale: &(&scalar_), n: uint32)
+  var nvec = n / 8
+  for vi = 0, nvec do
+    var o = vi*8
+    var px, py, pz = load8(pos[0]+o), load8(pos[1]+o), load8(pos[2]+o)
+    var qx, qy, qz, qw = load8(quat[0]+o), load8(quat[1]+o), load8(quat[2]+o), load8(quat[3]+o)
+    var sx, sy, sz = [vec8f](1.0f), [vec8f](1.0f), [vec8f](1.0f)
+    if scale ~= nil then
+      sx, sy, sz = load8(scale[0]+o), load8(scale[1]+o), load8(scale[2]+o)
+    end
+    var out = dest + o*16
+    [compose_trs(vec8f, px, py, pz, qx, qy, qz, qw, sx, sy, sz,
+      function(idx, val)
+        -- scatter each lane into its own matrix
+        return quote
+          var v = [val]
+          escape
+            for lane = 0, 7 do
+              emit(quote out[lane*16 + idx] = v[lane] end)
+            end
+          end
+        end
+      end)]
+  end
+  for i = nvec*8, n do
+    var mat = dest + i*16
+    var sx, sy, sz = [scalar_](1.0f), [scalar_](1.0f), [scalar_](1.0f)
+    if scale ~= nil then sx, sy, sz = scale[0][i], scale[1][i], scale[2][i] end
+    [compose_trs(scalar_, `pos[0][i], `pos[1][i], `pos[2][i],
+      `quat[0][i], `quat[1][i], `quat[2][i], `quat[3][i], sx, sy, sz,
+      function(idx, val) return quote mat[idx] = val end end)]
+  end
+end
+
+return m
@@ -13,6 +13,9 @@ m.Vector = require("./vec.t").Vector
 m.Matrix4 = require("./matrix.t").Matrix4
 m.Quaternion = require("./quat.t").Quaternion
 
+-- batched (SIMD) matrix kernels
+m.batch = require("./batch.t")
+
 -- Additional stuff
 module.include_submodules({
   "math/bitops.t",
@@ -268,6 +268,22 @@ function Matrix4:init()
   self.elem = self.data
 end
 
+-- makes this matrix a view onto external storage (16 scalars), e.g.,
+-- a slot in a packed array; the storage must outlive the binding.
+-- If ptr is nil, switches back to owned storage (keeping the values)
+function Matrix4:bind_storage(ptr)
+  local prev = self.data
+  if ptr then
+    m.copy_matrix(ptr, prev)
+    self.data = ptr
+  else
+    self.data = terralib.new(scalar_[16])
+    m.copy_matrix(self.data, prev)
+  end
+  self.elem = self.data
+  return self
+end
+
 function Matrix4:identity()
   m.set_identity_matrix(self.data)
   return self
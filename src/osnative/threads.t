@@ -0,0 +1,201 @@
+-- osnative/threads.t
+--
+-- os-specific native threads
+--
+-- Only terra code may run on spawned threads: the Lua state is
+-- not thread safe, so the thread function must not call back
+-- into Lua.
+
+local build = require("build/build.t")
+local libc = require("substrate/libc.t")
+local m = {}
+
+local target = build.target_name()
+
+local struct ThreadStart {
+  fn: {&opaque} -> {};
+  arg: &opaque;
+}
+
+local terra make_start(fn: {&opaque} -> {}, arg: &opaque): &ThreadStart
+  var start = [&ThreadStart](libc.std.malloc(sizeof(ThreadStart)))
+  start.fn = fn
+  start.arg = arg
+  return start
+end
+
+local terra run_start(p: &opaque)
+  var start = @[&ThreadStart](p)
+  libc.std.free(p)
+  start.fn(start.arg)
+end
+
+-- (handle is 0 if the thread couldn't be spawned)
+local struct Thread {
+  handle: uint64;
+}
+m.Thread = Thread
+
+terra Thread:is_valid(): bool
+  return self.handle ~= 0
+end
+
+-- a thread local storage slot: every thread sees its own value, which
+-- starts out nil (create with m.create_tls_key)
+local struct TlsKey {
+  key: uint64;
+}
+m.TlsKey = TlsKey
+
+-- running out of TLS keys isn't recoverable for the callers (e.g., the
+-- pool allocator), so it aborts
+local terra tls_key_failure()
+  libc.io.printf("threads: couldn't create a thread local storage key\n")
+  libc.std.exit(2)
+end
+
+if target == "Windows" then
+  local C = build.includecstring[[
+  #include "stdint.h"
+  typedef void* HANDLE;
+  typedef uint32_t (*thread_start_t)(void*);
+  HANDLE CreateThread(void* attribs, uint64_t stack_size, thread_start_t start,
+                      void* param, uint32_t flags, uint32_t* thread_id);
+  uint32_t WaitForSingleObject(HANDLE handle, uint32_t millis);
+  int CloseHandle(HANDLE handle);
+  int SwitchToThread(void);
+  void Sleep(uint32_t millis);
+  uint32_t GetActiveProcessorCount(uint16_t group);
+  typedef void (*fls_callback_t)(void*);
+  uint32_t FlsAlloc(fls_callback_t callback);
+  void* FlsGetValue(uint32_t index);
+  int FlsSetValue(uint32_t index, void* value);
+  ]]
+  local INFINITE = 0xFFFFFFFF
+  local ALL_PROCESSOR_GROUPS = 0xFFFF
+
+  local terra trampoline(p: &opaque): uint32
+    run_start(p)
+    return 0
+  end
+
+  terra m.spawn(fn: {&opaque} -> {}, arg: &opaque): Thread
+    var start = make_start(fn, arg)
+    var handle = C.CreateThread(nil, 0, trampoline, start, 0, nil)
+    if handle == nil then
+      libc.std.free(start)
+      return Thread{0}
+    end
+    return Thread{[uint64](handle)}
+  end
+
+  terra Thread:join()
+    if self.handle == 0 then return end
+    C.WaitForSingleObject([&opaque](self.handle), INFINITE)
+    C.CloseHandle([&opaque](self.handle))
+    self.handle = 0
+  end
+
+  terra m.yield()
+    C.SwitchToThread()
+  end
+
+  terra m.sleep_ms(ms: uint32)
+    C.Sleep(ms)
+  end
+
+  terra m.hardware_concurrency(): uint32
+    return C.GetActiveProcessorCount(ALL_PROCESSOR_GROUPS)
+  end
+
+  -- destructor (optional) is called with a thread's (non-nil) value
+  -- when that thread exits
+  local FLS_OUT_OF_INDEXES = 0xFFFFFFFF
+
+  terra m.create_tls_key(destructor: {&opaque} -> {}): TlsKey
+    var key = C.FlsAlloc(destructor)
+    if key == FLS_OUT_OF_INDEXES then tls_key_failure() end
+    return TlsKey{key}
+  end
+
+  terra TlsKey:get(): &opaque
+    return C.FlsGetValue(self.key)
+  end
+
+  terra TlsKey:set(value: &opaque)
+    C.FlsSetValue(self.key, value)
+  end
+else
+  -- (pthread_t is an integer on Linux and a pointer on OSX, but
+  --  64 bits on both; pthread_key_t is an unsigned int on Linux and
+  --  an unsigned long on OSX)
+  local key_type = (target == "OSX" and "unsigned long") or "unsigned int"
+  local C = build.includecstring([[
+  #include "stdint.h"
+  typedef uint64_t truss_pthread_t;
+  typedef ]] .. key_type .. [[ truss_pthread_key_t;
+  int pthread_key_create(truss_pthread_key_t* key, void (*destructor)(void*));
+  void* pthread_getspecific(truss_pthread_key_t key);
+  int pthread_setspecific(truss_pthread_key_t key, const void* value);
+  int pthread_create(truss_pthread_t* thread, const void* attr,
+                     void* (*start)(void*), void* arg);
+  int pthread_join(truss_pthread_t thread, void** retval);
+  int sched_yield(void);
+  int usleep(uint32_t usec);
+  long sysconf(int name);
+  ]])
+  local SC_NPROCESSORS_ONLN = (target == "OSX" and 58) or 84
+
+  local terra trampoline(p: &opaque): &opaque
+    run_start(p)
+    return nil
+  end
+
+  terra m.spawn(fn: {&opaque} -> {}, arg: &opaque): Thread
+    var start = make_start(fn, arg)
+    var handle: C.truss_pthread_t = 0
+    if C.pthread_create(&handle, nil, trampoline, start) ~= 0 then
+      libc.std.free(start)
+      return Thread{0}
+    end
+    return Thread{handle}
+  end
+
+  terra Thread:join()
+    if self.handle == 0 then return end
+    C.pthread_join(self.handle, nil)
+    self.handle = 0
+  end
+
+  terra m.yield()
+    C.sched_yield()
+  end
+
+  terra m.sleep_ms(ms: uint32)
+    C.usleep(ms * 1000)
+  end
+
+  terra m.hardware_concurrency(): uint32
+    var n = C.sysconf(SC_NPROCESSORS_ONLN)
+    if n < 1 then return 1 end
+    return n
+  end
+
+  -- destructor (optional) is called with a thread's (non-nil) value
+  -- when that thread exits
+  terra m.create_tls_key(destructor: {&opaque} -> {}): TlsKey
+    var key: C.truss_pthread_key_t = 0
+    if C.pthread_key_create(&key, destructor) ~= 0 then tls_key_failure() end
+    return TlsKey{key}
+  end
+
+  terra TlsKey:get(): &opaque
+    return C.pthread_getspecific(self.key)
+  end
+
+  terra TlsKey:set(value: &opaque)
+    C.pthread_setspecific(self.key, value)
+  end
+end
+
+return m
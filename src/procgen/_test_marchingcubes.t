@@ -0,0 +1,132 @@
+-- marching cubes tests
+
+local m = {}
+
+local function test_marching_cubes(jape)
+  local mc = require("./marchingcubes.t")
+  local test, expect = jape.test, jape.expect
+
+  local function sphere(size)
+    return mc.mc_data_from_function(function(x, y, z)
+      local dx, dy, dz = x - 0.5, y - 0.5, z - 0.5
+      return math.sqrt(dx*dx + dy*dy + dz*dz) - 0.3
+    end, size)
+  end
+
+  local function close(a, b)
+    return math.abs(a.x - b.x) < 1e-4 and math.abs(a.y - b.y) < 1e-4
+       and math.abs(a.z - b.z) < 1e-4
+  end
+
+  test("indexed output matches triangle soup", function()
+    local data = sphere(16)
+    local soup = mc.cubify(data, 64000).triangles
+    local mesh = mc.cubify_indexed(data)
+    expect(soup.index > 0):to_be_truthy()
+    expect(mesh.n_indices):to_be(soup.index)
+    local all_match = true
+    for i = 0, mesh.n_indices - 1 do
+      local v = mesh.vertices[mesh.indices[i]]
+      if not close(v, soup.vertices[i]) then all_match = false end
+    end
+    expect(all_match):to_be_truthy()
+    mesh:release()
+  end)
+
+  test("indexed output shares vertices", function()
+    local data = sphere(16)
+    local mesh = mc.cubify_indexed(data)
+    -- a closed manifold surface shares each vertex between ~6 triangles
+    expect(mesh.n_vertices * 4 < mesh.n_indices):to_be_truthy()
+    local in_range = true
+    for i = 0, mesh.n_indices - 1 do
+      if mesh.indices[i] >= mesh.n_vertices then in_range = false end
+    end
+    expect(in_range):to_be_truthy()
+    mesh:release()
+  end)
+
+  test("parallel output matches serial output", function()
+    local data = sphere(24)
+    local serial = mc.cubify_indexed(data)
+    local parallel = mc.cubify_parallel(data, nil, nil, {slabs = 5})
+    -- vertices on the planes between slabs are welded exactly
+    expect(parallel.n_vertices):to_be(serial.n_vertices)
+    expect(parallel.n_indices):to_be(serial.n_indices)
+    local all_match = true
+    for i = 0, serial.n_indices - 1 do
+      local a = serial.vertices[serial.indices[i]]
+      local b = parallel.vertices[parallel.indices[i]]
+      if not close(a, b) then all_match = false end
+    end
+    expect(all_match):to_be_truthy()
+    serial:release()
+    parallel:release()
+  end)
+
+  test("brick mesher skips empty bricks", function()
+    local data = sphere(33)
+    local serial = mc.cubify_indexed(data)
+    local mesher = mc.BrickMesher(data, {brick_size = 4})
+    local merged = mesher:merge()
+    expect(merged.n_indices):to_be(serial.n_indices)
+    local n_active = mesher.pyramid:find_active(mesher._active)
+    expect(n_active < mesher.n_bricks):to_be_truthy()
+    merged:release()
+    mesher:release()
+    serial:release()
+  end)
+
+  test("brick mesher updates edited regions", function()
+    local data = sphere(33)
+    local mesher = mc.BrickMesher(data, {brick_size = 4})
+    -- punch a small cube of 'inside' into an empty corner
+    for z = 2, 5 do
+      for y = 2, 5 do
+        for x = 2, 5 do
+          data.data[x + 33 * (y + 33 * z)] = -1.0
+        end
+      end
+    end
+    local changed = mesher:update_region({2, 2, 2}, {6, 6, 6})
+    expect(#changed > 0):to_be_truthy()
+    local updated = mesher:merge()
+    local fresh = mc.cubify_indexed(data)
+    expect(updated.n_indices):to_be(fresh.n_indices)
+    updated:release()
+    fresh:release()
+    mesher:release()
+  end)
+
+  test("brick mesher handles degenerate sizes", function()
+    local data = sphere(9)
+    local serial = mc.cubify_indexed(data)
+    local mesher = mc.BrickMesher(data, {brick_size = 1000})
+    expect(mesher.n_bricks):to_be(1)
+    local merged = mesher:merge()
+    expect(merged.n_indices):to_be(serial.n_indices)
+    merged:release()
+    mesher:release()
+    serial:release()
+
+    local empty = mc.BrickMesher(data, {limits = {x_start = 4, x_end = 4}})
+    expect(empty.n_bricks):to_be(0)
+    empty:release()
+  end)
+
+  test("mesh buffers can be reused", function()
+    local data = sphere(12)
+    local mesh = mc.cubify_indexed(data)
+    local nverts, nindices = mesh.n_vertices, mesh.n_indices
+    mc.cubify_indexed(data, nil, mesh)
+    expect(mesh.n_vertices):to_be(nverts)
+    expect(mesh.n_indices):to_be(nindices)
+    mesh:release()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("marching cubes", test_marching_cubes)
+end
+
+return m
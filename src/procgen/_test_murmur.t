@@ -44,6 +44,81 @@ local function test_murmur(jape)
     local h = murmur.murmur_128(s, l, 1) -- note non-zero seed
     expect(hash_to_string(h)):to_be("6eff5cb54610abe578f8358351622daa")
   end)
+
+  -- deterministic pseudo-random test data
+  local function test_data(n)
+    local data = terralib.new(uint8[math.max(n, 1)])
+    local x = 12345
+    for i = 0, n - 1 do
+      x = (x * 1103515245 + 12345) % 2147483648
+      data[i] = x % 256
+    end
+    return data
+  end
+
+  test("streaming murmur matches one-shot", function()
+    local all_match = true
+    for _, n in ipairs({0, 1, 7, 15, 16, 17, 100, 1000}) do
+      local data = test_data(n)
+      local expected = hash_to_string(murmur.murmur_128(data, n, 7))
+      for _, chunk in ipairs({1, 3, 16, 33}) do
+        local state = terralib.new(murmur.murmur_state_t)
+        state:init(7)
+        local pos = 0
+        while pos < n do
+          local amount = math.min(chunk, n - pos)
+          state:update(data + pos, amount)
+          pos = pos + amount
+        end
+        if hash_to_string(state:finalize()) ~= expected then all_match = false end
+      end
+    end
+    expect(all_match):to_be_truthy()
+  end)
+
+  test("streaming hash64 matches one-shot", function()
+    local all_match = true
+    local seen = {}
+    -- (including both sides of the short input cutoff)
+    local sizes = {0, 1, 8, 9, 16, 17, 63, 64, 65, 1023, 1024, 1025, 5000}
+    for _, n in ipairs(sizes) do
+      local data = test_data(n)
+      local expected = murmur.hash64(data, n, 3)
+      seen[murmur.hash64_to_string(expected)] = true
+      for _, chunk in ipairs({1, 5, 64, 100}) do
+        local state = terralib.new(murmur.hash64_state_t)
+        state:init(3)
+        local pos = 0
+        while pos < n do
+          local amount = math.min(chunk, n - pos)
+          state:update(data + pos, amount)
+          pos = pos + amount
+        end
+        if state:finalize() ~= expected then all_match = false end
+      end
+    end
+    expect(all_match):to_be_truthy()
+    local ndistinct = 0
+    for _, _ in pairs(seen) do ndistinct = ndistinct + 1 end
+    expect(ndistinct):to_be(#sizes)
+  end)
+
+  test("file hashing matches in-memory hashing", function()
+    local n = 10000
+    local data = test_data(n)
+    local filename = os.tmpname()
+    local outfile = io.open(filename, "wb")
+    outfile:write(require("ffi").string(data, n))
+    outfile:close()
+
+    local opts = {chunk_size = 777}
+    local h128 = murmur.hash_file(filename, opts)
+    expect(hash_to_string(h128)):to_be(hash_to_string(murmur.murmur_128(data, n, 0)))
+    opts.algorithm = "hash64"
+    expect(murmur.hash_file(filename, opts) == murmur.hash64(data, n, 0)):to_be_truthy()
+    os.remove(filename)
+    expect(murmur.hash_file(filename)):to_be(nil)
+  end)
 end
 
 function m.init(jape)
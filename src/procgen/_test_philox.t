@@ -0,0 +1,79 @@
+-- counter-based random stream tests
+
+local m = {}
+
+local function test_philox(jape)
+  local philox = require("./philox.t")
+  local test, expect = jape.test, jape.expect
+
+  test("known answer", function()
+    -- Random123 kat_vectors: philox4x32 10, zero counter and key
+    local ctr = terralib.new(uint32[4], {0, 0, 0, 0})
+    local key = terralib.new(uint32[2], {0, 0})
+    local out = terralib.new(uint32[4])
+    philox.philox4x32(ctr, key, out)
+    expect(out[0]):to_be(0x6627e8d5)
+    expect(out[1]):to_be(0xe169c58d)
+    expect(out[2]):to_be(0xbc57ac4c)
+    expect(out[3]):to_be(0x9b00dbd8)
+  end)
+
+  test("fills don't depend on chunking", function()
+    local n = 1000
+    local whole = philox.CounterRandom(1234, 5):fill_uint32(terralib.new(uint32[n]), n)
+    local gen = philox.CounterRandom(1234, 5)
+    local chunks = terralib.new(uint32[n])
+    local pos, chunk = 0, 1
+    while pos < n do
+      local amount = math.min(chunk, n - pos)
+      gen:fill_uint32(chunks + pos, amount)
+      pos, chunk = pos + amount, chunk + 2
+    end
+    local all_match = true
+    for i = 0, n - 1 do
+      if whole[i] ~= chunks[i] then all_match = false end
+    end
+    expect(all_match):to_be_truthy()
+
+    -- and seeking gives the same words as generating up to them
+    local seeker = philox.CounterRandom(1234, 5)
+    seeker:seek(517)
+    expect(seeker:rand_uint32()):to_be(whole[517])
+  end)
+
+  test("streams differ", function()
+    local gen = philox.CounterRandom("some seed")
+    local a = gen:fill_uint32(terralib.new(uint32[64]), 64)
+    local b = gen:split(1):fill_uint32(terralib.new(uint32[64]), 64)
+    local nsame = 0
+    for i = 0, 63 do
+      if a[i] == b[i] then nsame = nsame + 1 end
+    end
+    expect(nsame < 2):to_be_truthy()
+  end)
+
+  test("uniform and normal fills", function()
+    local n = 20000
+    local gen = philox.CounterRandom(99)
+    local u = gen:fill_uniform(terralib.new(float[n]), n)
+    local z = gen:fill_normal(terralib.new(float[n]), n, 1.0, 2.0)
+    local umin, umax, usum, zsum, zsum2 = 1, 0, 0, 0, 0
+    for i = 0, n - 1 do
+      umin, umax = math.min(umin, u[i]), math.max(umax, u[i])
+      usum = usum + u[i]
+      zsum, zsum2 = zsum + z[i], zsum2 + z[i]*z[i]
+    end
+    local zmean = zsum / n
+    local zvar = zsum2 / n - zmean*zmean
+    expect(umin >= 0 and umax < 1):to_be_truthy()
+    expect(usum / n):to_be_in_range(0.48, 0.52)
+    expect(zmean):to_be_in_range(0.9, 1.1)
+    expect(zvar):to_be_in_range(3.7, 4.3)
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("philox", test_philox)
+end
+
+return m
@@ -0,0 +1,91 @@
+-- simplex noise tests
+
+local m = {}
+
+local function test_simplex(jape)
+  local simplex = require("./simplex.t")
+  local test, expect = jape.test, jape.expect
+
+  -- (n isn't a multiple of the vector width, to cover the tail)
+  local n = 103
+  local function sample_points()
+    local xs = terralib.new(double[n])
+    local ys = terralib.new(double[n])
+    local zs = terralib.new(double[n])
+    for i = 0, n - 1 do
+      xs[i] = (i * 0.37) - 17.1
+      ys[i] = (i * -0.23) + 4.9
+      zs[i] = math.sin(i) * 9.3
+    end
+    return xs, ys, zs
+  end
+
+  test("2d batch matches scalar", function()
+    local xs, ys = sample_points()
+    local out = terralib.new(double[n])
+    simplex.simplex_2d_batch(xs, ys, out, n, simplex.noisetable_c)
+    local max_err = 0
+    for i = 0, n - 1 do
+      local err = math.abs(out[i] - simplex.simplex_2d(xs[i], ys[i]))
+      max_err = math.max(max_err, err)
+    end
+    expect(max_err < 1e-12):to_be_truthy()
+  end)
+
+  test("3d batch matches scalar", function()
+    local xs, ys, zs = sample_points()
+    local out = terralib.new(double[n])
+    simplex.simplex_3d_batch(xs, ys, zs, out, n, simplex.noisetable_c)
+    local max_err = 0
+    for i = 0, n - 1 do
+      local err = math.abs(out[i] - simplex.simplex_3d(xs[i], ys[i], zs[i]))
+      max_err = math.max(max_err, err)
+    end
+    expect(max_err < 1e-12):to_be_truthy()
+  end)
+
+  test("fbm grid sums octaves", function()
+    local w, h, d = 13, 5, 3
+    local grid = terralib.new(float[w*h*d])
+    local opts = {octaves = 3, origin = {0.5, 1.5, -2.0}, step = {0.1, 0.2, 0.3}}
+    simplex.simplex_3d_grid(grid, w, h, d, opts)
+    local max_err = 0
+    for k = 0, d - 1 do
+      for j = 0, h - 1 do
+        for i = 0, w - 1 do
+          local x, y, z = 0.5 + i*0.1, 1.5 + j*0.2, -2.0 + k*0.3
+          local expected = simplex.simplex_3d(x, y, z)
+                         + 0.5 * simplex.simplex_3d(2*x, 2*y, 2*z)
+                         + 0.25 * simplex.simplex_3d(4*x, 4*y, 4*z)
+          local err = math.abs(grid[(k*h + j)*w + i] - expected)
+          max_err = math.max(max_err, err)
+        end
+      end
+    end
+    expect(max_err < 1e-5):to_be_truthy()
+  end)
+
+  test("threaded grid matches serial", function()
+    local jobs = require("async/jobs.t")
+    local job_system = jobs.JobSystem{threads = 2}
+    local w, h = 37, 29
+    local serial = terralib.new(float[w*h])
+    local threaded = terralib.new(float[w*h])
+    local opts = {octaves = 4, step = {0.05, 0.05}}
+    simplex.simplex_2d_grid(serial, w, h, opts)
+    opts.jobs = job_system
+    simplex.simplex_2d_grid(threaded, w, h, opts)
+    job_system:release()
+    local all_match = true
+    for i = 0, w*h - 1 do
+      if serial[i] ~= threaded[i] then all_match = false end
+    end
+    expect(all_match):to_be_truthy()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("simplex noise", test_simplex)
+end
+
+return m
@@ -52,6 +52,50 @@ local function test_srand(jape)
       expect(counts[idx]):to_be_in_range(8000, 12000)
     end
   end)
+
+  test("bulk fill continues the byte stream", function()
+    local other = srand.StrongRandom("some test seed")
+    -- start partway into a block, then cover several multi-blocks
+    local n = 1000
+    local bytes = terralib.new(uint8[n])
+    for i = 0, 2 do bytes[i] = other:rand_uint8() end
+    other:fill_random(bytes + 3, n - 3)
+    local all_match = true
+    for i = 0, n - 1 do
+      if gen:rand_uint8() ~= bytes[i] then all_match = false end
+    end
+    expect(all_match):to_be_truthy()
+    -- and back to single bytes afterwards
+    expect(other:rand_uint8()):to_be(gen:rand_uint8())
+  end)
+
+  test("float and int fills", function()
+    local n = 10000
+    local floats = gen:fill_float(terralib.new(float[n]), n)
+    local ints = gen:fill_int(terralib.new(int32[n]), n, -3, 2)
+    local fmin, fmax, imin, imax = 1, 0, 100, -100
+    for i = 0, n - 1 do
+      fmin, fmax = math.min(fmin, floats[i]), math.max(fmax, floats[i])
+      imin, imax = math.min(imin, ints[i]), math.max(imax, ints[i])
+    end
+    expect(fmin >= 0 and fmin < 0.01):to_be_truthy()
+    expect(fmax < 1 and fmax > 0.99):to_be_truthy()
+    expect(imin):to_be(-3)
+    expect(imax):to_be(1)
+  end)
+
+  test("int fill over a span wider than int32", function()
+    local n = 1000
+    local lower, upper = -2000000000, 2000000000
+    local ints = gen:fill_int(terralib.new(int32[n]), n, lower, upper)
+    local in_range, negative, positive = true, 0, 0
+    for i = 0, n - 1 do
+      if ints[i] < lower or ints[i] >= upper then in_range = false end
+      if ints[i] < 0 then negative = negative + 1 else positive = positive + 1 end
+    end
+    expect(in_range):to_be_truthy()
+    expect(negative > 400 and positive > 400):to_be_truthy()
+  end)
 end
 
 function m.init(jape)
@@ -4,6 +4,9 @@ function m.init(jape)
   (jape or require("dev/jape.t")).describe("procgen", function(jape)
     require("./_test_strongrand.t").init(jape)
     require("./_test_murmur.t").init(jape)
+    require("./_test_marchingcubes.t").init(jape)
+    require("./_test_simplex.t").init(jape)
+    require("./_test_philox.t").init(jape)
   end)
 end
 
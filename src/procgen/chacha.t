@@ -2,6 +2,7 @@
 --
 -- implementation of the chacha20 symmetric cipher
 
+local libc = require("substrate/libc.t")
 local m = {}
 
 --[[LICENSE
@@ -98,6 +99,20 @@ local terra QUARTERROUND(x: &uint32, a: uint8, b: uint8, c: uint8, d: uint8)
   x[b] = ROTL32(x[b] ^ x[c], 7)
 end
 
+-- (128 bit increment of schedule[12..15], see :block)
+local terra increment_counter(nonce: &uint32)
+  nonce[0] = nonce[0] + 1
+  if nonce[0] == 0 then
+    nonce[1] = nonce[1] + 1
+    if nonce[1] == 0 then
+      nonce[2] = nonce[2] + 1
+      if nonce[2] == 0 then
+        nonce[3] = nonce[3] + 1
+      end
+    end
+  end
+end
+
 terra chacha20_ctx:block(output: &uint32)
   var nonce: &uint32 = (self.schedule) + 12 --12 is where the 128 bit counter is
 
@@ -127,18 +142,111 @@ terra chacha20_ctx:block(output: &uint32)
   This implementation will remain compatible with the official up to 2^64 blocks, and past that point, the official is not intended to be used.
   This implementation with this change also allows this algorithm to become compatible for a Fortuna-like construct.
   ]]--
-  nonce[0] = nonce[0] + 1
-  if nonce[0] == 0 then
-    nonce[1] = nonce[1] + 1
-    if nonce[1] == 0 then
-      nonce[2] = nonce[2] + 1
-      if nonce[2] == 0 then
-        nonce[3] = nonce[3] + 1
+  increment_counter(nonce)
+end
+
+-- Multi-block keystream --
+--
+-- BLOCK_LANES consecutive blocks are computed at once, with lane i of
+-- each state vector holding word j of block i, so that every
+-- quarterround operation is a single vector instruction.
+
+local BLOCK_LANES = 4
+m.BLOCK_LANES = BLOCK_LANES
+local BLOCKS_BYTES = 64 * BLOCK_LANES
+local VU = vector(uint32, BLOCK_LANES)
+
+local function vrotl(v, n)
+  return `(v << [VU](n)) or (v >> [VU](32 - n))
+end
+
+local function vquarterround(x, a, b, c, d)
+  return quote
+    [x[a]] = [x[a]] + [x[b]]
+    [x[d]] = [vrotl(`[x[d]] ^ [x[a]], 16)]
+    [x[c]] = [x[c]] + [x[d]]
+    [x[b]] = [vrotl(`[x[b]] ^ [x[c]], 12)]
+    [x[a]] = [x[a]] + [x[b]]
+    [x[d]] = [vrotl(`[x[d]] ^ [x[a]], 8)]
+    [x[c]] = [x[c]] + [x[d]]
+    [x[b]] = [vrotl(`[x[b]] ^ [x[c]], 7)]
+  end
+end
+
+-- writes the next BLOCK_LANES blocks (BLOCK_LANES*16 words), exactly
+-- as that many calls to :block would
+terra chacha20_ctx:blocks(output: &uint32)
+  var schedules: uint32[16][BLOCK_LANES]
+  for lane = 0, BLOCK_LANES do
+    for i = 0, 16 do schedules[lane][i] = self.schedule[i] end
+    increment_counter(self.schedule + 12)
+  end
+  escape
+    local x, init = {}, {}
+    for i = 0, 15 do
+      local elems = {}
+      for lane = 0, BLOCK_LANES - 1 do elems[lane + 1] = `schedules[lane][i] end
+      x[i], init[i] = symbol(VU), symbol(VU)
+      emit(quote
+        var [init[i]] = vectorof(uint32, [elems])
+        var [x[i]] = [init[i]]
+      end)
+    end
+    emit(quote
+      for round = 0, 10 do
+        [vquarterround(x, 0, 4, 8, 12)]
+        [vquarterround(x, 1, 5, 9, 13)]
+        [vquarterround(x, 2, 6, 10, 14)]
+        [vquarterround(x, 3, 7, 11, 15)]
+        [vquarterround(x, 0, 5, 10, 15)]
+        [vquarterround(x, 1, 6, 11, 12)]
+        [vquarterround(x, 2, 7, 8, 13)]
+        [vquarterround(x, 3, 4, 9, 14)]
       end
+    end)
+    for i = 0, 15 do
+      emit(quote
+        var result = [x[i]] + [init[i]]
+        escape
+          for lane = 0, BLOCK_LANES - 1 do
+            emit(quote output[lane*16 + i] = result[lane] end)
+          end
+        end
+      end)
     end
   end
 end
 
+-- writes n bytes of keystream to dest; this continues the same
+-- stream as :encrypt_raw (i.e., it is encrypting zeros), starting
+-- with any keystream left over from the previous call
+terra chacha20_ctx:fill_random(dest: &uint8, n: uint64)
+  var keystream: &uint8 = [&uint8](&(self.keystream))
+  var pos: uint64 = 0
+
+  if self.available > 0 then
+    var amount = MIN(n, self.available)
+    libc.string.memcpy(dest, keystream + (64 - self.available), amount)
+    self.available = self.available - amount
+    pos = amount
+  end
+
+  var blocks: uint32[16*BLOCK_LANES]
+  while n - pos >= BLOCKS_BYTES do
+    self:blocks(blocks)
+    libc.string.memcpy(dest + pos, &blocks, BLOCKS_BYTES)
+    pos = pos + BLOCKS_BYTES
+  end
+
+  while pos < n do
+    var amount = MIN(n - pos, 64)
+    self:block(self.keystream)
+    libc.string.memcpy(dest + pos, keystream, amount)
+    self.available = 64 - amount
+    pos = pos + amount
+  end
+end
+
 local terra stream_xor(keystream: &uint8, inptr: &uint8, outptr: &uint8, length: uint64)
   for i = 0,length do
     outptr[i] = inptr[i] ^ keystream[i]
@@ -4,11 +4,14 @@
 
 local m = {}
 
+local class = require("class")
 local math = require("math")
 local vec4 = require("math/types.t").vec4_
 local libc = require("substrate/libc.t")
 local cmath = libc.math
 local cio = libc.io
+local jobs = require("async/jobs.t")
+local jobs_Job, jobs_spawn_child = jobs.Job, jobs.spawn_child
 
 local struct index_list {
   n_indices: uint8;
@@ -20,10 +23,20 @@ local struct edge {
   v1: uint8;
 }
 
+-- which grid point (offset from the cell's origin corner) an edge
+-- starts at, and along which axis (0=x, 1=y, 2=z) it runs
+local struct edge_key {
+  dx: uint8;
+  dy: uint8;
+  dz: uint8;
+  axis: uint8;
+}
+
 local struct march_tables {
   edge_table: uint32[256];
   tri_table:  index_list[256];
   edge_verts: edge[12];
+  edge_keys: edge_key[12];
 }
 
 local function create_tables()
@@ -355,6 +368,27 @@ local function create_tables()
     edge_verts[i].v1 = _edge_verts[i+1][2]
   end
 
+  local _edge_keys = {
+    {0, 0, 0, 0},
+    {1, 0, 0, 1},
+    {0, 1, 0, 0},
+    {0, 0, 0, 1},
+    {0, 0, 1, 0},
+    {1, 0, 1, 1},
+    {0, 1, 1, 0},
+    {0, 0, 1, 1},
+    {0, 0, 0, 2},
+    {1, 0, 0, 2},
+    {1, 1, 0, 2},
+    {0, 1, 0, 2}
+  }
+  local edge_keys = tables.edge_keys
+  for i = 0, 11 do
+    local k = _edge_keys[i+1]
+    edge_keys[i].dx, edge_keys[i].dy = k[1], k[2]
+    edge_keys[i].dz, edge_keys[i].axis = k[3], k[4]
+  end
+
   return tables
 end
 
@@ -425,19 +459,25 @@ local terra interp(p0: &vec4, p1: &vec4, v0: float, v1: float): vec4
   return p
 end
 
--- Create the triangles for a cell.
-terra m._gen_cell(tables: &march_tables,
-                  gridvals: &float, 
-                  gridpositions: &vec4,
-                  triangles: &tri_list)
-  -- Determine the index into the edge table which
-  -- tells us which vertices are inside of the surface
+-- Determine the index into the edge table which
+-- tells us which vertices are inside of the surface
+local terra cube_index(gridvals: &float): uint8
   var cubeindex: uint8 = 0
   var idxpow: uint8 = 1
   for p = 0, 8 do
     if gridvals[p] < 0.0 then cubeindex = cubeindex + idxpow end
     idxpow = idxpow * 2
   end
+  return cubeindex
+end
+cube_index:setinlined(true)
+
+-- Create the triangles for a cell.
+terra m._gen_cell(tables: &march_tables,
+                  gridvals: &float, 
+                  gridpositions: &vec4,
+                  triangles: &tri_list)
+  var cubeindex = cube_index(gridvals)
 
   var edgeindex = tables.edge_table[cubeindex]
   var vertlist: vec4[12]
@@ -464,6 +504,135 @@ terra m._gen_cell(tables: &march_tables,
   end
 end
 
+-- growable vertex + uint32 index buffers for indexed output
+local struct mesh_buffers {
+  vertices: &vec4;
+  n_vertices: uint32;
+  vertex_capacity: uint32;
+  indices: &uint32;
+  n_indices: uint32;
+  index_capacity: uint32;
+  failed: bool; -- an allocation failed, so the mesh is incomplete
+}
+m.mesh_buffers = mesh_buffers
+
+terra mesh_buffers:init()
+  self.vertices, self.indices = nil, nil
+  self.n_vertices, self.vertex_capacity = 0, 0
+  self.n_indices, self.index_capacity = 0, 0
+  self.failed = false
+end
+
+terra mesh_buffers:release()
+  libc.std.free(self.vertices)
+  libc.std.free(self.indices)
+  self:init()
+end
+
+-- keeps the allocated capacity
+terra mesh_buffers:clear()
+  self.n_vertices, self.n_indices = 0, 0
+  self.failed = false
+end
+
+-- returns false (and sets .failed) if an allocation failed; the
+-- buffers are then left as they were
+terra mesh_buffers:reserve(n_vertices: uint32, n_indices: uint32): bool
+  if n_vertices > self.vertex_capacity then
+    var vertices = libc.std.realloc(self.vertices, n_vertices * sizeof(vec4))
+    if vertices == nil then
+      self.failed = true
+      return false
+    end
+    self.vertices = [&vec4](vertices)
+    self.vertex_capacity = n_vertices
+  end
+  if n_indices > self.index_capacity then
+    var indices = libc.std.realloc(self.indices, n_indices * sizeof(uint32))
+    if indices == nil then
+      self.failed = true
+      return false
+    end
+    self.indices = [&uint32](indices)
+    self.index_capacity = n_indices
+  end
+  return true
+end
+
+local NO_VERTEX = terralib.constant(uint32, 0xFFFFFFFF)
+
+-- (returns NO_VERTEX if out of memory)
+terra mesh_buffers:push_vertex(v: &vec4): uint32
+  if self.n_vertices >= self.vertex_capacity then
+    var cap = self.vertex_capacity * 2
+    if cap < 1024 then cap = 1024 end
+    if not self:reserve(cap, 0) then return NO_VERTEX end
+  end
+  var idx = self.n_vertices
+  self.vertices[idx] = @v
+  self.n_vertices = idx + 1
+  return idx
+end
+
+-- (triangles with a missing vertex, or that don't fit, are dropped)
+terra mesh_buffers:push_triangle(i0: uint32, i1: uint32, i2: uint32)
+  if i0 == NO_VERTEX or i1 == NO_VERTEX or i2 == NO_VERTEX then return end
+  if self.n_indices + 3 > self.index_capacity then
+    var cap = self.index_capacity * 2
+    if cap < 3072 then cap = 3072 end
+    if not self:reserve(0, cap) then return end
+  end
+  var dest = self.indices + self.n_indices
+  dest[0], dest[1], dest[2] = i0, i1, i2
+  self.n_indices = self.n_indices + 3
+end
+
+-- Create indexed triangles for a cell, sharing vertices with
+-- neighbouring cells through the edge caches: one cache per z slice
+-- of grid points, with three edges (+x, +y, +z) per point
+terra m._gen_cell_indexed(tables: &march_tables,
+                          gridvals: &float,
+                          gridpositions: &vec4,
+                          cache_z0: &uint32, cache_z1: &uint32,
+                          cx: uint32, cy: uint32, row_stride: uint32,
+                          mesh: &mesh_buffers)
+  var cubeindex = cube_index(gridvals)
+  var edgeindex = tables.edge_table[cubeindex]
+  if edgeindex == 0 then return end -- entirely in/out of the surface
+
+  var vertidx: uint32[12]
+  for i = 0, 12 do
+    if edgeindex % 2 == 1 then
+      var key = tables.edge_keys[i]
+      var cache = cache_z0
+      if key.dz ~= 0 then cache = cache_z1 end
+      var slot = ((cy + key.dy) * row_stride + (cx + key.dx)) * 3 + key.axis
+      if cache[slot] == NO_VERTEX then
+        var idx0 = tables.edge_verts[i].v0
+        var idx1 = tables.edge_verts[i].v1
+        -- always interpolate from the edge's lower end, so that cells
+        -- in different bricks produce bit-identical shared vertices
+        var p0, p1 = gridpositions[idx0], gridpositions[idx1]
+        if p0.x + p0.y + p0.z > p1.x + p1.y + p1.z then
+          p0, p1 = p1, p0
+          idx0, idx1 = idx1, idx0
+        end
+        var v = interp(&p0, &p1, gridvals[idx0], gridvals[idx1])
+        v.w = 1.0
+        cache[slot] = mesh:push_vertex(&v)
+      end
+      vertidx[i] = cache[slot]
+    end
+    edgeindex = edgeindex / 2
+  end
+
+  var n_indices = tables.tri_table[cubeindex].n_indices
+  var indices = tables.tri_table[cubeindex].indices
+  for i = 0, n_indices, 3 do
+    mesh:push_triangle(vertidx[indices[i]], vertidx[indices[i+1]], vertidx[indices[i+2]])
+  end
+end
+
 local struct cube_data {
   vals: &float;
   w: uint32;
@@ -527,6 +696,516 @@ terra m._cubify(tables: &march_tables, data: &cube_data, triangles: &tri_list)
   end
 end
 
+-- like _cubify, but appends a vertex-sharing indexed mesh to mesh;
+-- if given, bottom_cache/top_cache receive the edge caches of the
+-- lowest and highest z slices (for stitching slabs together)
+terra m._cubify_indexed_slices(tables: &march_tables, data: &cube_data, mesh: &mesh_buffers,
+                               bottom_cache: &uint32, top_cache: &uint32)
+  var values: float[8]
+  var positions: vec4[8]
+  var p_offsets: vec4[8]
+
+  p_offsets[0], p_offsets[1] = vec4{0.0, 0.0, 0.0, 1.0}, vec4{1.0, 0.0, 0.0, 1.0}
+  p_offsets[2], p_offsets[3] = vec4{1.0, 1.0, 0.0, 1.0}, vec4{0.0, 1.0, 0.0, 1.0}
+  p_offsets[4], p_offsets[5] = vec4{0.0, 0.0, 1.0, 1.0}, vec4{1.0, 0.0, 1.0, 1.0}
+  p_offsets[6], p_offsets[7] = vec4{1.0, 1.0, 1.0, 1.0}, vec4{0.0, 1.0, 1.0, 1.0}
+
+  if data.x_end <= data.x_start + 1 or data.y_end <= data.y_start + 1
+     or data.z_end <= data.z_start + 1 then
+    return
+  end
+
+  var x_stride: int32 = 1;
+  var y_stride: int32 = data.w;
+  var z_stride: int32 = data.w * data.h;
+
+  -- edge caches for the grid points of the cells' lower and upper
+  -- z slices
+  var row_stride: uint32 = data.x_end - data.x_start
+  var slice_size: uint32 = row_stride * (data.y_end - data.y_start) * 3
+  var cache_z0 = [&uint32](libc.std.malloc(slice_size * sizeof(uint32)))
+  var cache_z1 = [&uint32](libc.std.malloc(slice_size * sizeof(uint32)))
+  libc.string.memset(cache_z1, 0xFF, slice_size * sizeof(uint32))
+
+  for z = data.z_start, data.z_end - 1 do
+    -- the old upper slice is the new lower slice
+    cache_z0, cache_z1 = cache_z1, cache_z0
+    libc.string.memset(cache_z1, 0xFF, slice_size * sizeof(uint32))
+    for y = data.y_start, data.y_end - 1 do
+      for x = data.x_start, data.x_end - 1 do
+        for jj = 0, 8 do
+          positions[jj].x = p_offsets[jj].x + x
+          positions[jj].y = p_offsets[jj].y + y
+          positions[jj].z = p_offsets[jj].z + z
+        end
+        var corner: int32 = x + (y * data.w) + (z * data.w * data.h)
+        values[0] = data.vals[corner]
+        values[1] = data.vals[corner + x_stride]
+        values[2] = data.vals[corner + x_stride + y_stride]
+        values[3] = data.vals[corner + y_stride]
+        corner = corner + z_stride
+        values[4] = data.vals[corner]
+        values[5] = data.vals[corner + x_stride]
+        values[6] = data.vals[corner + x_stride + y_stride]
+        values[7] = data.vals[corner + y_stride]
+
+        m._gen_cell_indexed(tables, values, positions, cache_z0, cache_z1,
+                            x - data.x_start, y - data.y_start, row_stride, mesh)
+      end
+    end
+    if z == data.z_start and bottom_cache ~= nil then
+      libc.string.memcpy(bottom_cache, cache_z0, slice_size * sizeof(uint32))
+    end
+  end
+  if top_cache ~= nil then
+    libc.string.memcpy(top_cache, cache_z1, slice_size * sizeof(uint32))
+  end
+
+  libc.std.free(cache_z0)
+  libc.std.free(cache_z1)
+end
+
+terra m._cubify_indexed(tables: &march_tables, data: &cube_data, mesh: &mesh_buffers)
+  m._cubify_indexed_slices(tables, data, mesh, nil, nil)
+end
+
+-- Parallel indexed polygonization: the volume is split into slabs
+-- along z, which are polygonized as separate jobs. Neighbouring slabs
+-- generate the same vertices on the plane they share, so each slab
+-- drops its copies of its bottom plane's vertices in favour of the
+-- slab below's, and after a prefix sum over the slabs' (remaining)
+-- vertex and index counts, every slab copies its part of the mesh
+-- into the output in parallel.
+local struct mc_slab {
+  parent: &opaque; -- &mc_parallel
+  idx: uint32;
+  data: cube_data;
+  mesh: mesh_buffers;
+  bottom: &uint32;
+  top: &uint32;
+  -- per slab vertex: its index among the slab's kept vertices, or
+  -- NO_VERTEX for duplicates of the slab below's
+  compact: &uint32;
+  -- per slab vertex: its index in the output (filled in by stitch_slab)
+  remap: &uint32;
+  n_dups: uint32;
+  vert_offset: uint32;
+  index_offset: uint32;
+}
+
+local struct mc_parallel {
+  tables: &march_tables;
+  slabs: &mc_slab;
+  n_slabs: uint32;
+  slice_size: uint32;
+  out: &mesh_buffers;
+}
+m.mc_slab = mc_slab
+m.mc_parallel = mc_parallel
+
+-- (only edges along x and y lie in a z slice)
+local terra in_plane(slot: uint32): bool
+  return slot % 3 < 2
+end
+
+-- (everything a slab needs is allocated here, so that stitching can't
+-- fail; on failure the slab's mesh is marked failed)
+local terra polygonize_slab(job: &jobs_Job, arg: &opaque)
+  var slab = [&mc_slab](arg)
+  var par = [&mc_parallel](slab.parent)
+  var slice_size = par.slice_size
+  slab.mesh:init()
+  slab.bottom = [&uint32](libc.std.malloc(slice_size * sizeof(uint32)))
+  slab.top = [&uint32](libc.std.malloc(slice_size * sizeof(uint32)))
+  if slab.bottom == nil or slab.top == nil then
+    slab.mesh.failed = true
+    return
+  end
+  libc.string.memset(slab.bottom, 0xFF, slice_size * sizeof(uint32))
+  libc.string.memset(slab.top, 0xFF, slice_size * sizeof(uint32))
+  m._cubify_indexed_slices(par.tables, &slab.data, &slab.mesh, slab.bottom, slab.top)
+
+  if slab.mesh.failed then return end
+
+  var nverts = slab.mesh.n_vertices
+  slab.compact = [&uint32](libc.std.malloc((nverts + 1) * sizeof(uint32)))
+  slab.remap = [&uint32](libc.std.malloc((nverts + 1) * sizeof(uint32)))
+  if slab.compact == nil or slab.remap == nil then
+    slab.mesh.failed = true
+    return
+  end
+  libc.string.memset(slab.compact, 0, nverts * sizeof(uint32))
+  if slab.idx > 0 then
+    for slot = 0, slice_size do
+      var v = slab.bottom[slot]
+      if v ~= NO_VERTEX and in_plane(slot) then slab.compact[v] = NO_VERTEX end
+    end
+  end
+  var kept: uint32 = 0
+  for v = 0, nverts do
+    if slab.compact[v] ~= NO_VERTEX then
+      slab.compact[v] = kept
+      kept = kept + 1
+    end
+  end
+  slab.n_dups = nverts - kept
+end
+
+local terra stitch_slab(job: &jobs_Job, arg: &opaque)
+  var slab = [&mc_slab](arg)
+  var par = [&mc_parallel](slab.parent)
+  var out = par.out
+  var nverts = slab.mesh.n_vertices
+  var remap = slab.remap
+  for v = 0, nverts do
+    var c = slab.compact[v]
+    if c ~= NO_VERTEX then
+      remap[v] = slab.vert_offset + c
+      out.vertices[slab.vert_offset + c] = slab.mesh.vertices[v]
+    end
+  end
+  if slab.idx > 0 then
+    var below = &par.slabs[slab.idx - 1]
+    for slot = 0, par.slice_size do
+      var v = slab.bottom[slot]
+      if v ~= NO_VERTEX and in_plane(slot) then
+        var shared = below.top[slot]
+        if shared ~= NO_VERTEX then
+          remap[v] = below.vert_offset + below.compact[shared]
+        else
+          -- (the slabs disagree on the plane: shouldn't happen unless a
+          --  vertex was dropped, but keep the index in range)
+          remap[v] = 0
+          out.failed = true
+        end
+      end
+    end
+  end
+  var dest = out.indices + slab.index_offset
+  for i = 0, slab.mesh.n_indices do
+    dest[i] = remap[slab.mesh.indices[i]]
+  end
+end
+
+local terra polygonize_slabs(job: &jobs_Job, arg: &opaque)
+  var par = [&mc_parallel](arg)
+  for k = 0, par.n_slabs do
+    jobs_spawn_child(job, polygonize_slab, &par.slabs[k])
+  end
+end
+
+-- (runs as the continuation of polygonize_slabs)
+local terra stitch_slabs(job: &jobs_Job, arg: &opaque)
+  var par = [&mc_parallel](arg)
+  par.out:clear()
+  for k = 0, par.n_slabs do
+    if par.slabs[k].mesh.failed then
+      par.out.failed = true
+      return -- (left empty)
+    end
+  end
+  var nverts: uint32, nindices: uint32 = 0, 0
+  for k = 0, par.n_slabs do
+    var slab = &par.slabs[k]
+    slab.vert_offset, slab.index_offset = nverts, nindices
+    nverts = nverts + slab.mesh.n_vertices - slab.n_dups
+    nindices = nindices + slab.mesh.n_indices
+  end
+  if not par.out:reserve(nverts, nindices) then return end -- (left empty)
+  par.out.n_vertices, par.out.n_indices = nverts, nindices
+  for k = 0, par.n_slabs do
+    jobs_spawn_child(job, stitch_slab, &par.slabs[k])
+  end
+end
+
+terra m._release_slabs(par: &mc_parallel)
+  for k = 0, par.n_slabs do
+    var slab = &par.slabs[k]
+    slab.mesh:release()
+    libc.std.free(slab.bottom)
+    libc.std.free(slab.top)
+    libc.std.free(slab.compact)
+    libc.std.free(slab.remap)
+    slab.bottom, slab.top, slab.compact, slab.remap = nil, nil, nil, nil
+  end
+end
+
+-- A min/max pyramid over the grid values, for skipping empty space:
+-- level 0 holds the value range of each brick of brick_size^3 cells
+-- (including the points on its upper faces), and each further level
+-- the range of 2x2x2 blocks of the level below. A brick can only
+-- contain surface if its range straddles the isolevel (0).
+local MAX_LEVELS = 16
+
+local struct minmax_pyramid {
+  brick_size: uint32;
+  -- cells covered (relative to the data's x/y/z_start)
+  origin: uint32[3];
+  n_cells: uint32[3];
+  n_levels: uint32;
+  dims: uint32[3][MAX_LEVELS];
+  offsets: uint32[MAX_LEVELS];
+  mins: &float;
+  maxs: &float;
+}
+m.minmax_pyramid = minmax_pyramid
+
+-- an empty range (fewer than two points along an axis) gives a
+-- pyramid with no bricks; brick_size is clamped to [1, largest side]
+terra minmax_pyramid:init(data: &cube_data, brick_size: uint32)
+  self.origin[0], self.origin[1], self.origin[2] = data.x_start, data.y_start, data.z_start
+  var starts = arrayof(uint32, data.x_start, data.y_start, data.z_start)
+  var ends = arrayof(uint32, data.x_end, data.y_end, data.z_end)
+  var max_cells: uint32 = 1
+  for axis = 0, 3 do
+    if ends[axis] > starts[axis] + 1 then
+      self.n_cells[axis] = ends[axis] - starts[axis] - 1
+    else
+      self.n_cells[axis] = 0
+    end
+    if self.n_cells[axis] > max_cells then max_cells = self.n_cells[axis] end
+  end
+  if brick_size < 1 then brick_size = 1 end
+  if brick_size > max_cells then brick_size = max_cells end
+  self.brick_size = brick_size
+  var total: uint32 = 0
+  var level: uint32 = 0
+  for axis = 0, 3 do
+    self.dims[0][axis] = (self.n_cells[axis] + brick_size - 1) / brick_size
+  end
+  while true do
+    var dims = self.dims[level]
+    self.offsets[level] = total
+    total = total + dims[0] * dims[1] * dims[2]
+    level = level + 1
+    if (dims[0] <= 1 and dims[1] <= 1 and dims[2] <= 1) or level == MAX_LEVELS then
+      break
+    end
+    for axis = 0, 3 do
+      self.dims[level][axis] = (dims[axis] + 1) / 2
+    end
+  end
+  self.n_levels = level
+  self.mins = [&float](libc.std.malloc((total + 1) * sizeof(float)))
+  self.maxs = [&float](libc.std.malloc((total + 1) * sizeof(float)))
+end
+
+terra minmax_pyramid:release()
+  libc.std.free(self.mins)
+  libc.std.free(self.maxs)
+  self.mins, self.maxs = nil, nil
+end
+
+terra minmax_pyramid:n_bricks(): uint32
+  var dims = self.dims[0]
+  return dims[0] * dims[1] * dims[2]
+end
+
+terra minmax_pyramid:node_index(level: uint32, bx: uint32, by: uint32, bz: uint32): uint32
+  var dims = self.dims[level]
+  return self.offsets[level] + bx + dims[0] * (by + dims[1] * bz)
+end
+
+-- the cell range [lo, hi) of a level 0 brick along an axis
+terra minmax_pyramid:brick_cells(axis: uint32, b: uint32): {uint32, uint32}
+  var lo = b * self.brick_size
+  var hi = lo + self.brick_size
+  if hi > self.n_cells[axis] then hi = self.n_cells[axis] end
+  return self.origin[axis] + lo, self.origin[axis] + hi
+end
+
+terra minmax_pyramid:_compute_brick(data: &cube_data, bx: uint32, by: uint32, bz: uint32)
+  var x0, x1 = self:brick_cells(0, bx)
+  var y0, y1 = self:brick_cells(1, by)
+  var z0, z1 = self:brick_cells(2, bz)
+  var lo = data.vals[x0 + data.w * (y0 + data.h * z0)]
+  var hi = lo
+  -- (cells [x0, x1) touch points [x0, x1])
+  for z = z0, z1 + 1 do
+    for y = y0, y1 + 1 do
+      var row = data.vals + data.w * (y + data.h * z)
+      for x = x0, x1 + 1 do
+        var v = row[x]
+        if v < lo then lo = v end
+        if v > hi then hi = v end
+      end
+    end
+  end
+  var idx = self:node_index(0, bx, by, bz)
+  self.mins[idx], self.maxs[idx] = lo, hi
+end
+
+terra minmax_pyramid:_compute_node(level: uint32, bx: uint32, by: uint32, bz: uint32)
+  var child_dims = self.dims[level - 1]
+  var lo, hi = [float](math.huge), -[float](math.huge)
+  for dz = 0, 2 do
+    for dy = 0, 2 do
+      for dx = 0, 2 do
+        var cx, cy, cz = bx*2 + dx, by*2 + dy, bz*2 + dz
+        if cx < child_dims[0] and cy < child_dims[1] and cz < child_dims[2] then
+          var child = self:node_index(level - 1, cx, cy, cz)
+          if self.mins[child] < lo then lo = self.mins[child] end
+          if self.maxs[child] > hi then hi = self.maxs[child] end
+        end
+      end
+    end
+  end
+  var idx = self:node_index(level, bx, by, bz)
+  self.mins[idx], self.maxs[idx] = lo, hi
+end
+
+-- recomputes level 0 bricks in [b0, b1) (per axis) and their ancestors
+terra minmax_pyramid:_update_bricks(data: &cube_data, b0: &uint32, b1: &uint32)
+  var lo: uint32[3]
+  var hi: uint32[3]
+  for axis = 0, 3 do lo[axis], hi[axis] = b0[axis], b1[axis] end
+  for bz = lo[2], hi[2] do
+    for by = lo[1], hi[1] do
+      for bx = lo[0], hi[0] do
+        self:_compute_brick(data, bx, by, bz)
+      end
+    end
+  end
+  for level = 1, self.n_levels do
+    for axis = 0, 3 do
+      lo[axis] = lo[axis] / 2
+      hi[axis] = (hi[axis] + 1) / 2
+    end
+    for bz = lo[2], hi[2] do
+      for by = lo[1], hi[1] do
+        for bx = lo[0], hi[0] do
+          self:_compute_node(level, bx, by, bz)
+        end
+      end
+    end
+  end
+end
+
+terra minmax_pyramid:build(data: &cube_data)
+  var b0 = arrayof(uint32, 0, 0, 0)
+  self:_update_bricks(data, &b0[0], &self.dims[0][0])
+end
+
+-- after the values of grid points [p0, p1) (absolute, per axis) have
+-- changed: updates the pyramid, and sets [b0, b1) to the range of
+-- bricks which need to be re-polygonized
+terra minmax_pyramid:update_region(data: &cube_data, p0: &uint32, p1: &uint32,
+                                   b0: &uint32, b1: &uint32): bool
+  for axis = 0, 3 do
+    var n = self.dims[0][axis]
+    var lo: int64 = [int64](p0[axis]) - self.origin[axis]
+    var hi: int64 = [int64](p1[axis]) - self.origin[axis]
+    -- a point on a brick's lower face also belongs to the brick below
+    lo = (lo - 1) / self.brick_size
+    if lo < 0 then lo = 0 end
+    hi = (hi - 1) / self.brick_size + 1
+    if hi > n then hi = n end
+    if hi <= lo or hi <= 0 then return false end
+    b0[axis], b1[axis] = lo, hi
+  end
+  self:_update_bricks(data, b0, b1)
+  return true
+end
+
+terra minmax_pyramid:is_active(level: uint32, bx: uint32, by: uint32, bz: uint32): bool
+  var idx = self:node_index(level, bx, by, bz)
+  return self.mins[idx] < 0.0 and self.maxs[idx] >= 0.0
+end
+
+-- marks active level 0 bricks below a node, descending only into
+-- active nodes; returns how many were found
+terra minmax_pyramid:_mark_active(level: uint32, bx: uint32, by: uint32, bz: uint32,
+                                  active: &uint8): uint32
+  if not self:is_active(level, bx, by, bz) then return 0 end
+  if level == 0 then
+    active[self:node_index(0, bx, by, bz)] = 1
+    return 1
+  end
+  var child_dims = self.dims[level - 1]
+  var count: uint32 = 0
+  for dz = 0, 2 do
+    for dy = 0, 2 do
+      for dx = 0, 2 do
+        var cx, cy, cz = bx*2 + dx, by*2 + dy, bz*2 + dz
+        if cx < child_dims[0] and cy < child_dims[1] and cz < child_dims[2] then
+          count = count + self:_mark_active(level - 1, cx, cy, cz, active)
+        end
+      end
+    end
+  end
+  return count
+end
+
+-- active: [n_bricks], set to 1 for bricks that might contain surface
+terra minmax_pyramid:find_active(active: &uint8): uint32
+  libc.string.memset(active, 0, self:n_bricks())
+  var top = self.n_levels - 1
+  var dims = self.dims[top]
+  var count: uint32 = 0
+  for bz = 0, dims[2] do
+    for by = 0, dims[1] do
+      for bx = 0, dims[0] do
+        count = count + self:_mark_active(top, bx, by, bz, active)
+      end
+    end
+  end
+  return count
+end
+
+-- (re)polygonizes one level 0 brick into its own mesh
+terra m._polygonize_brick(tables: &march_tables, data: &cube_data,
+                          pyramid: &minmax_pyramid, brick: uint32, mesh: &mesh_buffers)
+  mesh:clear()
+  var dims = pyramid.dims[0]
+  var bx, by, bz = brick % dims[0], (brick / dims[0]) % dims[1], brick / (dims[0] * dims[1])
+  if not pyramid:is_active(0, bx, by, bz) then return end
+  var sub = @data
+  var x0, x1 = pyramid:brick_cells(0, bx)
+  var y0, y1 = pyramid:brick_cells(1, by)
+  var z0, z1 = pyramid:brick_cells(2, bz)
+  sub.x_start, sub.x_end = x0, x1 + 1
+  sub.y_start, sub.y_end = y0, y1 + 1
+  sub.z_start, sub.z_end = z0, z1 + 1
+  m._cubify_indexed(tables, &sub, mesh)
+end
+
+terra m._polygonize_bricks(tables: &march_tables, data: &cube_data,
+                           pyramid: &minmax_pyramid, meshes: &mesh_buffers, active: &uint8)
+  pyramid:find_active(active)
+  for brick = 0, pyramid:n_bricks() do
+    if active[brick] ~= 0 then
+      m._polygonize_brick(tables, data, pyramid, brick, &meshes[brick])
+    else
+      meshes[brick]:clear()
+    end
+  end
+end
+
+-- concatenates per brick meshes into out
+terra m._merge_meshes(meshes: &mesh_buffers, n: uint32, out: &mesh_buffers)
+  var nverts: uint32, nindices: uint32 = 0, 0
+  for k = 0, n do
+    nverts = nverts + meshes[k].n_vertices
+    nindices = nindices + meshes[k].n_indices
+  end
+  out:clear()
+  for k = 0, n do
+    if meshes[k].failed then out.failed = true end
+  end
+  if not out:reserve(nverts, nindices) then return end -- (left empty)
+  for k = 0, n do
+    var mesh = &meshes[k]
+    var voffset = out.n_vertices
+    libc.string.memcpy(out.vertices + voffset, mesh.vertices, mesh.n_vertices * sizeof(vec4))
+    var dest = out.indices + out.n_indices
+    for i = 0, mesh.n_indices do
+      dest[i] = mesh.indices[i] + voffset
+    end
+    out.n_vertices = voffset + mesh.n_vertices
+    out.n_indices = out.n_indices + mesh.n_indices
+  end
+end
+
 terra m._add_data(target: &cube_data, addition: &cube_data, x: int32, y: int32, z: int32, mult: float)
   var sx: int32 = 0
   var ex: int32 = addition.w
@@ -662,6 +1341,249 @@ function m.cubify_to_geo(data, max_tris, scale, limits, target)
   return target
 end
 
+-- returns a mesh_buffers with a vertex-sharing indexed mesh
+-- (call :release() on it when done); mesh: optional mesh_buffers to
+-- reuse (it is cleared first). If memory runs out, the mesh is
+-- incomplete and its .failed is set.
+function m.cubify_indexed(data, limits, mesh)
+  if not m._tables then
+    m._tables = create_tables()
+  end
+  if not data.cubedata then
+    truss.error("No cubedata?")
+  end
+  if mesh then
+    mesh:clear()
+  else
+    mesh = terralib.new(mesh_buffers)
+    mesh:init()
+  end
+
+  local cd = data.cubedata
+  set_limits(cd, limits)
+  m._cubify_indexed(m._tables, cd, mesh)
+  return mesh
+end
+
+-- copies a mesh_buffers into geometry vertex/index arrays
+m._copy_mesh_fn = terralib.memoize(function(VertType, IndexType)
+  return terra(mesh: &mesh_buffers, verts: &VertType, indices: &IndexType, scale: float)
+    for i = 0, mesh.n_vertices do
+      var s = mesh.vertices[i]
+      verts[i].position[0] = s.x * scale
+      verts[i].position[1] = s.y * scale
+      verts[i].position[2] = s.z * scale
+    end
+    for i = 0, mesh.n_indices do
+      indices[i] = mesh.indices[i]
+    end
+  end
+end)
+
+-- copies an indexed mesh (from cubify_indexed) into a StaticGeometry,
+-- creating one with just positions if target is nil
+function m.mesh_to_geo(mesh, scale, target)
+  if mesh.n_indices == 0 then return nil end
+  local created_target = (not target)
+  if created_target then
+    local gfx = require("gfx")
+    local vtype = gfx.create_basic_vertex_type{"position"}
+    target = gfx.StaticGeometry():allocate(mesh.n_vertices, mesh.n_indices, vtype)
+  elseif target.n_verts < mesh.n_vertices or target.n_indices < mesh.n_indices then
+    truss.error("Target geometry too small for mesh: needs " .. mesh.n_vertices
+                .. " verts, " .. mesh.n_indices .. " indices")
+  end
+  local copy = m._copy_mesh_fn(target.vertinfo.ttype, target.index_type)
+  copy(mesh, target.verts, target.indices, scale or 1.0)
+  if created_target then
+    target:commit()
+  else
+    target:set_slice(0, mesh.n_vertices, 0, mesh.n_indices)
+    target:update()
+  end
+  return target
+end
+
+function m.cubify_indexed_to_geo(data, scale, limits, target)
+  local mesh = m.cubify_indexed(data, limits)
+  local geo = m.mesh_to_geo(mesh, scale or (1.0 / (data.dsize - 1)), target)
+  mesh:release()
+  return geo
+end
+
+local function start_parallel(data, limits, mesh, options)
+  options = options or {}
+  if not m._tables then
+    m._tables = create_tables()
+  end
+  if not data.cubedata then
+    truss.error("No cubedata?")
+  end
+  local job_system = options.jobs or jobs.default_job_system()
+  if mesh then
+    mesh:clear()
+  else
+    mesh = terralib.new(mesh_buffers)
+    mesh:init()
+  end
+
+  local cd = data.cubedata
+  set_limits(cd, limits)
+  local ncells_z = cd.z_end - cd.z_start - 1
+  if ncells_z < 1 or cd.x_end <= cd.x_start + 1 or cd.y_end <= cd.y_start + 1 then
+    return {mesh = mesh}
+  end
+  local n_slabs = options.slabs or (job_system.nthreads + 1) * 4
+  n_slabs = math.max(1, math.min(n_slabs, ncells_z))
+
+  local slabs = terralib.new(mc_slab[n_slabs])
+  local par = terralib.new(mc_parallel)
+  par.tables = terralib.cast(&march_tables, m._tables)
+  par.slabs = slabs
+  par.n_slabs = n_slabs
+  par.slice_size = (cd.x_end - cd.x_start) * (cd.y_end - cd.y_start) * 3
+  par.out = terralib.cast(&mesh_buffers, mesh)
+  for k = 0, n_slabs - 1 do
+    local slab = slabs[k]
+    slab.parent = terralib.cast(&opaque, par)
+    slab.idx = k
+    slab.data = cd
+    -- slab k polygonizes cells [z0, z1)
+    local z0 = cd.z_start + math.floor(ncells_z * k / n_slabs)
+    local z1 = cd.z_start + math.floor(ncells_z * (k + 1) / n_slabs)
+    slab.data.z_start, slab.data.z_end = z0, z1 + 1
+  end
+
+  local native = job_system.native
+  local root = job_system:create(polygonize_slabs, par)
+  local stitch = job_system:create(stitch_slabs, par)
+  native:set_continuation(root, stitch)
+  native:retain(stitch)
+  native:submit(root)
+  -- (slabs and par have to stay alive until the jobs finish)
+  return {mesh = mesh, jobs = job_system, job = stitch, par = par, slabs = slabs}
+end
+
+local function finish_parallel(state)
+  if state.par then m._release_slabs(state.par) end
+  return state.mesh
+end
+
+-- polygonizes on all cores; otherwise the same as cubify_indexed
+-- (if memory runs out, the mesh is left empty with .failed set)
+-- options.jobs: JobSystem to use (default: the shared one)
+-- options.slabs: number of z slabs to split the volume into
+function m.cubify_parallel(data, limits, mesh, options)
+  local state = start_parallel(data, limits, mesh, options)
+  if state.job then
+    state.jobs:wait(state.job)
+    state.jobs:release_job(state.job)
+  end
+  return finish_parallel(state)
+end
+
+-- returns a promise for the mesh, without blocking
+function m.cubify_parallel_async(data, limits, mesh, options)
+  local state = start_parallel(data, limits, mesh, options)
+  if not state.job then
+    local promise = require("async/promise.t")
+    local p = promise.Promise()
+    p:resolve(state.mesh)
+    return p
+  end
+  return state.jobs:promise(state.job):next(function()
+    return finish_parallel(state)
+  end)
+end
+
+-- Keeps a separate indexed mesh per brick of a volume, using a
+-- min/max pyramid to skip bricks that can't contain any surface, so
+-- that after local edits to the values only the affected bricks need
+-- to be re-polygonized (and re-uploaded).
+local BrickMesher = class("BrickMesher")
+m.BrickMesher = BrickMesher
+
+-- options.brick_size: cells per brick side (default 16)
+-- options.limits: as for cubify
+function BrickMesher:init(data, options)
+  options = options or {}
+  if not m._tables then
+    m._tables = create_tables()
+  end
+  if not data.cubedata then
+    truss.error("No cubedata?")
+  end
+  self.data = data
+  local cd = data.cubedata
+  set_limits(cd, options.limits)
+  local brick_size = options.brick_size or 16
+  if brick_size < 1 then
+    truss.error("BrickMesher: brick_size must be at least 1, got " .. brick_size)
+  end
+  self.pyramid = terralib.new(minmax_pyramid)
+  self.pyramid:init(cd, brick_size)
+  self.n_bricks = self.pyramid:n_bricks()
+  self.meshes = terralib.new(mesh_buffers[self.n_bricks])
+  for k = 0, self.n_bricks - 1 do self.meshes[k]:init() end
+  self._active = terralib.new(uint8[self.n_bricks + 1])
+  self:rebuild()
+end
+
+-- recomputes everything; returns the number of non-empty bricks
+function BrickMesher:rebuild()
+  local cd = self.data.cubedata
+  self.pyramid:build(cd)
+  m._polygonize_bricks(m._tables, cd, self.pyramid, self.meshes, self._active)
+  local nonempty = 0
+  for k = 0, self.n_bricks - 1 do
+    if self.meshes[k].n_indices > 0 then nonempty = nonempty + 1 end
+  end
+  return nonempty
+end
+
+-- call after changing the values of the grid points in [p0, p1)
+-- (absolute {x, y, z} point coordinates); returns the list of bricks
+-- whose meshes were regenerated
+function BrickMesher:update_region(p0, p1)
+  local cd = self.data.cubedata
+  local lo = terralib.new(uint32[3], p0)
+  local hi = terralib.new(uint32[3], p1)
+  local b0, b1 = terralib.new(uint32[3]), terralib.new(uint32[3])
+  if not self.pyramid:update_region(cd, lo, hi, b0, b1) then return {} end
+  local dims = self.pyramid.dims[0]
+  local changed = {}
+  for bz = b0[2], b1[2] - 1 do
+    for by = b0[1], b1[1] - 1 do
+      for bx = b0[0], b1[0] - 1 do
+        local brick = bx + dims[0] * (by + dims[1] * bz)
+        m._polygonize_brick(m._tables, cd, self.pyramid, brick, self.meshes[brick])
+        table.insert(changed, brick)
+      end
+    end
+  end
+  return changed
+end
+
+function BrickMesher:get_mesh(brick)
+  return self.meshes[brick]
+end
+
+-- all bricks' meshes as one mesh (vertices on brick faces appear
+-- once per brick, at identical positions)
+function BrickMesher:merge(mesh)
+  if not mesh then
+    mesh = terralib.new(mesh_buffers)
+    mesh:init()
+  end
+  m._merge_meshes(self.meshes, self.n_bricks, mesh)
+  return mesh
+end
+
+function BrickMesher:release()
+  for k = 0, self.n_bricks - 1 do self.meshes[k]:release() end
+  self.pyramid:release()
+end
+
 function m.mc_data_add(target, other)
   if target.dsize ~= other.dsize then
     truss.error("MC Data Size mismatch: " .. tostring(target.dsize) .. " vs " .. tostring(other.dsize))
@@ -1,3 +1,6 @@
+local libc = require("substrate/libc.t")
+local bit = require("bit")
+
 -- would forcing these to inline make any difference?
 -- (presumably LLVM is smart enough to already inline)
 local terra rotl64(x: uint64, r: int8): uint64
@@ -21,56 +24,50 @@ local struct hash128_t {
   }
 }
 
-local terra MurmurHash3_128(data: &uint8, len: uint64, seed: uint64): hash128_t
-  var nblocks = len / 16
-
-  var h1: uint64 = seed
-  var h2: uint64 = seed
-
+local terra mix_block(h1p: &uint64, h2p: &uint64, k1: uint64, k2: uint64)
+  var h1, h2 = @h1p, @h2p
   var c1: uint64 = 0x87c37b91114253d5ULL
   var c2: uint64 = 0x4cf5ad432745937fULL
 
-  -- ALIASING?!
-  var blocks: &uint64 = [&uint64](data)
+  k1 = k1 * c1 
+  k1 = rotl64(k1, 31) 
+  k1 = k1 * c2;
+  h1 = h1 ^ k1
 
-  for i = 0, nblocks do
-    var k1: uint64 = blocks[i*2+0]
-    var k2: uint64 = blocks[i*2+1]
+  h1 = rotl64(h1, 27)
+  h1 = h1 + h2
+  h1 = (h1 * 5) + 0x52dce729
 
-    k1 = k1 * c1 
-    k1 = rotl64(k1, 31) 
-    k1 = k1 * c2;
-    h1 = h1 ^ k1
+  k2 = k2 * c2
+  k2 = rotl64(k2, 33)
+  k2 = k2 * c1
+  h2 = h2 ^ k2
 
-    h1 = rotl64(h1, 27)
-    h1 = h1 + h2
-    h1 = (h1 * 5) + 0x52dce729
+  h2 = rotl64(h2, 31)
+  h2 = h2 + h1
+  h2 = (h2 * 5) + 0x38495ab5
 
-    k2 = k2 * c2
-    k2 = rotl64(k2, 33)
-    k2 = k2 * c1
-    h2 = h2 ^ k2
+  @h1p, @h2p = h1, h2
+end
 
-    h2 = rotl64(h2, 31)
-    h2 = h2 + h1
-    h2 = (h2 * 5) + 0x38495ab5
-  end
+-- mixes in the last (len % 16) bytes and finalizes
+local terra finish(h1: uint64, h2: uint64, tail: &uint8, n_tail: uint32,
+                   len: uint64): hash128_t
+  var c1: uint64 = 0x87c37b91114253d5ULL
+  var c2: uint64 = 0x4cf5ad432745937fULL
 
   -- this complicated block is just to deal with the input not
   -- being a multiple of 16 bytes: it's logically equivalent to
   -- just padding with 0s to a multiple of 16 bytes
-  var tail_pos: uint32 = nblocks * 16
-  var n_tail: uint32 = len % 16
-
   var k1: uint64 = 0
   var k2: uint64 = 0
 
   for tt = 0, n_tail do
     var ttt = n_tail - tt
     if ttt > 8 then
-      k2 = k2 ^ ([uint64](data[tail_pos + ttt - 1]) << (48 - 8*tt))
+      k2 = k2 ^ ([uint64](tail[ttt - 1]) << (48 - 8*tt))
     else
-      k1 = k1 ^ ([uint64](data[tail_pos + ttt - 1]) << (56 - 8*(tt-8)))
+      k1 = k1 ^ ([uint64](tail[ttt - 1]) << (56 - 8*(tt-8)))
     end
   end
   if n_tail > 8 then
@@ -104,6 +101,261 @@ local terra MurmurHash3_128(data: &uint8, len: uint64, seed: uint64): hash128_t
   return out
 end
 
+local terra MurmurHash3_128(data: &uint8, len: uint64, seed: uint64): hash128_t
+  var nblocks = len / 16
+
+  var h1: uint64 = seed
+  var h2: uint64 = seed
+
+  -- ALIASING?!
+  var blocks: &uint64 = [&uint64](data)
+
+  for i = 0, nblocks do
+    mix_block(&h1, &h2, blocks[i*2+0], blocks[i*2+1])
+  end
+
+  return finish(h1, h2, data + nblocks * 16, len % 16, len)
+end
+
+-- incremental version of MurmurHash3_128: feeding the same bytes
+-- through any sequence of :update calls gives the same hash
+local struct murmur_state_t {
+  h1: uint64;
+  h2: uint64;
+  total: uint64;
+  nbuffered: uint32;
+  buffer: uint64[2];
+}
+
+terra murmur_state_t:init(seed: uint64)
+  self.h1, self.h2 = seed, seed
+  self.total = 0
+  self.nbuffered = 0
+end
+
+terra murmur_state_t:update(data: &uint8, len: uint64)
+  self.total = self.total + len
+  var buffer = [&uint8](&self.buffer)
+  var pos: uint64 = 0
+  if self.nbuffered > 0 then
+    var amount = 16 - self.nbuffered
+    if amount > len then amount = len end
+    libc.string.memcpy(buffer + self.nbuffered, data, amount)
+    self.nbuffered = self.nbuffered + amount
+    pos = amount
+    if self.nbuffered < 16 then return end
+    mix_block(&self.h1, &self.h2, self.buffer[0], self.buffer[1])
+    self.nbuffered = 0
+  end
+  while len - pos >= 16 do
+    var k: uint64[2]
+    libc.string.memcpy(&k, data + pos, 16)
+    mix_block(&self.h1, &self.h2, k[0], k[1])
+    pos = pos + 16
+  end
+  libc.string.memcpy(buffer, data + pos, len - pos)
+  self.nbuffered = len - pos
+end
+
+terra murmur_state_t:finalize(): hash128_t
+  return finish(self.h1, self.h2, [&uint8](&self.buffer), self.nbuffered, self.total)
+end
+
+-- hash64: a fast 64 bit hash in the style of XXH3 (but not output
+-- compatible with it). 64 byte stripes are spread over eight 64 bit
+-- accumulators with independent 32x32->64 multiplies, which LLVM
+-- vectorizes, and the accumulators are scrambled every 1KB. Inputs of
+-- up to 16 bytes skip the accumulators entirely.
+local PRIME32_1 = 0x9E3779B1ULL
+local PRIME32_2 = 0x85EBCA77ULL
+local PRIME32_3 = 0xC2B2AE3DULL
+local PRIME64_1 = 0x9E3779B185EBCA87ULL
+local PRIME64_2 = 0xC2B2AE3D27D4EB4FULL
+local PRIME64_3 = 0x165667B19E3779F9ULL
+local PRIME64_4 = 0x85EBCA77C2B2AE63ULL
+local PRIME64_5 = 0x27D4EB2F165667C5ULL
+local STRIPE_BYTES = 64
+local STRIPES_PER_SCRAMBLE = 16
+local SHORT_BYTES = 16
+
+local struct hash64_state_t {
+  acc: uint64[8];
+  key: uint64[8];
+  total: uint64;
+  nstripes: uint32;
+  nbuffered: uint32;
+  buffer: uint64[8];
+}
+
+local terra avalanche64(h: uint64): uint64
+  h = h ^ (h >> 37)
+  h = h * 0x165667919E3779F9ULL
+  h = h ^ (h >> 32)
+  return h
+end
+
+terra hash64_state_t:init(seed: uint64)
+  self.acc[0], self.acc[1] = PRIME32_3, PRIME64_1
+  self.acc[2], self.acc[3] = PRIME64_2, PRIME64_3
+  self.acc[4], self.acc[5] = PRIME64_4, PRIME32_2
+  self.acc[6], self.acc[7] = PRIME64_5, PRIME32_1
+  -- per-seed keys stand in for XXH3's secret
+  for i = 0, 8 do
+    self.key[i] = fmix64(seed + (i + 1) * PRIME64_1)
+  end
+  self.total = 0
+  self.nstripes = 0
+  self.nbuffered = 0
+end
+
+terra hash64_state_t:_stripe(data: &uint8)
+  var lanes: uint64[8]
+  libc.string.memcpy(&lanes, data, STRIPE_BYTES)
+  for i = 0, 8 do
+    var v = lanes[i]
+    var k = v ^ self.key[i]
+    self.acc[i ^ 1] = self.acc[i ^ 1] + v
+    self.acc[i] = self.acc[i] + (k and 0xFFFFFFFFULL) * (k >> 32)
+  end
+  self.nstripes = self.nstripes + 1
+  if self.nstripes == STRIPES_PER_SCRAMBLE then
+    for i = 0, 8 do
+      var a = self.acc[i]
+      a = a ^ (a >> 47)
+      a = a ^ self.key[i]
+      self.acc[i] = a * PRIME32_1
+    end
+    self.nstripes = 0
+  end
+end
+
+terra hash64_state_t:update(data: &uint8, len: uint64)
+  self.total = self.total + len
+  var buffer = [&uint8](&self.buffer)
+  var pos: uint64 = 0
+  if self.nbuffered > 0 then
+    var amount = STRIPE_BYTES - self.nbuffered
+    if amount > len then amount = len end
+    libc.string.memcpy(buffer + self.nbuffered, data, amount)
+    self.nbuffered = self.nbuffered + amount
+    pos = amount
+    if self.nbuffered < STRIPE_BYTES then return end
+    self:_stripe(buffer)
+    self.nbuffered = 0
+  end
+  while len - pos >= STRIPE_BYTES do
+    self:_stripe(data + pos)
+    pos = pos + STRIPE_BYTES
+  end
+  libc.string.memcpy(buffer, data + pos, len - pos)
+  self.nbuffered = len - pos
+end
+
+-- key0: the seed's first key (see hash64_state_t:init)
+local terra hash64_short(data: &uint8, len: uint64, key0: uint64): uint64
+  var lo: uint64, hi: uint64 = 0, 0
+  if len > 8 then
+    libc.string.memcpy(&lo, data, 8)
+    libc.string.memcpy(&hi, data + 8, len - 8)
+  else
+    libc.string.memcpy(&lo, data, len)
+  end
+  var a = fmix64(lo ^ key0)
+  var b = fmix64(hi ^ rotl64(key0, 29))
+  return avalanche64((a ^ rotl64(b, 31)) + len * PRIME64_1)
+end
+
+-- (doesn't modify the state, so more data can still be added)
+terra hash64_state_t:finalize(): uint64
+  if self.total <= SHORT_BYTES then
+    return hash64_short([&uint8](&self.buffer), self.total, self.key[0])
+  end
+  var tmp = @self
+  if tmp.nbuffered > 0 then
+    -- zero padded; the length is mixed in below
+    var buffer = [&uint8](&tmp.buffer)
+    libc.string.memset(buffer + tmp.nbuffered, 0, STRIPE_BYTES - tmp.nbuffered)
+    tmp:_stripe(buffer)
+  end
+  var h: uint64 = tmp.total * PRIME64_1
+  for i = 0, 4 do
+    var a = fmix64(tmp.acc[2*i] ^ tmp.key[2*i])
+    var b = fmix64(tmp.acc[2*i + 1] ^ tmp.key[2*i + 1])
+    h = h + (a ^ rotl64(b, 31))
+    h = rotl64(h, 27) * PRIME64_1 + PRIME64_4
+  end
+  return avalanche64(h)
+end
+
+local terra hash64(data: &uint8, len: uint64, seed: uint64): uint64
+  if len <= SHORT_BYTES then
+    return hash64_short(data, len, fmix64(seed + PRIME64_1))
+  end
+  var state: hash64_state_t
+  state:init(seed)
+  state:update(data, len)
+  return state:finalize()
+end
+
+-- file hashing: files are read (through substrate's File) and hashed
+-- chunk_size bytes at a time rather than loaded whole
+local build_file_hasher = terralib.memoize(function(State, Hash)
+  local File = require("substrate").File
+  return terra(filename: &int8, seed: uint64, chunk_size: uint64, out: &Hash): bool
+    var f: File
+    f:init()
+    if not f:open(filename, false) then return false end
+    var chunk = [&uint8](libc.std.malloc(chunk_size))
+    var state: State
+    state:init(seed)
+    var remaining: uint64 = f.size
+    var ok = (chunk ~= nil)
+    while ok and remaining > 0 do
+      var amount = remaining
+      if amount > chunk_size then amount = chunk_size end
+      -- (a short read, e.g. the file shrank, fails the whole hash)
+      ok = f:read_raw(chunk, chunk_size, amount) == amount
+      if ok then
+        state:update(chunk, amount)
+        remaining = remaining - amount
+      end
+    end
+    libc.std.free(chunk)
+    f:close()
+    if not ok then return false end
+    @out = state:finalize()
+    return true
+  end
+end)
+
+local hashers = {
+  murmur128 = {murmur_state_t, hash128_t},
+  hash64 = {hash64_state_t, uint64},
+}
+
+-- returns the hash (a hash128_t or uint64, by options.algorithm:
+-- "murmur128" (default) or "hash64"), or nil if the file can't be read
+-- options.seed (default 0), options.chunk_size (default 1MB)
+local function hash_file(filename, options)
+  options = options or {}
+  local algorithm = options.algorithm or "murmur128"
+  local hasher = hashers[algorithm]
+  if not hasher then truss.error("Unknown hash algorithm " .. algorithm) end
+  local State, Hash = hasher[1], hasher[2]
+  local out = terralib.new(Hash[1])
+  local ok = build_file_hasher(State, Hash)(filename, options.seed or 0,
+                                            options.chunk_size or 2^20, out)
+  if not ok then return nil end
+  if Hash == uint64 then return out[0] end
+  local ret = terralib.new(Hash)
+  ret.u64[0], ret.u64[1] = out[0].u64[0], out[0].u64[1]
+  return ret
+end
+
+local function hash64_to_string(h)
+  return bit.tohex(h, 16)
+end
+
 local function hash_to_string(h)
   local s = ""
   for i = 0, 3 do
@@ -149,6 +401,11 @@ end
 return {
   hash128_t = hash128_t, 
   murmur_128 = MurmurHash3_128, 
+  murmur_state_t = murmur_state_t,
+  hash64 = hash64,
+  hash64_state_t = hash64_state_t,
+  hash_file = hash_file,
   hash_to_string = hash_to_string,
+  hash64_to_string = hash64_to_string,
   print_hash = print_hash
 }
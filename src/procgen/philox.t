@@ -0,0 +1,279 @@
+-- procgen/philox.t
+--
+-- counter-based random streams (Philox4x32-10)
+--
+-- Each output block is a pure function of (seed, stream, block index):
+-- the seed is the Philox key, and the counter is the 64 bit block
+-- index followed by the 64 bit stream id. Streams with different ids
+-- therefore never overlap, and any part of any stream can be
+-- generated independently, e.g., one stream per worker thread, or
+-- one stream per chunk of a world, without any coordination.
+--
+-- Reference: Salmon et al., "Parallel Random Numbers: As Easy as
+-- 1, 2, 3" (SC11); outputs match the Random123 philox4x32 (10 rounds).
+
+local class = require("class")
+local m = {}
+
+local PHILOX_M0 = 0xD2511F53ULL
+local PHILOX_M1 = 0xCD9E8D57ULL
+local PHILOX_W0 = 0x9E3779B9
+local PHILOX_W1 = 0xBB67AE85
+local ROUNDS = 10
+
+-- (generic over scalar uint32 and uint32 vectors)
+local function philox_rounds(U, U64, c, key0, key1)
+  local function mulhilo(mul, x)
+    return quote
+      var p = [U64](x) * mul
+    in
+      [U](p >> [U64](32)), [U](p)
+    end
+  end
+  return quote
+    var k0, k1 = key0, key1
+    for round = 0, ROUNDS do
+      var hi0, lo0 = [mulhilo(PHILOX_M0, `c[0])]
+      var hi1, lo1 = [mulhilo(PHILOX_M1, `c[2])]
+      c[0], c[1], c[2], c[3] = hi1 ^ c[1] ^ k0, lo1, hi0 ^ c[3] ^ k1, lo0
+      k0, k1 = k0 + [U](PHILOX_W0), k1 + [U](PHILOX_W1)
+    end
+  end
+end
+
+-- one 4 word block
+terra m.philox4x32(ctr: &uint32, key: &uint32, out: &uint32)
+  var c: uint32[4]
+  for i = 0, 4 do c[i] = ctr[i] end
+  [philox_rounds(uint32, uint64, c, `key[0], `key[1])]
+  for i = 0, 4 do out[i] = c[i] end
+end
+
+local LANES = 4
+local VU = vector(uint32, LANES)
+local VU64 = vector(uint64, LANES)
+
+-- writes blocks [first_block, first_block + nblocks) of a stream
+-- (4 words each); LANES blocks are computed at once, one per
+-- vector lane
+terra m.generate_blocks(seed: uint64, stream: uint64, first_block: uint64,
+                        nblocks: uint64, dest: &uint32)
+  var key0, key1 = [uint32](seed), [uint32](seed >> 32)
+  var s0, s1 = [uint32](stream), [uint32](stream >> 32)
+  var b: uint64 = 0
+  while b + LANES <= nblocks do
+    var c: VU[4]
+    escape
+      local lo, hi = {}, {}
+      for lane = 0, LANES - 1 do
+        lo[lane + 1] = `[uint32](first_block + b + lane)
+        hi[lane + 1] = `[uint32]((first_block + b + lane) >> 32)
+      end
+      emit(quote
+        c[0] = vectorof(uint32, [lo])
+        c[1] = vectorof(uint32, [hi])
+      end)
+    end
+    c[2], c[3] = [VU](s0), [VU](s1)
+    [philox_rounds(VU, VU64, c, `[VU](key0), `[VU](key1))]
+    escape
+      for lane = 0, LANES - 1 do
+        for word = 0, 3 do
+          emit(quote dest[(b + lane)*4 + word] = c[word][lane] end)
+        end
+      end
+    end
+    b = b + LANES
+  end
+  var key: uint32[2]
+  key[0], key[1] = key0, key1
+  while b < nblocks do
+    var block = first_block + b
+    var ctr: uint32[4]
+    ctr[0], ctr[1], ctr[2], ctr[3] = block, block >> 32, s0, s1
+    m.philox4x32(ctr, key, dest + b*4)
+    b = b + 1
+  end
+end
+
+-- a position in one stream; the fills continue from wherever the
+-- previous call left off, a word at a time
+local struct PhiloxStream {
+  seed: uint64;
+  stream: uint64;
+  block: uint64; -- next block to generate
+  buffer: uint32[4];
+  nbuffered: uint32;
+}
+m.PhiloxStream = PhiloxStream
+
+terra PhiloxStream:init(seed: uint64, stream: uint64)
+  self.seed = seed
+  self.stream = stream
+  self.block = 0
+  self.nbuffered = 0
+end
+
+-- jumps to a word offset within the stream
+terra PhiloxStream:seek(word: uint64)
+  self.block = word / 4
+  self.nbuffered = 0
+  var skip = word % 4
+  if skip > 0 then
+    m.generate_blocks(self.seed, self.stream, self.block, 1, self.buffer)
+    self.block = self.block + 1
+    self.nbuffered = 4 - skip
+  end
+end
+
+terra PhiloxStream:fill_uint32(dest: &uint32, n: uint64)
+  var pos: uint64 = 0
+  while self.nbuffered > 0 and pos < n do
+    dest[pos] = self.buffer[4 - self.nbuffered]
+    self.nbuffered = self.nbuffered - 1
+    pos = pos + 1
+  end
+  var nblocks = (n - pos) / 4
+  m.generate_blocks(self.seed, self.stream, self.block, nblocks, dest + pos)
+  self.block = self.block + nblocks
+  pos = pos + nblocks*4
+  if pos < n then
+    m.generate_blocks(self.seed, self.stream, self.block, 1, self.buffer)
+    self.block = self.block + 1
+    self.nbuffered = 4
+    while pos < n do
+      dest[pos] = self.buffer[4 - self.nbuffered]
+      self.nbuffered = self.nbuffered - 1
+      pos = pos + 1
+    end
+  end
+end
+
+terra PhiloxStream:next_uint32(): uint32
+  var ret: uint32
+  self:fill_uint32(&ret, 1)
+  return ret
+end
+
+local VF = vector(float, LANES)
+local vlog = terralib.intrinsic("llvm.log.v4f32", {VF} -> VF)
+local vsqrt = terralib.intrinsic("llvm.sqrt.v4f32", {VF} -> VF)
+local vsin = terralib.intrinsic("llvm.sin.v4f32", {VF} -> VF)
+local vcos = terralib.intrinsic("llvm.cos.v4f32", {VF} -> VF)
+
+local load_vu = macro(function(words)
+  local elems = {}
+  for lane = 0, LANES - 1 do elems[lane + 1] = `words[lane] end
+  return `vectorof(uint32, [elems])
+end)
+
+-- uniform in [0, 1), from 24 random bits each
+terra PhiloxStream:fill_uniform(dest: &float, n: uint64)
+  var bits = [&uint32](dest)
+  self:fill_uint32(bits, n)
+  var i: uint64 = 0
+  while i + LANES <= n do
+    var v = [VF](load_vu(bits + i) >> [VU](8)) * [VF](1.0f / 16777216.0f)
+    escape
+      for lane = 0, LANES - 1 do
+        emit(quote dest[i + lane] = v[lane] end)
+      end
+    end
+    i = i + LANES
+  end
+  while i < n do
+    dest[i] = [float](bits[i] >> 8) * (1.0f / 16777216.0f)
+    i = i + 1
+  end
+end
+
+-- uniform in [0, 1), from 53 random bits (two words) each
+terra PhiloxStream:fill_uniform_double(dest: &double, n: uint64)
+  var bits = [&uint64](dest)
+  self:fill_uint32([&uint32](dest), n*2)
+  for i = 0, n do
+    dest[i] = [double](bits[i] >> 11) * (1.0 / 9007199254740992.0)
+  end
+end
+
+-- normally distributed (Box-Muller); each group of up to 8 values
+-- uses 8 words of the stream
+terra PhiloxStream:fill_normal(dest: &float, n: uint64, mean: float, stddev: float)
+  var words: uint32[2*LANES]
+  var scale = [VF](1.0f / 16777216.0f)
+  var i: uint64 = 0
+  while i < n do
+    self:fill_uint32(words, 2*LANES)
+    -- u1 in (0, 1] so that the log is finite
+    var u1 = [VF]((load_vu(words) >> [VU](8)) + [VU](1)) * scale
+    var u2 = [VF](load_vu(words + LANES) >> [VU](8)) * scale
+    var r = vsqrt([VF](-2.0f) * vlog(u1)) * [VF](stddev)
+    var theta = u2 * [VF](6.2831853f)
+    var z0 = r * vcos(theta) + [VF](mean)
+    var z1 = r * vsin(theta) + [VF](mean)
+    escape
+      for lane = 0, LANES - 1 do
+        emit(quote
+          if i + 2*lane < n then dest[i + 2*lane] = z0[lane] end
+          if i + 2*lane + 1 < n then dest[i + 2*lane + 1] = z1[lane] end
+        end)
+      end
+    end
+    i = i + 2*LANES
+  end
+end
+
+local CounterRandom = class("CounterRandom")
+m.CounterRandom = CounterRandom
+
+-- seed: number (up to 2^53), or a string (hashed)
+-- stream: stream id (default 0); e.g., a worker or chunk index
+function CounterRandom:init(seed, stream)
+  if type(seed) == "string" then
+    local murmur = require("./murmur.t")
+    seed = murmur.murmur_128(terralib.cast(&uint8, seed), #seed, 0).u64[0]
+  end
+  self._seed = seed or 0
+  self._stream = terralib.new(PhiloxStream)
+  self._stream:init(self._seed, stream or 0)
+end
+
+-- a generator for a different stream with the same seed
+function CounterRandom:split(stream)
+  return CounterRandom(self._seed, stream)
+end
+
+function CounterRandom:seek(word)
+  self._stream:seek(word)
+end
+
+function CounterRandom:rand_uint32()
+  return self._stream:next_uint32()
+end
+
+function CounterRandom:rand_uniform()
+  return (self._stream:next_uint32() / 2^32)
+end
+
+-- the fills take a pointer to n values (e.g., from terralib.new(float[n]))
+function CounterRandom:fill_uint32(dest, n)
+  self._stream:fill_uint32(dest, n)
+  return dest
+end
+
+function CounterRandom:fill_uniform(dest, n)
+  self._stream:fill_uniform(dest, n)
+  return dest
+end
+
+function CounterRandom:fill_uniform_double(dest, n)
+  self._stream:fill_uniform_double(dest, n)
+  return dest
+end
+
+function CounterRandom:fill_normal(dest, n, mean, stddev)
+  self._stream:fill_normal(dest, n, mean or 0.0, stddev or 1.0)
+  return dest
+end
+
+return m
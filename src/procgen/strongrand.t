@@ -70,4 +70,94 @@ function StrongRandom:rand_int(lower_bound, upper_bound)
   return lower_bound + self:rand_unsigned(upper_bound - lower_bound)
 end
 
-return m
\ No newline at end of file
+-- Bulk fillers --
+--
+-- These draw from the same keystream as the rand_* methods (so calls
+-- can be freely mixed), but generate it a multi-block at a time.
+
+local ctx_t = chacha.chacha20_ctx
+
+terra m.fill_uint32(ctx: &ctx_t, dest: &uint32, n: uint64)
+  ctx:fill_random([&uint8](dest), n * sizeof(uint32))
+end
+
+-- uniform in [0, 1), from 24 random bits each
+terra m.fill_float(ctx: &ctx_t, dest: &float, n: uint64)
+  var bits = [&uint32](dest)
+  ctx:fill_random([&uint8](dest), n * sizeof(uint32))
+  for i = 0, n do
+    dest[i] = [float](bits[i] >> 8) * (1.0f / 16777216.0f)
+  end
+end
+
+-- uniform in [0, 1), from 53 random bits each
+terra m.fill_double(ctx: &ctx_t, dest: &double, n: uint64)
+  var bits = [&uint64](dest)
+  ctx:fill_random([&uint8](dest), n * sizeof(uint64))
+  for i = 0, n do
+    dest[i] = [double](bits[i] >> 11) * (1.0 / 9007199254740992.0)
+  end
+end
+
+-- uniform in [lower, upper), by rejection sampling under the tightest
+-- power of two range (as StrongRandom:rand_unsigned)
+terra m.fill_int(ctx: &ctx_t, dest: &int32, n: uint64, lower: int32, upper: int32)
+  if upper <= lower then
+    for i = 0, n do dest[i] = lower end
+    return
+  end
+  -- (the span can exceed int32's range, so take it in uint32, where
+  --  it is exact since upper > lower)
+  var nvals: uint32 = [uint32](upper) - [uint32](lower)
+  var mask: uint32 = nvals - 1
+  mask = mask or (mask >> 1)
+  mask = mask or (mask >> 2)
+  mask = mask or (mask >> 4)
+  mask = mask or (mask >> 8)
+  mask = mask or (mask >> 16)
+
+  var buffer: uint32[64]
+  var pos: uint32 = 64
+  var i: uint64 = 0
+  while i < n do
+    if pos == 64 then
+      ctx:fill_random([&uint8](&buffer), sizeof([uint32[64]]))
+      pos = 0
+    end
+    var v = buffer[pos] and mask
+    pos = pos + 1
+    if v < nvals then
+      dest[i] = [int32]([uint32](lower) + v)
+      i = i + 1
+    end
+  end
+end
+
+-- fills nbytes of raw random bytes
+function StrongRandom:fill_random(dest, nbytes)
+  self._ctx:fill_random(terralib.cast(&uint8, dest), nbytes)
+  return dest
+end
+
+function StrongRandom:fill_uint32(dest, n)
+  m.fill_uint32(self._ctx, dest, n)
+  return dest
+end
+
+function StrongRandom:fill_float(dest, n)
+  m.fill_float(self._ctx, dest, n)
+  return dest
+end
+
+function StrongRandom:fill_double(dest, n)
+  m.fill_double(self._ctx, dest, n)
+  return dest
+end
+
+-- values in [lower_bound, upper_bound), as :rand_int
+function StrongRandom:fill_int(dest, n, lower_bound, upper_bound)
+  m.fill_int(self._ctx, dest, n, lower_bound, upper_bound)
+  return dest
+end
+
+return m
@@ -0,0 +1,374 @@
+-- protobuf/_bench.t
+--
+-- throughput benchmarks for the generated codecs
+--
+-- usage: truss protobuf/_bench.t [results.json] [corpus_dir]
+--
+-- Builds corpora of testgen/test.proto messages (many small messages,
+-- lots of nested messages, big packed arrays, many strings) and times
+-- encoding (marker and sized), decoding (heap and arena) and lazy
+-- scanning of each, and counts the heap allocations decoding makes per
+-- message. Results are written as JSON so that runs can be compared
+-- over time. If corpus_dir is given, each corpus is also written there
+-- as a length-delimited stream, which testgen/proto_bench.py reads to
+-- time the reference (Python) implementation on the same data.
+
+local ffi = require("ffi")
+local substrate = require("substrate")
+local timing = require("osnative/timing.t")
+local json = require("lib/json.lua")
+local gen = require("./gen.t")
+local wf = require("./wireformat.t")
+local m = {}
+
+local PROTO_FILE = "src/protobuf/testgen/test.proto"
+local MIN_SECONDS = 0.5
+local MIN_REPS = 3
+
+-- counts every allocation made by the benchmarked messages
+local alloc_count = global(uint64, 0)
+
+local function counting_protogen()
+  local base = substrate.configure()
+  local cfg = {}
+  for k, v in pairs(base) do cfg[k] = v end
+  function cfg.ALLOCATE(T, count)
+    return quote alloc_count = alloc_count + 1 in [base.ALLOCATE(T, count)] end
+  end
+  function cfg.ALLOCATE_ZEROED(T, count)
+    return quote alloc_count = alloc_count + 1 in [base.ALLOCATE_ZEROED(T, count)] end
+  end
+  function cfg.REALLOCATE(T, ptr, old_count, new_count)
+    return quote
+      alloc_count = alloc_count + 1
+    in
+      [base.REALLOCATE(T, ptr, old_count, new_count)]
+    end
+  end
+  return gen.ProtoGen{
+    vec = terralib.memoize(function(T)
+      return require("substrate/array.t")._Array(T, {
+        allow_growth = true, typename = "CountedVec", cfg = cfg
+      })
+    end),
+    box = terralib.memoize(function(T)
+      return require("substrate/box.t")._Box(T, {typename = "CountedBox", cfg = cfg})
+    end)
+  }
+end
+
+-- Corpora --
+
+-- (slices point into Lua strings, which have to be kept alive)
+local function set_string(slice, s, keep)
+  table.insert(keep, s)
+  slice:from_string(s, #s)
+end
+
+local function random_string(minlen, maxlen)
+  local chars = {}
+  for idx = 1, math.random(minlen, maxlen) do
+    chars[idx] = string.char(math.random(32, 126))
+  end
+  return table.concat(chars)
+end
+
+-- spread over every varint length, including negatives (10 bytes)
+local function random_int()
+  local v = math.floor(math.random() * 2^math.random(0, 52))
+  if math.random() < 0.1 then v = -v end
+  return v
+end
+
+local function fill_allint(msg)
+  msg.one, msg.two = random_int() % 2^31, random_int()
+  msg.three, msg.four = random_int() % 2^31, random_int()
+  msg.five, msg.six = math.random(0, 2^31), random_int()
+  msg.seven, msg.eight = math.random(-2^31, 2^31 - 1), random_int()
+  msg.nine, msg.ten = math.random(0, 2^31), math.abs(random_int())
+end
+
+local function fill_allfloat(msg)
+  msg.one, msg.two = math.random() * 1000, math.random() * 1e9
+end
+
+local function fill_allbag(msg, keep)
+  msg.one = math.random() < 0.5
+  set_string(msg.two, random_string(0, 32), keep)
+  set_string(msg.three, random_string(0, 256), keep)
+end
+
+local CORPORA = {
+  {
+    name = "small_messages", message = "AllInt", count = 20000,
+    fill = function(msg, keep) fill_allint(msg) end
+  },
+  {
+    name = "nested_messages", message = "RepeatMixed", count = 20,
+    fill = function(msg, keep)
+      set_string(msg.camelOne, random_string(8, 64), keep)
+      for _ = 1, 2000 do fill_allint(msg.two:push_new()) end
+      for _ = 1, 2000 do fill_allfloat(msg.camThree:push_new()) end
+      for _ = 1, 500 do fill_allbag(msg.Four:push_new(), keep) end
+    end
+  },
+  {
+    name = "packed_arrays", message = "RepeatSimple", count = 4,
+    fill = function(msg, keep)
+      for _ = 1, 250000 do
+        msg.vertices:push_val(math.random() * 100)
+        msg.faces:push_val(random_int())
+      end
+    end
+  },
+  {
+    name = "many_strings", message = "NestSimple", count = 10,
+    fill = function(msg, keep)
+      for _ = 1, 100 do
+        local stuff = msg.stuff:push_new()
+        for _ = 1, 50 do
+          set_string(stuff.one:push_new(), random_string(1, 64), keep)
+        end
+        for _ = 1, 20 do stuff.two:push_val(math.random()) end
+      end
+      for _ = 1, 50 do
+        set_string(msg.bloooobbbbs:push_new(), random_string(512, 2048), keep)
+      end
+    end
+  },
+}
+
+-- Kernels --
+
+local function build_kernels(Msg, Lazy, ArenaMsg)
+  local T, ArenaT = Msg.ctype, ArenaMsg.ctype
+  local Arena = substrate.Arena
+  local k = {}
+
+  terra k.encode(msgs: &T, n: uint32, buff: &gen.CombBuffer): uint64
+    var total: uint64 = 0
+    for i = 0, n do
+      buff:clear()
+      Msg.encoder(&buff.enc, &msgs[i])
+      buff.enc:compress(&buff.buff)
+      total = total + buff.buff.pos
+    end
+    return total
+  end
+
+  terra k.encode_sized(msgs: &T, n: uint32, state: &wf.sized_encode_state_t,
+                       dest: &uint8, capacity: uint64): uint64
+    var total: uint64 = 0
+    for i = 0, n do
+      total = total + Msg.encode_into(state, dest, capacity, &msgs[i])
+    end
+    return total
+  end
+
+  -- (fresh: decode each message into a newly initialized struct, rather
+  --  than reusing the last one's storage)
+  terra k.decode(data: &uint8, offsets: &uint64, n: uint32, out: &T, fresh: bool): bool
+    for i = 0, n do
+      var b = wf.buffer_t{data + offsets[i], offsets[i + 1] - offsets[i], 0, 0}
+      if fresh then
+        out:release()
+        out:init()
+      else
+        out:clear()
+      end
+      if not Msg.decoder(&b, out) then return false end
+    end
+    return true
+  end
+
+  terra k.decode_arena(data: &uint8, offsets: &uint64, n: uint32,
+                       out: &ArenaT, arena: &Arena): bool
+    for i = 0, n do
+      var b = wf.buffer_t{data + offsets[i], offsets[i + 1] - offsets[i], 0, 0}
+      if not ArenaMsg.arena_decoder(&b, out, arena) then return false end
+      ArenaMsg.arena_reset(out, arena)
+    end
+    return true
+  end
+
+  terra k.lazy_scan(data: &uint8, offsets: &uint64, n: uint32, lazy: &Lazy): bool
+    for i = 0, n do
+      var b = wf.buffer_t{data + offsets[i], offsets[i + 1] - offsets[i], 0, 0}
+      if not lazy:scan(&b) then return false end
+    end
+    return true
+  end
+
+  return k
+end
+
+local function time_it(nbytes, f)
+  local reps, elapsed, best = 0, 0, math.huge
+  while reps < MIN_REPS or elapsed < MIN_SECONDS do
+    local t0 = timing.tic()
+    f()
+    local dt = timing.toc(t0)
+    reps, elapsed = reps + 1, elapsed + dt
+    best = math.min(best, dt)
+  end
+  return {
+    reps = reps,
+    mean_s = elapsed / reps,
+    best_s = best,
+    mb_per_s = nbytes / best / 1e6
+  }
+end
+
+local function write_corpus(fn, data, offsets, n)
+  local f = assert(io.open(fn, "wb"))
+  local prefix = terralib.new(wf.buffer_t)
+  local prefix_bytes = terralib.new(uint8[10])
+  for i = 0, n - 1 do
+    local len = offsets[i + 1] - offsets[i]
+    prefix:view_raw(prefix_bytes, 10)
+    prefix:write_varint_u64(len)
+    f:write(ffi.string(prefix_bytes, prefix.pos))
+    f:write(ffi.string(data + offsets[i], len))
+  end
+  f:close()
+end
+
+local function bench_corpus(pg, arena_pg, corpus, options)
+  local Msg = pg:get(corpus.message)
+  local Lazy = pg:get_lazy(corpus.message)
+  local ArenaMsg = arena_pg:get(corpus.message)
+  local k = build_kernels(Msg, Lazy, ArenaMsg)
+  local n = corpus.count
+
+  local keep = {}
+  local msgs = terralib.new(Msg.ctype[n])
+  for i = 0, n - 1 do
+    msgs[i]:init()
+    corpus.fill(msgs[i], keep)
+  end
+
+  -- the encoded corpus, one message after another
+  local state = terralib.new(wf.sized_encode_state_t)
+  state:init()
+  local offsets = terralib.new(uint64[n + 1])
+  local total, largest = 0, 0
+  for i = 0, n - 1 do
+    local size = tonumber(Msg.compute_size(state, msgs[i]))
+    offsets[i] = total
+    total, largest = total + size, math.max(largest, size)
+  end
+  offsets[n] = total
+  local data = terralib.new(uint8[total])
+  for i = 0, n - 1 do
+    Msg.encode_into(state, data + offsets[i], offsets[i + 1] - offsets[i], msgs[i])
+  end
+
+  local result = {
+    name = corpus.name,
+    message = corpus.message,
+    count = n,
+    total_bytes = total
+  }
+  if options.corpus_dir then
+    result.corpus_file = options.corpus_dir .. "/" .. corpus.name .. ".bin"
+    write_corpus(result.corpus_file, data, offsets, n)
+  end
+
+  local buff = terralib.new(gen.CombBuffer)
+  buff:init()
+  buff:allocate(largest * 2 + 1024, 0)
+  local dest = terralib.new(uint8[largest])
+  result.encode = time_it(total, function()
+    assert(k.encode(msgs, n, buff) == total)
+  end)
+  result.encode_sized = time_it(total, function()
+    assert(k.encode_sized(msgs, n, state, dest, largest) == total)
+  end)
+
+  local out = terralib.new(Msg.ctype)
+  out:init()
+  result.decode = time_it(total, function()
+    assert(k.decode(data, offsets, n, out, false))
+  end)
+  result.decode_fresh = time_it(total, function()
+    assert(k.decode(data, offsets, n, out, true))
+  end)
+
+  local arena = terralib.new(substrate.Arena)
+  arena:init()
+  local arena_out = terralib.new(ArenaMsg.ctype)
+  arena_out:init()
+  result.decode_arena = time_it(total, function()
+    assert(k.decode_arena(data, offsets, n, arena_out, arena))
+  end)
+
+  local lazy = terralib.new(Lazy)
+  lazy:init()
+  result.lazy_scan = time_it(total, function()
+    assert(k.lazy_scan(data, offsets, n, lazy))
+  end)
+
+  -- allocations per message: decoding into a reused message (whose
+  -- vectors already have capacity) and into fresh ones
+  local function count_allocs(fresh)
+    k.decode(data, offsets, n, out, fresh) -- warm up
+    alloc_count:set(0)
+    k.decode(data, offsets, n, out, fresh)
+    return tonumber(alloc_count:get()) / n
+  end
+  result.allocs_per_message = {
+    decode = count_allocs(false),
+    decode_fresh = count_allocs(true)
+  }
+
+  lazy:release()
+  arena_out:init()
+  arena:release()
+  out:release()
+  buff:release()
+  state:release()
+  for i = 0, n - 1 do msgs[i]:release() end
+  return result
+end
+
+-- options.corpus_dir: also write the corpora there
+-- options.only: only run the corpus with this name
+function m.run(options)
+  options = options or {}
+  math.randomseed(12345)
+  local pg = counting_protogen()
+  pg:add_schema_file(PROTO_FILE)
+  local arena_pg = gen.ProtoGen{arena = true}
+  arena_pg:add_schema_file(PROTO_FILE)
+
+  local results = {
+    implementation = "terra",
+    timestamp = os.date("!%Y-%m-%dT%H:%M:%SZ"),
+    os = truss.os,
+    min_seconds = MIN_SECONDS,
+    corpora = {}
+  }
+  for _, corpus in ipairs(CORPORA) do
+    if not options.only or options.only == corpus.name then
+      print("=>", corpus.name)
+      local result = bench_corpus(pg, arena_pg, corpus, options)
+      for _, key in ipairs({"encode", "encode_sized", "decode", "decode_fresh",
+                            "decode_arena", "lazy_scan"}) do
+        print(("  %-14s %10.1f MB/s"):format(key, result[key].mb_per_s))
+      end
+      print(("  allocs/message: %.2f (reused), %.2f (fresh)"):format(
+        result.allocs_per_message.decode, result.allocs_per_message.decode_fresh))
+      table.insert(results.corpora, result)
+    end
+  end
+  return results
+end
+
+function m.main()
+  local outfn = truss.args[3] or "protobuf_bench.json"
+  local results = m.run{corpus_dir = truss.args[4]}
+  truss.save_string(outfn, json:encode_pretty(results))
+  print("Wrote " .. outfn)
+end
+
+return m
@@ -4,8 +4,11 @@ local m = {}
 --   allocator = "leaky_allocator"
 -- }
 
+local ffi = require("ffi")
+
 local gen = require("./gen.t")
 local parser = require("./schemaparser.t")
+local wf = require("./wireformat.t")
 
 local buff = nil
 local function allocate_buff()
@@ -48,6 +51,23 @@ local function hex_to_bytes(hexstr)
   return table.concat(frags)
 end
 
+local function bytes_hex(data, nbytes)
+  local frags = {}
+  for idx = 0, tonumber(nbytes)-1 do
+    table.insert(frags, ("%02x"):format(data[idx]))
+  end
+  return table.concat(frags, "")
+end
+
+local sized_state = nil
+local function allocate_sized_state()
+  if not sized_state then
+    sized_state = terralib.new(wf.sized_encode_state_t)
+    sized_state:init()
+  end
+  return sized_state
+end
+
 local function hex_equal(buff, hexstr)
   return as_hex(buff) == hexstr
 end
@@ -167,8 +187,20 @@ local function test_fundamentals(jape)
       buff.buff.pos = 0
       local decoded = buff.buff:read_varint_u64()
       expect(decoded):to_be(raw + 0ULL)
+      -- also without the 10 bytes of slack the fast path needs
+      local len = buff.buff.len
+      buff.buff.len, buff.buff.pos = #encoded / 2, 0
+      expect(buff.buff:read_varint_u64()):to_be(raw + 0ULL)
+      expect(buff.buff:check_status()):to_be(true)
+      buff.buff.len = len
     end)
   end
+
+  test("truncated varint", function()
+    from_hex(buff.buff, "ffff")
+    buff.buff:read_varint_u64()
+    expect(buff.buff:check_status()):to_be(false)
+  end)
 end
 
 local function reset_msgs()
@@ -307,6 +339,12 @@ local function test_primitives(jape)
         local nbytes = msgs[mname].msg.encoder(buff.enc, cmsg)
         buff.enc:compress(buff.buff)
         expect(as_hex(buff.buff)):to_be(sample.serial)
+        -- single pass: exactly sized, into a caller-provided buffer
+        local state = allocate_sized_state()
+        local nsized = msgs[mname].msg.encode_into(state, buff.scratch.data,
+                                                   buff.scratch.capacity, cmsg)
+        expect(tonumber(nsized)):to_be(#sample.serial / 2)
+        expect(bytes_hex(buff.scratch.data, nsized)):to_be(sample.serial)
         cmsg:clear()
         buff:clear()
         from_hex(buff.buff, sample.serial)
@@ -329,6 +367,325 @@ local function round_trip(buff, Msg, msg_in, msg_out)
   return Msg.decoder(buff.buff, msg_out)
 end
 
+local function test_packed(jape)
+  local test, expect = jape.test, jape.expect
+
+  local pg = gen.ProtoGen()
+  pg:add_schema_file("src/protobuf/testgen/test.proto")
+  local Msg = pg:get("RepeatSimple")
+
+  test("large packed arrays round trip", function()
+    local msg = terralib.new(Msg.ctype)
+    local msg_out = terralib.new(Msg.ctype)
+    msg:init()
+    msg_out:init()
+    for i = 0, 9999 do
+      msg.vertices:push_val(i * 0.5)
+      -- mix of 1 to 10 byte encodings
+      msg.faces:push_val((i % 2 == 0 and 1 or -1) * (2LL ^ (i % 63)))
+    end
+    expect(round_trip(allocate_buff(), Msg, msg, msg_out)):to_be_truthy()
+    expect(tonumber(msg_out.faces.size)):to_be(10000)
+    expect(Msg.dump(msg_out)):to_equal(Msg.dump(msg))
+    msg:release()
+    msg_out:release()
+  end)
+end
+
+local function test_sized_encoding(jape)
+  local test, expect = jape.test, jape.expect
+
+  local pg = gen.ProtoGen()
+  pg:add_schema_file("src/protobuf/testgen/test.proto")
+  local Msg = pg:get("NestSimple")
+
+  local function make_msg()
+    local msg = terralib.new(Msg.ctype)
+    msg:init()
+    for i = 1, 30 do
+      local stuff = msg.stuff:push_new()
+      -- enough strings that some lengths need 2 byte prefixes
+      for j = 1, i do
+        local s = ("x"):rep(i * j)
+        stuff.one:push_new():from_string(s, #s)
+        stuff.two:push_val(i / j)
+      end
+    end
+    local blob = "blob"
+    msg.bloooobbbbs:push_new():from_string(blob, #blob)
+    return msg
+  end
+
+  test("sized encoding matches marker encoding", function()
+    local msg = make_msg()
+    local buff = allocate_buff()
+    Msg.encoder(buff.enc, msg)
+    buff.enc:compress(buff.buff)
+    local expected = as_hex(buff.buff)
+
+    local state = allocate_sized_state()
+    local size = Msg.compute_size(state, msg)
+    expect(tonumber(size)):to_be(tonumber(buff.buff.pos))
+    local dest = terralib.new(uint8[tonumber(size)])
+    state:target(dest, size)
+    expect(tonumber(Msg.encode_sized(state, msg))):to_be(tonumber(size))
+    expect(bytes_hex(dest, size)):to_be(expected)
+
+    local msg_out = terralib.new(Msg.ctype)
+    msg_out:init()
+    local readback = terralib.new(wf.buffer_t)
+    readback:view_raw(dest, size)
+    expect(Msg.decoder(readback, msg_out)):to_be_truthy()
+    expect(Msg.dump(msg_out)):to_equal(Msg.dump(msg))
+    msg_out:release()
+    msg:release()
+  end)
+
+  test("sized encoding into too small a buffer", function()
+    local msg = make_msg()
+    local state = allocate_sized_state()
+    local size = Msg.compute_size(state, msg)
+    local dest = terralib.new(uint8[tonumber(size)])
+    expect(tonumber(Msg.encode_into(state, dest, size - 1, msg))):to_be(-1)
+    expect(tonumber(Msg.encode_into(state, dest, size, msg))):to_be(tonumber(size))
+    msg:release()
+  end)
+
+  test("sized encoding of a message changed after sizing", function()
+    local msg = make_msg()
+    local state = allocate_sized_state()
+    local size = Msg.compute_size(state, msg)
+    -- one more nested message than there are recorded sizes for
+    msg.stuff:push_new().two:push_val(1)
+    local capacity = tonumber(size) * 2
+    local dest = terralib.new(uint8[capacity])
+    state:target(dest, capacity)
+    expect(tonumber(Msg.encode_sized(state, msg))):to_be(-1)
+    msg:release()
+  end)
+end
+
+local function test_streaming(jape)
+  local test, expect = jape.test, jape.expect
+  local stream = require("./stream.t")
+
+  local pg = gen.ProtoGen()
+  pg:add_schema_file("src/protobuf/testgen/test.proto")
+  local Msg = pg:get("NestSimple")
+
+  -- a length-delimited stream of messages of very different sizes
+  local NMESSAGES = 40
+  local function make_stream()
+    local frags, dumps = {}, {}
+    local msg = terralib.new(Msg.ctype)
+    msg:init()
+    local state = allocate_sized_state()
+    local scratch = allocate_buff().scratch
+    local prefix = terralib.new(wf.buffer_t)
+    local prefix_bytes = terralib.new(uint8[10])
+    for i = 1, NMESSAGES do
+      msg:clear()
+      local nstuff = (i % 7 == 0 and 200) or (i % 3)
+      for j = 1, nstuff do
+        local stuff = msg.stuff:push_new()
+        local s = "message " .. i .. " stuff " .. j
+        stuff.one:push_new():from_string(s, #s)
+        stuff.two:push_val(i + j)
+      end
+      local nbytes = Msg.encode_into(state, scratch.data, scratch.capacity, msg)
+      prefix:view_raw(prefix_bytes, 10)
+      prefix:write_varint_u64(nbytes)
+      table.insert(frags, ffi.string(prefix_bytes, prefix.pos))
+      table.insert(frags, ffi.string(scratch.data, nbytes))
+      dumps[i] = Msg.dump(msg)
+    end
+    msg:release()
+    return table.concat(frags), dumps, frags
+  end
+  local data, dumps, frags = make_stream()
+
+  test("stream from a source, across chunk boundaries", function()
+    local pos = 0
+    local function read(dest, n)
+      n = math.min(tonumber(n), #data - pos)
+      ffi.copy(dest, data:sub(pos + 1, pos + n), n)
+      pos = pos + n
+      return n
+    end
+    local reader = stream.MessageStream(Msg, {chunk_size = 37})
+    reader:open_source(read)
+    local count = 0
+    for idx, msg in reader:messages() do
+      count = idx
+      expect(Msg.dump(msg)):to_equal(dumps[idx])
+    end
+    expect(count):to_be(NMESSAGES)
+    reader:release()
+  end)
+
+  test("stream from a file", function()
+    local fn = os.tmpname()
+    local f = io.open(fn, "wb")
+    f:write(data)
+    f:close()
+    local reader = stream.MessageStream(Msg, {chunk_size = 256})
+    expect(reader:open_file(fn)):to_be_truthy()
+    local idx = 0
+    local count = reader:each(function(msg)
+      idx = idx + 1
+      expect(Msg.dump(msg)):to_equal(dumps[idx])
+    end)
+    expect(count):to_be(NMESSAGES)
+    reader:release()
+    os.remove(fn)
+  end)
+
+  test("messages don't wait on later bytes", function()
+    -- a source that only has each message once the previous one has
+    -- been handled (like a socket)
+    local delivered = 0
+    local reader = stream.MessageStream(Msg, {chunk_size = 65536})
+    reader:open_source(function(dest, n)
+      if delivered == NMESSAGES then return 0 end
+      delivered = delivered + 1
+      local frame = frags[delivered*2 - 1] .. frags[delivered*2]
+      ffi.copy(dest, frame, #frame)
+      return #frame
+    end)
+    local in_step = true
+    for idx, msg in reader:messages() do
+      if delivered ~= idx then in_step = false end
+      expect(Msg.dump(msg)):to_equal(dumps[idx])
+    end
+    expect(in_step):to_be_truthy()
+    reader:release()
+  end)
+
+  test("over-long length prefixes", function()
+    local function stream_of(bytes, options)
+      local pos = 0
+      local reader = stream.MessageStream(Msg, options)
+      reader:open_source(function(dest, n)
+        n = math.min(tonumber(n), #bytes - pos)
+        ffi.copy(dest, bytes:sub(pos + 1, pos + n), n)
+        pos = pos + n
+        return n
+      end)
+      return reader
+    end
+    -- a 10 byte varint of 2^64 - 1, which would wrap the total length
+    local reader = stream_of(("\xff"):rep(9) .. "\x01" .. "abc")
+    local count, err = reader:each(function(msg) end)
+    expect(count):to_be(nil)
+    expect(err ~= nil):to_be_truthy()
+    reader:release()
+    -- a plausible length over the limit fails without reading it all
+    reader = stream_of(data, {max_message_size = 16})
+    count, err = reader:each(function(msg) end)
+    expect(count):to_be(nil)
+    expect(err ~= nil):to_be_truthy()
+    reader:release()
+  end)
+
+  test("truncated stream", function()
+    local truncated = data:sub(1, #data - 3)
+    local pos = 0
+    local reader = stream.MessageStream(Msg, {chunk_size = 1000})
+    reader:open_source(function(dest, n)
+      n = math.min(tonumber(n), #truncated - pos)
+      ffi.copy(dest, truncated:sub(pos + 1, pos + n), n)
+      pos = pos + n
+      return n
+    end)
+    local count, err = reader:each(function(msg) end)
+    expect(count):to_be(nil)
+    expect(err ~= nil):to_be_truthy()
+    reader:release()
+  end)
+end
+
+local function test_lazy(jape)
+  local test, expect = jape.test, jape.expect
+
+  local pg = gen.ProtoGen()
+  pg:add_schema_file("src/protobuf/testgen/test.proto")
+
+  local function encode(Msg, msg)
+    local buff = allocate_buff()
+    local nbytes = Msg.encode_into(allocate_sized_state(), buff.scratch.data,
+                                   buff.scratch.capacity, msg)
+    local view = terralib.new(wf.buffer_t)
+    view:view_raw(buff.scratch.data, nbytes)
+    return view
+  end
+
+  test("lazy fields are only decoded on access", function()
+    local Msg = pg:get("RepeatMixed")
+    local Lazy = pg:get_lazy("RepeatMixed")
+    local msg = terralib.new(Msg.ctype)
+    msg:init()
+    msg.camelOne:from_string("header", 6)
+    for i = 1, 100 do
+      local two = msg.two:push_new()
+      two.one, two.nine = i, i * 3
+      msg.camThree:push_new().two = i / 4
+    end
+    local view = encode(Msg, msg)
+
+    local lazy = terralib.new(Lazy)
+    lazy:init()
+    expect(lazy:scan(view)):to_be_truthy()
+    expect(tonumber(lazy:count_two())):to_be(100)
+    expect(tonumber(lazy:count_Four())):to_be(0)
+    local header = lazy:get_camelOne()
+    expect(ffi.string(header.data, header.len)):to_be("header")
+    expect(tonumber(lazy.value.two.size)):to_be(0)
+    expect(tonumber(lazy:get_two().size)):to_be(100)
+    expect(tonumber(lazy.value.camThree.size)):to_be(0)
+    expect(lazy:decode_all()):to_be_truthy()
+    expect(Msg.dump(lazy.value)):to_equal(Msg.dump(msg))
+    lazy:release()
+    msg:release()
+  end)
+
+  test("lazy sub-message views", function()
+    local Msg = pg:get("Mixed")
+    local Lazy = pg:get_lazy("Mixed")
+    local LazyAllInt = pg.messages.AllInt.lazy
+    local msg = terralib.new(Msg.ctype)
+    msg:init()
+    msg.one.five = 55
+    msg.one.ten = 1000
+    msg.three.two:from_string("bag", 3)
+    local view = encode(Msg, msg)
+
+    local lazy = terralib.new(Lazy)
+    lazy:init()
+    expect(lazy:scan(view)):to_be_truthy()
+    local sub = terralib.new(LazyAllInt)
+    sub:init()
+    expect(lazy:view_one(sub)):to_be_truthy()
+    expect(sub:get_five()[0]):to_be(55)
+    expect(tonumber(sub:get_ten()[0])):to_be(1000)
+    expect(sub:get_one()[0]):to_be(0)
+    -- viewing doesn't decode the field in the parent
+    expect(lazy.value.one.five):to_be(0)
+    expect(lazy:get_one().five):to_be(55)
+    lazy:release()
+    sub:release()
+    msg:release()
+  end)
+
+  test("lazy scan of a truncated message", function()
+    local buff = allocate_buff()
+    from_hex(buff.buff, "0a0568656164")
+    local lazy = terralib.new(pg:get_lazy("RepeatMixed"))
+    lazy:init()
+    expect(lazy:scan(buff.buff)):to_be(false)
+    lazy:release()
+  end)
+end
+
 local function test_enums(jape)
   local test, expect = jape.test, jape.expect
   local schemas = [[
@@ -552,14 +909,91 @@ local function test_big_field_indices(jape)
   end)
 end
 
+local function test_arena_decoding(jape)
+  local test, expect = jape.test, jape.expect
+
+  local pg = gen.ProtoGen()
+  pg:add_schema_file("src/protobuf/testgen/test.proto")
+  local arena_pg = gen.ProtoGen{arena = true}
+  arena_pg:add_schema_file("src/protobuf/testgen/test.proto")
+
+  local function make_stuff()
+    local Msg = pg:get("NestSimple")
+    local msg = terralib.new(Msg.ctype)
+    msg:init()
+    for i = 1, 20 do
+      local stuff = msg.stuff:push_new()
+      for j = 1, i do
+        stuff.two:push_val(i * j)
+        local s = "string " .. i .. "," .. j
+        stuff.one:push_new():from_string(s, #s)
+      end
+    end
+    return Msg, msg
+  end
+
+  test("arena decode matches heap decode", function()
+    local Msg, msg = make_stuff()
+    local ArenaMsg = arena_pg:get("NestSimple")
+    local arena = terralib.new(require("substrate").Arena)
+    arena:init()
+    local msg_out = terralib.new(ArenaMsg.ctype)
+    msg_out:init()
+
+    local buff = allocate_buff()
+    Msg.encoder(buff.enc, msg)
+    buff.enc:compress(buff.buff)
+    buff.buff.len = buff.buff.pos
+    buff.buff.pos = 0
+    expect(ArenaMsg.arena_decoder(buff.buff, msg_out, arena)):to_be_truthy()
+    expect(ArenaMsg.dump(msg_out)):to_equal(Msg.dump(msg))
+    expect(tonumber(arena.bytes_allocated) > 0):to_be_truthy()
+
+    ArenaMsg.arena_reset(msg_out, arena)
+    expect(tonumber(arena.bytes_allocated)):to_be(0)
+    expect(tonumber(msg_out.stuff.size)):to_be(0)
+
+    -- and the arena's chunks are reused for the next decode
+    local reserved = tonumber(arena:reserved_bytes())
+    buff.buff.pos = 0
+    expect(ArenaMsg.arena_decoder(buff.buff, msg_out, arena)):to_be_truthy()
+    expect(ArenaMsg.dump(msg_out)):to_equal(Msg.dump(msg))
+    expect(tonumber(arena:reserved_bytes())):to_be(reserved)
+    ArenaMsg.arena_reset(msg_out, arena)
+    arena:release()
+    msg:release()
+  end)
+
+  test("fallback arena is released on request", function()
+    local ArenaMsg = arena_pg:get("NestSimple")
+    local msg = terralib.new(ArenaMsg.ctype)
+    msg:init()
+    for i = 1, 10 do
+      msg.stuff:push_new().two:push_val(i)
+    end
+    local fallback = ArenaMsg.arena_fallback()
+    expect(tonumber(fallback.bytes_allocated) > 0):to_be_truthy()
+
+    msg:init()
+    ArenaMsg.arena_release_fallback()
+    expect(tonumber(fallback.bytes_allocated)):to_be(0)
+    expect(tonumber(fallback:reserved_bytes())):to_be(0)
+  end)
+end
+
 function m.main(jape)
   jape = jape or require("dev/jape.t")
   jape.describe("parser", test_parser)
   jape.describe("fundamentals", test_fundamentals)
+  jape.describe("packed repeated", test_packed)
   jape.describe("basic encoding", test_basic_encoding)
+  jape.describe("sized encoding", test_sized_encoding)
+  jape.describe("streaming", test_streaming)
+  jape.describe("lazy decoding", test_lazy)
   jape.describe("primitives", test_primitives)
   jape.describe("test_enums", test_enums)
   jape.describe("test_oneof", test_oneof)
+  jape.describe("arena decoding", test_arena_decoding)
   --test("silly big indices", test_big_field_indices)
 end
 
@@ -114,6 +114,7 @@ function m.prep_ctx(ctx)
   end
 
   ctx.decoders = ctx.decoders or {}
+  ctx.lazy_types = ctx.lazy_types or {}
 end
 
 local function _decode_repeated(ctx, fieldinfo, buff, target, wire_type)
@@ -143,15 +144,23 @@ local function _decode_repeated(ctx, fieldinfo, buff, target, wire_type)
       end
     end
   elseif PACKABLE[kind] then
+    -- packed varints: count them up front, so that the whole run is
+    -- decoded straight into the vector's storage with one resize
     return quote
       if wire_type == wf.WIRE_TYPES.__packed then
         var sub_buf = buff:read_blob():as_buffer()
-        while sub_buf:has_more() do
-          if not decoder(&sub_buf, target.[name]:push_new()) then 
+        if not buff:check_status() then return false end
+        var vec = &target.[name]
+        var start = vec.size
+        var count = wf.count_varints(sub_buf.data, sub_buf.len)
+        vec:resize(start + count)
+        var dest = vec.data + start
+        for idx = 0, count do
+          if not decoder(&sub_buf, dest + idx) then 
             return false 
           end
         end
-        if not buff:check_status() then return false end
+        if sub_buf:has_more() then return false end
       else
         [non_packed_decode]
       end
@@ -229,4 +238,169 @@ function m.wrap_message_decoder(ctx, schema, T, decoder)
   return decode_message
 end
 
-return m
\ No newline at end of file
+-- Lazy decoding --
+--
+-- A lazy message scans its buffer once, skipping over every value with
+-- discard_value and recording where each field occurs. A field is only
+-- decoded (into .value) the first time it's accessed, with
+-- get_<field>() (or decode_<field>() / decode_all()). Singular
+-- sub-messages can also be viewed lazily with view_<field>(&sub), so
+-- that a few fields can be picked out of a big nested message without
+-- decoding anything else. The scanned buffer must outlive the lazy
+-- message, and rescanning it clears the decoded values.
+local struct field_span_t {
+  first: uint64; -- offset of the field's first key
+  last: uint64; -- offset of its last key
+  stop: uint64; -- end of its last value
+  count: uint32;
+}
+m.field_span_t = field_span_t
+
+function m.generate_lazy(ctx, schema, T)
+  local name = schema.name or T.name
+  local fields = {}
+  for _, fieldinfo in ipairs(schema.fields) do
+    if not fieldinfo.ignored then table.insert(fields, fieldinfo) end
+  end
+  local nslots = math.max(#fields, 1)
+
+  local Lazy = terralib.types.newstruct("Lazy" .. name)
+  Lazy.entries = {
+    {"buff", wf.buffer_t},
+    {"spans", field_span_t[nslots]},
+    {"decoded", bool[nslots]},
+    {"failed", bool},
+    {"value", T}
+  }
+  Lazy:complete()
+
+  terra Lazy:_reset()
+    self.failed = false
+    for idx = 0, nslots do
+      self.spans[idx] = field_span_t{0, 0, 0, 0}
+      self.decoded[idx] = false
+    end
+  end
+
+  terra Lazy:init()
+    self.buff:init()
+    self:_reset()
+    self.value:init()
+  end
+
+  terra Lazy:release()
+    self.value:release()
+    self.buff:init()
+    self:_reset()
+  end
+
+  local function scan_cases(lazy, keypos, stop, field_number)
+    if #fields == 0 then return quote end end
+    local cases = {}
+    for slot, fieldinfo in ipairs(fields) do
+      table.insert(cases, quote
+        case [fieldinfo.idx] then
+          var span = &lazy.spans[slot - 1]
+          if span.count == 0 then span.first = keypos end
+          span.last = keypos
+          span.stop = stop
+          span.count = span.count + 1
+        end
+      end)
+    end
+    return quote
+      switch field_number do
+        [cases]
+      else
+        -- unknown field: ignored
+      end
+    end
+  end
+
+  -- indexes a whole message (the rest of buff, which is consumed)
+  terra Lazy:scan(buff: &wf.buffer_t): bool
+    self.value:clear()
+    self:_reset()
+    var b = wf.buffer_t{buff.data + buff.pos, buff.len - buff.pos, 0, 0}
+    buff.pos = buff.len
+    while b:has_more() do
+      var keypos = b.pos
+      var key = b:read_key()
+      if not b:discard_value(key.wire_type) then
+        self.failed = true
+        return false
+      end
+      var stop = b.pos
+      [scan_cases(self, keypos, stop, `key.field_number)]
+    end
+    b.pos = 0
+    self.buff = b
+    return true
+  end
+  Lazy.methods.scan:setname("scan_lazy_" .. name:lower())
+
+  local decode_fns = {}
+  for slot, fieldinfo in ipairs(fields) do
+    local fname = fieldinfo.name
+    -- (a decoder for just this field, run over the span it occurs in)
+    local decode_field = m.generate_decoder(ctx, {
+      name = name .. "_" .. fname, fields = {fieldinfo}
+    }, T)
+
+    local terra decode(self: &Lazy): bool
+      if self.decoded[slot - 1] then return true end
+      self.decoded[slot - 1] = true
+      var span = self.spans[slot - 1]
+      if span.count == 0 then return true end
+      var b = wf.buffer_t{self.buff.data + span.first, span.stop - span.first, 0, 0}
+      if not decode_field(&b, &self.value) then
+        self.failed = true
+        return false
+      end
+      return true
+    end
+    decode_fns[slot] = decode
+    Lazy.methods["decode_" .. fname] = decode
+
+    Lazy.methods["get_" .. fname] = terra(self: &Lazy)
+      decode(self)
+      return &self.value.[fname]
+    end
+
+    Lazy.methods["count_" .. fname] = terra(self: &Lazy): uint32
+      return self.spans[slot - 1].count
+    end
+
+    local SubLazy = ctx.lazy_types[fieldinfo.kind]
+    if SubLazy and not fieldinfo.repeated then
+      -- scans the sub-message (its last occurrence) without decoding it
+      Lazy.methods["view_" .. fname] = terra(self: &Lazy, sub: &SubLazy): bool
+        var span = self.spans[slot - 1]
+        if span.count == 0 then
+          var empty = wf.buffer_t{nil, 0, 0, 0}
+          return sub:scan(&empty)
+        end
+        var b = wf.buffer_t{self.buff.data + span.last, span.stop - span.last, 0, 0}
+        b:read_key()
+        var sub_buf = b:read_blob():as_buffer()
+        if not b:check_status() then return false end
+        return sub:scan(&sub_buf)
+      end
+    end
+  end
+
+  terra Lazy:decode_all(): bool
+    escape
+      for _, decode in ipairs(decode_fns) do
+        emit(quote
+          if not decode(self) then return false end
+        end)
+      end
+    end
+    return true
+  end
+
+  return Lazy
+end
+
+return m
@@ -6,14 +6,16 @@ local wf = require("./wireformat.t")
 
 local m = {}
 
-local function encode_varnum(T, converter, tag)
+-- (the base encoders are generated for each kind of encode state B:
+--  wf.encode_state_t, or wf.sized_encode_state_t for sized encoding)
+local function encode_varnum(B, T, converter, tag)
   local ret = nil
-  if converter then 
-    ret = terra(buff: &wf.encode_state_t, src: &T): int64
+  if converter then
+    ret = terra(buff: &B, src: &T): int64
       return buff:write_varint_u64(converter(@src))
     end
   else
-    ret = terra(buff: &wf.encode_state_t, src: &T): int64
+    ret = terra(buff: &B, src: &T): int64
       return buff:write_varint_u64([uint64](@src))
     end
   end
@@ -22,7 +24,7 @@ local function encode_varnum(T, converter, tag)
 end
 
 -- this could cause endianness issues but nobody uses big-endian anyway!
-local function encode_punned(T)
+local function encode_punned(B, T)
   local num_bytes = terralib.sizeof(T)
   local struct pun {
     union {
@@ -30,7 +32,7 @@ local function encode_punned(T)
       v: T
     }
   }
-  local ret = terra(buff: &wf.encode_state_t, src: &T): int64
+  local ret = terra(buff: &B, src: &T): int64
     var p: pun
     p.v = @src
     return buff:write_raw_bytes(&(p.bytes[0]), num_bytes)
@@ -39,58 +41,112 @@ local function encode_punned(T)
   return ret
 end
 
-local terra encode_bytes(buff: &wf.encode_state_t, src: &wf.slice_t): int64
-  var total: int64 = buff:write_varint_u64(src.len)
-  total = total + buff:write_raw_bytes(src.data, src.len)
-  return total
+local function encode_bytes(B)
+  return terra(buff: &B, src: &wf.slice_t): int64
+    var total: int64 = buff:write_varint_u64(src.len)
+    total = total + buff:write_raw_bytes(src.data, src.len)
+    return total
+  end
 end
 
 local terra from_bool(val: bool): uint64
   if val then return 1 else return 0 end
 end
 
-local BASE_ENCODERS = {}
-BASE_ENCODERS["double"] = encode_punned(double)
-BASE_ENCODERS["float"] = encode_punned(float)
-BASE_ENCODERS["fixed32"] = encode_punned(uint32)
-BASE_ENCODERS["sfixed32"] = encode_punned(int32)
-BASE_ENCODERS["fixed64"] = encode_punned(uint64)
-BASE_ENCODERS["sfixed64"] = encode_punned(int64)
+local FIXED_KINDS = {
+  double = double, float = float,
+  fixed32 = uint32, sfixed32 = int32,
+  fixed64 = uint64, sfixed64 = int64
+}
 
--- TODO: refactor this w/ equivalent struct in decodergen.t
-local FLATPACKABLE = {}
-for k, _ in pairs(BASE_ENCODERS) do FLATPACKABLE[k] = true end
+-- {type, converter, name tag}
+local VARNUM_KINDS = {
+  uint32 = {uint32}, int32 = {int32}, sint32 = {int32, wf.encode_sint32, "s_"},
+  enum = {int32},
+  int64 = {int64}, uint64 = {uint64}, sint64 = {int64, wf.encode_sint64, "s_"},
+  bool = {bool, from_bool}
+}
+
+local base_encoders = terralib.memoize(function(B)
+  local ret = {}
+  for kind, T in pairs(FIXED_KINDS) do
+    ret[kind] = encode_punned(B, T)
+  end
+  for kind, spec in pairs(VARNUM_KINDS) do
+    ret[kind] = encode_varnum(B, unpack(spec))
+  end
+  ret["string"] = encode_bytes(B)
+  ret["bytes"] = ret["string"]
+  return ret
+end)
 
-BASE_ENCODERS["uint32"] = encode_varnum(uint32)
-BASE_ENCODERS["int32"] = encode_varnum(int32)
-BASE_ENCODERS["sint32"] = encode_varnum(int32, wf.encode_sint32, "s_")
+local BASE_ENCODERS = base_encoders(wf.encode_state_t)
 
-BASE_ENCODERS["enum"] = encode_varnum(int32)
+-- TODO: refactor this w/ equivalent struct in decodergen.t
+local FLATPACKABLE = {}
+for k, _ in pairs(FIXED_KINDS) do FLATPACKABLE[k] = true end
 
-BASE_ENCODERS["int64"] = encode_varnum(int64)
-BASE_ENCODERS["uint64"] = encode_varnum(uint64)
-BASE_ENCODERS["sint64"] = encode_varnum(int64, wf.encode_sint64, "s_")
+local PACKABLE = {} -- all the base numeric types can be packed
+for k, _ in pairs(FIXED_KINDS) do PACKABLE[k] = true end
+for k, _ in pairs(VARNUM_KINDS) do PACKABLE[k] = true end
 
 local CHECK_NON_DEFAULT = {}
 local function check_nonzero(val)
   return `val ~= 0
 end
-for k, _ in pairs(BASE_ENCODERS) do CHECK_NON_DEFAULT[k] = check_nonzero end
-
-BASE_ENCODERS["bool"] = encode_varnum(bool, from_bool)
-
-local PACKABLE = {} -- all the base numeric types above can be packed
-for k, _ in pairs(BASE_ENCODERS) do PACKABLE[k] = true end
-
-BASE_ENCODERS["string"] = encode_bytes
-BASE_ENCODERS["bytes"] = encode_bytes
-
+for k, _ in pairs(PACKABLE) do CHECK_NON_DEFAULT[k] = check_nonzero end
 CHECK_NON_DEFAULT["bool"] = function(val) return val end
 CHECK_NON_DEFAULT["string"] = function(val)
   return `(val.data ~= nil) and (val.len > 0)
 end
 CHECK_NON_DEFAULT["bytes"] = CHECK_NON_DEFAULT["string"]
 
+-- encoded sizes of the base kinds (not including the key)
+local function size_varnum(T, converter)
+  local ret = nil
+  if converter then
+    ret = terra(src: &T): uint64
+      return wf.varint_size(converter(@src))
+    end
+  else
+    ret = terra(src: &T): uint64
+      return wf.varint_size([uint64](@src))
+    end
+  end
+  ret:setname("size_varnum_" .. T.name)
+  return ret
+end
+
+local function size_fixed(T)
+  local num_bytes = terralib.sizeof(T)
+  return terra(src: &T): uint64
+    return num_bytes
+  end
+end
+
+local terra size_bytes(src: &wf.slice_t): uint64
+  return wf.varint_size(src.len) + src.len
+end
+
+local BASE_SIZERS = {}
+for kind, T in pairs(FIXED_KINDS) do BASE_SIZERS[kind] = size_fixed(T) end
+for kind, spec in pairs(VARNUM_KINDS) do
+  BASE_SIZERS[kind] = size_varnum(spec[1], spec[2])
+end
+BASE_SIZERS["string"] = size_bytes
+BASE_SIZERS["bytes"] = size_bytes
+
+-- (computed at generation time, since keys are constants)
+local function key_size(field_number, wire_type)
+  local key = field_number * 8 + wire_type
+  local nbytes = 1
+  while key >= 128 do
+    key = math.floor(key / 128)
+    nbytes = nbytes + 1
+  end
+  return nbytes
+end
+
 function m.prep_ctx(ctx)
   ctx.resolve_field = function(src, fieldinfo)
     local name = fieldinfo.name
@@ -113,11 +169,27 @@ function m.prep_ctx(ctx)
   end
 
   ctx.encoders = ctx.encoders or {}
+  ctx.sized_encoders = ctx.sized_encoders or {}
+  ctx.sizers = ctx.sizers or {}
+end
+
+-- which encoders a generated encoder calls: markers (encode_state_t,
+-- needs a compress afterwards) or sized (sized_encode_state_t)
+local function marker_style(ctx)
+  return {base = BASE_ENCODERS, messages = ctx.encoders, sized = false}
+end
+
+local function sized_style(ctx)
+  return {
+    base = base_encoders(wf.sized_encode_state_t),
+    messages = ctx.sized_encoders,
+    sized = true
+  }
 end
 
-local function _encode_single_field(ctx, fieldinfo, totalsize, buff, val)
+local function _encode_single_field(style, fieldinfo, totalsize, buff, val)
   local idx, name, kind = fieldinfo.idx, fieldinfo.name, fieldinfo.kind
-  local encoder = ctx.encoders[kind] or BASE_ENCODERS[kind]
+  local encoder = style.messages[kind] or style.base[kind]
   if not encoder then
     error("No encoder for [" .. kind .. "]!")
   end
@@ -128,7 +200,7 @@ local function _encode_single_field(ctx, fieldinfo, totalsize, buff, val)
   end
 end
 
-local function _encode_repeated(ctx, fieldinfo, totalsize, buff, src)
+local function _encode_repeated(style, fieldinfo, totalsize, buff, src)
   if FLATPACKABLE[fieldinfo.kind] then
     return quote
       var count = src.[fieldinfo.name].size
@@ -139,8 +211,23 @@ local function _encode_repeated(ctx, fieldinfo, totalsize, buff, src)
         totalsize = totalsize + buff:write_raw_bytes(bytes.data, bytes.size)
       end
     end
+  elseif PACKABLE[fieldinfo.kind] and style.sized then
+    local encoder = style.base[fieldinfo.kind]
+    return quote
+      var count = src.[fieldinfo.name].size
+      if count > 0 then
+        totalsize = totalsize + buff:write_key([fieldinfo.idx], wf.WIRE_TYPES.__packed)
+        var subsize = buff:take_size()
+        totalsize = totalsize + buff:write_varint_u64(subsize)
+        for idx = 0, count do
+          var val = src.[fieldinfo.name]:get_ref(idx)
+          encoder(buff, val)
+        end
+        totalsize = totalsize + subsize
+      end
+    end
   elseif PACKABLE[fieldinfo.kind] then
-    local encoder = BASE_ENCODERS[fieldinfo.kind]
+    local encoder = style.base[fieldinfo.kind]
     return quote
       var count = src.[fieldinfo.name].size
       if count > 0 then
@@ -161,39 +248,139 @@ local function _encode_repeated(ctx, fieldinfo, totalsize, buff, src)
       var count = src.[fieldinfo.name].size
       for idx = 0, count do
         var val = src.[fieldinfo.name]:get_ref(idx)
-        [_encode_single_field(ctx, fieldinfo, totalsize, buff, val)]
+        [_encode_single_field(style, fieldinfo, totalsize, buff, val)]
       end
     end
   end
 end
 
-local function _encode_fields(ctx, schema, totalsize, buff, src)
+local function _encode_fields(ctx, style, schema, totalsize, buff, src)
   local statements = {}
   for _, fieldinfo in ipairs(schema.fields) do
     if fieldinfo.repeated then
-      table.insert(statements, _encode_repeated(ctx, fieldinfo, totalsize, buff, src))
+      table.insert(statements, _encode_repeated(style, fieldinfo, totalsize, buff, src))
     elseif not fieldinfo.ignored then
       table.insert(statements, quote
         if [ctx.value_present(src, fieldinfo)] then
           var val = [ctx.resolve_field(src, fieldinfo)]
-          [_encode_single_field(ctx, fieldinfo, totalsize, buff, val)]
+          [_encode_single_field(style, fieldinfo, totalsize, buff, val)]
         end
       end)
     end
-  end 
+  end
+  return statements
+end
+
+-- nested messages record their size in a slot reserved before their
+-- own contents are sized, so the slots end up in write order
+local function _size_single_field(ctx, fieldinfo, totalsize, state, val)
+  local kind = fieldinfo.kind
+  local wire_type = wf.WIRE_TYPES[kind] or wf.WIRE_TYPES.__message
+  local keysize = key_size(fieldinfo.idx, wire_type)
+  if BASE_SIZERS[kind] then
+    return quote
+      totalsize = totalsize + keysize + [BASE_SIZERS[kind]](val)
+    end
+  end
+  local sizer = ctx.sizers[kind]
+  if not sizer then
+    error("No sizer for [" .. kind .. "]!")
+  end
+  return quote
+    var slot = state:reserve_size()
+    var subsize = sizer(state, val)
+    state:set_size(slot, subsize)
+    totalsize = totalsize + keysize + wf.varint_size(subsize) + subsize
+  end
+end
+
+local function _size_repeated(ctx, fieldinfo, totalsize, state, src)
+  local keysize = key_size(fieldinfo.idx, wf.WIRE_TYPES.__packed)
+  if FLATPACKABLE[fieldinfo.kind] then
+    return quote
+      var count = src.[fieldinfo.name].size
+      if count > 0 then
+        var nbytes: uint64 = src.[fieldinfo.name]:size_bytes()
+        totalsize = totalsize + keysize + wf.varint_size(nbytes) + nbytes
+      end
+    end
+  elseif PACKABLE[fieldinfo.kind] then
+    local sizer = BASE_SIZERS[fieldinfo.kind]
+    return quote
+      var count = src.[fieldinfo.name].size
+      if count > 0 then
+        var slot = state:reserve_size()
+        var subsize: uint64 = 0
+        for idx = 0, count do
+          subsize = subsize + sizer(src.[fieldinfo.name]:get_ref(idx))
+        end
+        state:set_size(slot, subsize)
+        totalsize = totalsize + keysize + wf.varint_size(subsize) + subsize
+      end
+    end
+  else
+    return quote
+      var count = src.[fieldinfo.name].size
+      for idx = 0, count do
+        var val = src.[fieldinfo.name]:get_ref(idx)
+        [_size_single_field(ctx, fieldinfo, totalsize, state, val)]
+      end
+    end
+  end
+end
+
+local function _size_fields(ctx, schema, totalsize, state, src)
+  local statements = {}
+  for _, fieldinfo in ipairs(schema.fields) do
+    if fieldinfo.repeated then
+      table.insert(statements, _size_repeated(ctx, fieldinfo, totalsize, state, src))
+    elseif not fieldinfo.ignored then
+      table.insert(statements, quote
+        if [ctx.value_present(src, fieldinfo)] then
+          var val = [ctx.resolve_field(src, fieldinfo)]
+          [_size_single_field(ctx, fieldinfo, totalsize, state, val)]
+        end
+      end)
+    end
+  end
   return statements
 end
 
 function m.generate_encoder(ctx, schema, T)
+  local style = marker_style(ctx)
   local terra encode(buff: &wf.encode_state_t, src: &T): int64
     var totalsize: int64 = 0
-    [_encode_fields(ctx, schema, totalsize, buff, src)]
+    [_encode_fields(ctx, style, schema, totalsize, buff, src)]
     return totalsize
   end
   encode:setname("encode_" .. (schema.name or T.name):lower())
   return encode
 end
 
+-- the encoded size of a message (not including its own length prefix);
+-- also records the sizes the sized encoder will need in state
+function m.generate_sizer(ctx, schema, T)
+  local terra compute_size(state: &wf.sized_encode_state_t, src: &T): uint64
+    var totalsize: uint64 = 0
+    [_size_fields(ctx, schema, totalsize, state, src)]
+    return totalsize
+  end
+  compute_size:setname("size_" .. (schema.name or T.name):lower())
+  return compute_size
+end
+
+-- (the sizer must have been run on src first)
+function m.generate_sized_encoder(ctx, schema, T)
+  local style = sized_style(ctx)
+  local terra encode(buff: &wf.sized_encode_state_t, src: &T): int64
+    var totalsize: int64 = 0
+    [_encode_fields(ctx, style, schema, totalsize, buff, src)]
+    return totalsize
+  end
+  encode:setname("encode_sized_" .. (schema.name or T.name):lower())
+  return encode
+end
+
 function m.wrap_message_encoder(ctx, schema, T, encoder)
   local terra encode_message(buff: &wf.encode_state_t, src: &T): int64
     var length_marker_idx = buff:place_size_marker()
@@ -207,4 +394,16 @@ function m.wrap_message_encoder(ctx, schema, T, encoder)
   return encode_message
 end
 
-return m
\ No newline at end of file
+function m.wrap_sized_message_encoder(ctx, schema, T, encoder)
+  local terra encode_message(buff: &wf.sized_encode_state_t, src: &T): int64
+    var subsize = buff:take_size()
+    var prefix_len = buff:write_varint_u64(subsize)
+    var nwritten = encoder(buff, src)
+    if nwritten < 0 then return nwritten end
+    return nwritten + prefix_len
+  end
+  encode_message:setname("encode_sized_message_" .. (schema.name or T.name):lower())
+  return encode_message
+end
+
+return m
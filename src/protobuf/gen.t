@@ -58,6 +58,146 @@ terra CombBuffer:view_raw(data: &uint8, datasize: uint32)
   self.buff:view_raw(data, datasize)
 end
 
+-- Arena decoding --
+--
+-- With ProtoGen{arena = true}, the repeated and boxed fields of
+-- generated messages allocate from whichever substrate Arena is
+-- current, rather than through the substrate allocator. Decoding with
+-- message.arena_decoder(buff, msg, arena) makes arena current for the
+-- duration of the decode, so that every allocation a whole message
+-- tree needs is a pointer bump, and message.arena_reset(msg, arena)
+-- frees it all at once. (string/bytes fields are always views into
+-- the decoded buffer, so that buffer has to outlive the message.)
+--
+-- The current arena is a plain global, so arena decodes must not run
+-- concurrently. Allocations made while no arena is current (e.g.,
+-- filling in a message to encode) come from a fallback global arena,
+-- which only grows: freeing a message built this way gives nothing
+-- back. Once every such message is done with, call
+-- message.arena_release_fallback() to free the fallback arena's chunks
+-- (any message still pointing into it is left dangling, so re-init
+-- those first).
+local _arena_alloc = nil
+local function get_arena_alloc()
+  if _arena_alloc then return _arena_alloc end
+  local Arena = substrate.Arena
+  local current = global(&Arena, nil)
+  local fallback = global(Arena)
+
+  local terra get_arena(): &Arena
+    if current ~= nil then return current end
+    return &fallback
+  end
+
+  local cfg = {}
+  for k, v in pairs(substrate.configure()) do cfg[k] = v end
+  function cfg.ALLOCATE(T, count)
+    return `[&T](get_arena():alloc([count or 1] * sizeof(T), 0))
+  end
+  function cfg.ALLOCATE_ZEROED(T, count)
+    return `[&T](get_arena():alloc_zeroed([count or 1] * sizeof(T), 0))
+  end
+  function cfg.FREE(ptr)
+    return quote get_arena():free([&uint8](ptr)) end
+  end
+  function cfg.REALLOCATE(T, ptr, old_count, new_count)
+    return `[&T](get_arena():realloc([&uint8](ptr),
+      old_count * sizeof(T), new_count * sizeof(T), 0))
+  end
+
+  local terra fallback_arena(): &Arena
+    return &fallback
+  end
+
+  local terra release_fallback()
+    fallback:release()
+  end
+
+  _arena_alloc = {
+    Arena = Arena,
+    current = current,
+    fallback_arena = fallback_arena,
+    release_fallback = release_fallback,
+    vec = terralib.memoize(function(T)
+      return require("substrate/array.t")._Array(T, {
+        allow_growth = true, typename = "ArenaVec", cfg = cfg
+      })
+    end),
+    box = terralib.memoize(function(T)
+      return require("substrate/box.t")._Box(T, {typename = "ArenaBox", cfg = cfg})
+    end)
+  }
+  return _arena_alloc
+end
+
+local function gen_arena_codecs(message)
+  local alloc = get_arena_alloc()
+  local Arena, current = alloc.Arena, alloc.current
+  local T, decoder = message.ctype, message.decoder
+
+  message.arena_decoder = terra(buff: &wf.buffer_t, target: &T, arena: &Arena): bool
+    var prev = current
+    current = arena
+    var ok = decoder(buff, target)
+    current = prev
+    return ok
+  end
+  message.arena_decoder:setname("arena_decode_" .. message.name:lower())
+
+  -- frees everything allocated from arena, and empties the message
+  -- (which must only hold allocations from that arena)
+  message.arena_reset = terra(target: &T, arena: &Arena)
+    arena:reset()
+    target:init()
+  end
+
+  -- shared by every arena message: see "Arena decoding" above
+  message.arena_fallback = alloc.fallback_arena
+  message.arena_release_fallback = alloc.release_fallback
+end
+
+-- Sized encoding --
+--
+-- message.compute_size(state, msg) returns the exact encoded size of
+-- msg, and message.encode_sized(state, msg) then writes it in one pass
+-- into state.buff, which only has to be that big (see
+-- wf.sized_encode_state_t). message.encode_into(state, dest, capacity,
+-- msg) does both, into a caller-provided buffer, returning the number
+-- of bytes written, or -1 if capacity is too small. To encode into a
+-- buffer someone else allocates (e.g., zmq_msg_init_size), call
+-- compute_size, allocate, state:target(dest, size), then encode_sized.
+-- The message must not change between compute_size and encode_sized.
+local function gen_sized_codecs(message)
+  local T, sizer, encoder = message.ctype, message.sizer, message.sized_encoder
+  local State = wf.sized_encode_state_t
+
+  local terra compute_size(state: &State, src: &T): uint64
+    state:clear_sizes()
+    return sizer(state, src)
+  end
+  compute_size:setname("compute_size_" .. message.name:lower())
+
+  local terra encode_sized(state: &State, src: &T): int64
+    state.next_size = 0
+    var nbytes = encoder(state, src)
+    if not state.buff:check_status() then return -1 end
+    return nbytes
+  end
+  encode_sized:setname("encode_sized_" .. message.name:lower())
+
+  local terra encode_into(state: &State, dest: &uint8, capacity: uint64, src: &T): int64
+    var size = compute_size(state, src)
+    if size > capacity then return -1 end
+    state:target(dest, size)
+    return encode_sized(state, src)
+  end
+  encode_into:setname("encode_into_" .. message.name:lower())
+
+  message.compute_size = compute_size
+  message.encode_sized = encode_sized
+  message.encode_into = encode_into
+end
+
 local ProtoGen = class("ProtoGen")
 m.ProtoGen = ProtoGen
 
@@ -68,8 +208,15 @@ function ProtoGen:init(options)
   self._decoder_ctx = {}
   eg.prep_ctx(self._encoder_ctx)
   dg.prep_ctx(self._decoder_ctx)
-  self.vec_template = options.vec or assert(substrate.Vec)
-  self.box_template = options.box or assert(substrate.Box)
+  self.arena = options.arena
+  if self.arena then
+    local alloc = get_arena_alloc()
+    self.vec_template = alloc.vec
+    self.box_template = alloc.box
+  else
+    self.vec_template = options.vec or assert(substrate.Vec)
+    self.box_template = options.box or assert(substrate.Box)
+  end
   self.parser_options = options
 end
 
@@ -197,6 +344,16 @@ function ProtoGen:_create_codecs(name)
       --print("Generating decoder for", message.name)
       message.decoder = dg.generate_decoder(dctx, message.schema, message.ctype)
     end
+    if not message.sizer then
+      message.sizer = eg.generate_sizer(ectx, message.schema, message.ctype)
+      message.sized_encoder = eg.generate_sized_encoder(
+        ectx, message.schema, message.ctype
+      )
+      gen_sized_codecs(message)
+    end
+    if self.arena and not message.arena_decoder then
+      gen_arena_codecs(message)
+    end
     if level > 0 then
       if not ectx.encoders[message.name] then
         --print("Generating field encoder for", message.name)
@@ -204,6 +361,12 @@ function ProtoGen:_create_codecs(name)
           ectx, message.schema, message.ctype, message.encoder
         )
       end
+      if not ectx.sizers[message.name] then
+        ectx.sizers[message.name] = message.sizer
+        ectx.sized_encoders[message.name] = eg.wrap_sized_message_encoder(
+          ectx, message.schema, message.ctype, message.sized_encoder
+        )
+      end
       if not dctx.decoders[message.name] then
         --print("Generating field decoder for", message.name)
         dctx.decoders[message.name] = dg.wrap_message_decoder(
@@ -219,4 +382,18 @@ function ProtoGen:get(name)
   return self.messages[name] -- TODO: wrap in something nicer?
 end
 
+-- the lazily decoding struct for a message (see decodergen.t); its
+-- sub-messages get lazy structs too, for view_<field>
+function ProtoGen:get_lazy(name)
+  self:_create_codecs(name)
+  local dctx = self._decoder_ctx
+  self:_map_messages(name, function(message, level)
+    if not message.lazy then
+      message.lazy = dg.generate_lazy(dctx, message.schema, message.ctype)
+      dctx.lazy_types[message.name] = message.lazy
+    end
+  end, 0)
+  return self.messages[name].lazy
+end
+
 return m
\ No newline at end of file
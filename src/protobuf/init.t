@@ -5,6 +5,7 @@ local protobuf = {}
 moduleutils.include_submodules({
   "protobuf/gen.t",
   "protobuf/schemaparser.t",
+  "protobuf/stream.t",
 }, protobuf)
 
 return protobuf
\ No newline at end of file
@@ -0,0 +1,308 @@
+-- protobuf/stream.t
+--
+-- streaming reader for length-delimited messages
+--
+-- Reads a stream of messages which are each prefixed by their length as
+-- a varint (the usual protobuf framing, as written by writeDelimitedTo),
+-- pulling it from a file or any other source chunk_size bytes at a
+-- time, so that only the current message (plus at most a chunk) is ever
+-- held in memory. A message that doesn't fit in the window grows it.
+
+local class = require("class")
+local substrate = require("substrate")
+local wf = require("./wireformat.t")
+local m = {}
+
+-- a source writes up to n bytes into dest and returns how many it
+-- wrote: 0 at the end of the stream, or < 0 on an error
+local SourceFn = {&opaque, &uint8, uint64} -> int64
+m.SourceFn = SourceFn
+
+-- longer length prefixes are treated as corrupt (rather than buffering
+-- whatever follows them)
+m.DEFAULT_MAX_MESSAGE_SIZE = 64 * 2^20
+
+local struct DelimitedReader {
+  window: substrate.Vec(uint8);
+  start: uint64; -- the unconsumed bytes are [start, stop) of the window
+  stop: uint64;
+  chunk_size: uint64;
+  max_message_size: uint64;
+  read: SourceFn;
+  source: &opaque;
+  finished: bool; -- the source has run out
+  failed: bool; -- read error, or the stream ended mid-message
+  count: uint64; -- messages read so far
+}
+m.DelimitedReader = DelimitedReader
+
+terra DelimitedReader:init()
+  self.window:init()
+  self.start, self.stop = 0, 0
+  self.chunk_size = 0
+  self.max_message_size = [m.DEFAULT_MAX_MESSAGE_SIZE]
+  self.read, self.source = nil, nil
+  self.finished, self.failed = false, false
+  self.count = 0
+end
+
+terra DelimitedReader:release()
+  self.window:release()
+  self:init()
+end
+
+terra DelimitedReader:open(read: SourceFn, source: &opaque, chunk_size: uint64)
+  self.read, self.source = read, source
+  self.chunk_size = chunk_size
+  self.start, self.stop = 0, 0
+  self.finished, self.failed = false, false
+  self.count = 0
+  self.window:fit_capacity(chunk_size)
+end
+
+-- reads chunks until at least n unconsumed bytes are in the window;
+-- returns false if the source runs out first
+terra DelimitedReader:_fill(n: uint64): bool
+  if self.stop - self.start >= n then return true end
+  -- move the leftover partial message to the front of the window
+  var nleft = self.stop - self.start
+  if self.start > 0 then
+    if nleft > 0 then
+      substrate.intrinsics.memmove(self.window.data,
+                                   self.window.data + self.start, nleft)
+    end
+    self.start, self.stop = 0, nleft
+  end
+  while self.stop < n and not self.finished do
+    self.window:fit_capacity(self.stop + self.chunk_size)
+    var nread = self.read(self.source, self.window.data + self.stop,
+                          self.chunk_size)
+    if nread < 0 then
+      self.failed = true
+      return false
+    elseif nread == 0 then
+      self.finished = true
+    end
+    self.stop = self.stop + nread
+  end
+  return self.stop >= n
+end
+
+-- whether the unconsumed bytes start with a whole varint (or with 10
+-- bytes, which is as long as a valid one can be)
+terra DelimitedReader:_has_prefix(): bool
+  var p = self.window.data + self.start
+  for i = 0, self.stop - self.start do
+    if i == 10 or (p[i] and 0x80) == 0 then return true end
+  end
+  return false
+end
+
+-- views the next message (without its length prefix) in msg, which is
+-- only valid until the next call; returns false at the end of the
+-- stream, or on an error (in which case .failed is set)
+terra DelimitedReader:next(msg: &wf.buffer_t): bool
+  if self.failed then return false end
+  -- only read more while the prefix is incomplete, so that a short
+  -- message never waits on bytes that come after it
+  while not self:_has_prefix() do
+    if not self:_fill(self.stop - self.start + 1) then break end
+  end
+  if self.failed then return false end
+  var avail = self.stop - self.start
+  if avail == 0 then return false end
+  var prefix = wf.buffer_t{self.window.data + self.start, avail, 0, 0}
+  var len = prefix:read_varint_u64()
+  if not prefix:check_status() then
+    self.failed = true
+    return false
+  end
+  var total = prefix.pos + len
+  -- (checked before filling, since len comes straight from the stream)
+  if len > self.max_message_size or total < len then
+    self.failed = true
+    return false
+  end
+  if not self:_fill(total) then
+    self.failed = true
+    return false
+  end
+  -- (filling may have moved the window)
+  msg.data = self.window.data + self.start + prefix.pos
+  msg.len = len
+  msg.pos = 0
+  msg.flags = 0
+  self.start = self.start + total
+  self.count = self.count + 1
+  return true
+end
+
+-- reads a file (through substrate's File)
+local struct FileSource {
+  file: substrate.File;
+  remaining: uint64;
+}
+m.FileSource = FileSource
+
+terra FileSource:open(filename: &int8): bool
+  self.file:init()
+  if not self.file:open(filename, false) then return false end
+  self.remaining = self.file.size
+  return true
+end
+
+terra FileSource:close()
+  self.file:close()
+end
+
+local terra read_file(p: &opaque, dest: &uint8, n: uint64): int64
+  var src = [&FileSource](p)
+  if n > src.remaining then n = src.remaining end
+  if n == 0 then return 0 end
+  if src.file:read_raw(dest, n, n) ~= n then return -1 end
+  src.remaining = src.remaining - n
+  return n
+end
+m.read_file = read_file
+
+-- a native loop which decodes every message from a reader into target,
+-- calling callback(target, userdata) on each (which can return false to
+-- stop); returns the number of messages, or -1 on a read/decode error
+m.build_foreach = terralib.memoize(function(Msg)
+  local T, decoder = Msg.ctype, Msg.decoder
+  local terra foreach(reader: &DelimitedReader, target: &T,
+                      callback: {&T, &opaque} -> bool, userdata: &opaque): int64
+    var view: wf.buffer_t
+    var count: int64 = 0
+    while reader:next(&view) do
+      target:clear()
+      if not decoder(&view, target) then return -1 end
+      count = count + 1
+      if not callback(target, userdata) then break end
+    end
+    if reader.failed then return -1 end
+    return count
+  end
+  foreach:setname("foreach_" .. Msg.name:lower())
+  return foreach
+end)
+
+local MessageStream = class("MessageStream")
+m.MessageStream = MessageStream
+
+-- Msg: a message from ProtoGen:get
+-- options.chunk_size: how many bytes to read at a time (default 64KB)
+-- options.max_message_size: longest message accepted, in bytes
+-- (default m.DEFAULT_MAX_MESSAGE_SIZE); longer prefixes are errors
+function MessageStream:init(Msg, options)
+  options = options or {}
+  self.Msg = Msg
+  self.chunk_size = options.chunk_size or 2^16
+  self.reader = terralib.new(DelimitedReader)
+  self.reader:init()
+  self.reader.max_message_size = options.max_message_size
+                                 or m.DEFAULT_MAX_MESSAGE_SIZE
+  self.msg = terralib.new(Msg.ctype)
+  self.msg:init()
+  self.view = terralib.new(wf.buffer_t)
+end
+
+-- returns false if the file can't be opened
+function MessageStream:open_file(filename)
+  self:close()
+  local file = terralib.new(FileSource)
+  if not file:open(filename) then return false end
+  self._file = file
+  self.reader:open(read_file:getpointer(), file, self.chunk_size)
+  return true
+end
+
+-- read: either a terra SourceFn (called with source), or a Lua
+-- function(dest, n) which writes up to n bytes to dest and returns how
+-- many it wrote, e.g., from a socket
+function MessageStream:open_source(read, source)
+  self:close()
+  if terralib.isfunction(read) then
+    read = read:getpointer()
+  elseif type(read) == "function" then
+    local lua_read = read
+    self._callback = terralib.cast(SourceFn, function(_, dest, n)
+      return lua_read(dest, n)
+    end)
+    read = self._callback
+  end
+  self.reader:open(read, source, self.chunk_size)
+end
+
+-- decodes the next message into the stream's message (which is reused
+-- for every message) and returns it; returns nil at the end of the
+-- stream, or nil and an error message
+function MessageStream:next()
+  if not self.reader:next(self.view) then
+    if self.reader.failed then
+      return nil, "Read error, truncated or oversized message after message "
+                  .. tonumber(self.reader.count)
+    end
+    return nil
+  end
+  self.msg:clear()
+  if not self.Msg.decoder(self.view, self.msg) then
+    return nil, "Couldn't decode message " .. tonumber(self.reader.count)
+  end
+  return self.msg
+end
+
+-- for idx, msg in stream:messages() do ... end
+function MessageStream:messages()
+  local idx = 0
+  return function()
+    local msg, err = self:next()
+    if not msg then
+      if err then truss.error(err) end
+      return nil
+    end
+    idx = idx + 1
+    return idx, msg
+  end
+end
+
+-- calls callback(msg) for each message, until it returns false; with a
+-- terra callback ({&T, &opaque} -> bool, given userdata) the whole loop
+-- runs natively. Returns the number of messages, or nil and an error.
+function MessageStream:each(callback, userdata)
+  if terralib.isfunction(callback) then
+    local foreach = m.build_foreach(self.Msg)
+    local count = foreach(self.reader, self.msg, callback:getpointer(), userdata)
+    if count < 0 then return nil, "Error reading message stream" end
+    return tonumber(count)
+  end
+  local count = 0
+  while true do
+    local msg, err = self:next()
+    if not msg then
+      if err then return nil, err end
+      return count
+    end
+    count = count + 1
+    if callback(msg) == false then return count end
+  end
+end
+
+function MessageStream:close()
+  if self._file then
+    self._file:close()
+    self._file = nil
+  end
+  if self._callback then
+    self._callback:free()
+    self._callback = nil
+  end
+end
+
+function MessageStream:release()
+  self:close()
+  self.reader:release()
+  self.msg:release()
+end
+
+return m
@@ -0,0 +1,115 @@
+"""
+proto_bench.py
+--------------
+
+Time the reference (Python protobuf) codecs on the corpora
+written by `truss protobuf/_bench.t results.json corpus_dir`,
+and write the results in the same JSON format, so the two
+can be compared.
+
+usage: python proto_bench.py results.json reference.json
+(run from the same directory truss was run from)
+"""
+import os
+import sys
+import json
+import time
+
+from google.protobuf.internal.decoder import _DecodeVarint
+
+# import our built proto messages
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from messages import test_pb2 as msg  # noqa: E402
+
+
+MIN_SECONDS = 0.5
+MIN_REPS = 3
+
+
+def read_stream(path):
+    """
+    Split a length-delimited stream into message payloads.
+
+    Parameters
+    -----------
+    path : str
+      Corpus file written by _bench.t
+
+    Returns
+    -----------
+    payloads : list of bytes
+      Serialized messages
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    payloads = []
+    pos = 0
+    while pos < len(data):
+        size, pos = _DecodeVarint(data, pos)
+        payloads.append(data[pos:pos + size])
+        pos += size
+    return payloads
+
+
+def time_it(nbytes, func):
+    """
+    Run func repeatedly (at least MIN_REPS times and
+    MIN_SECONDS in total) and report its throughput.
+    """
+    reps, elapsed, best = 0, 0.0, float('inf')
+    while reps < MIN_REPS or elapsed < MIN_SECONDS:
+        start = time.perf_counter()
+        func()
+        dt = time.perf_counter() - start
+        reps += 1
+        elapsed += dt
+        best = min(best, dt)
+    return {'reps': reps,
+            'mean_s': elapsed / reps,
+            'best_s': best,
+            'mb_per_s': nbytes / best / 1e6}
+
+
+def bench_corpus(corpus):
+    """
+    Time encoding and decoding one corpus.
+    """
+    kind = getattr(msg, corpus['message'])
+    payloads = read_stream(corpus['corpus_file'])
+    total = sum(len(p) for p in payloads)
+    decoded = [kind.FromString(p) for p in payloads]
+
+    def encode():
+        for m in decoded:
+            m.SerializeToString()
+
+    def decode():
+        for p in payloads:
+            kind.FromString(p)
+
+    return {'name': corpus['name'],
+            'message': corpus['message'],
+            'count': len(payloads),
+            'total_bytes': total,
+            'encode': time_it(total, encode),
+            'decode': time_it(total, decode)}
+
+
+if __name__ == '__main__':
+    with open(sys.argv[1]) as f:
+        results = json.load(f)
+    corpora = [c for c in results['corpora'] if 'corpus_file' in c]
+    if len(corpora) == 0:
+        raise ValueError('no corpus files: run _bench.t with a corpus_dir')
+
+    reference = {
+        'implementation': 'python-protobuf',
+        'timestamp': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'min_seconds': MIN_SECONDS,
+        'corpora': []}
+    for corpus in corpora:
+        print(corpus['name'])
+        reference['corpora'].append(bench_corpus(corpus))
+
+    with open(sys.argv[2], 'w') as f:
+        json.dump(reference, f, indent=2)
@@ -133,16 +133,12 @@ terra buffer_t:view(src: &ByteArray)
   self:view_raw(src.data, src.capacity)
 end
 
-terra buffer_t:read_raw_bytes(dest: &uint8, n_bytes: uint8)
+terra buffer_t:read_raw_bytes(dest: &uint8, n_bytes: size_t)
   if self.pos + n_bytes > self.len then
     self.flags = FLAG_ERROR
     return
   end
-  var pos = self.pos
-  var data = self.data
-  for p = 0, n_bytes do
-    dest[p] = data[pos + p]
-  end
+  substrate.intrinsics.memcpy(dest, self.data + self.pos, n_bytes)
   self.pos = self.pos + n_bytes
 end
 
@@ -162,7 +158,8 @@ terra buffer_t:write_raw_bytes(src: &uint8, n_bytes: size_t): int64
   return n_bytes
 end
 
-terra buffer_t:read_varint_u64(): uint64
+-- (byte at a time; handles varints running up to the end of the buffer)
+terra buffer_t:_read_varint_u64_slow(): uint64
   var result: uint64 = 0
   var shift: uint32 = 0
   var src = self.data
@@ -184,6 +181,50 @@ terra buffer_t:read_varint_u64(): uint64
   return result
 end
 
+local cttz64 = terralib.intrinsic("llvm.cttz.i64", {uint64, bool} -> uint64)
+
+-- Varints of up to 8 bytes are decoded from a single 8 byte load: the
+-- terminating byte is the lowest one with its high bit clear, and the
+-- 7 bit groups below it are then compacted with three shift/masks
+-- instead of a loop. This needs 10 readable bytes (the longest varint),
+-- so near the end of the buffer it falls back to the bytewise loop.
+terra buffer_t:read_varint_u64(): uint64
+  if self.len - self.pos < 10 or self.pos > self.len then
+    return self:_read_varint_u64_slow()
+  end
+  var word: uint64
+  substrate.intrinsics.memcpy([&uint8](&word), self.data + self.pos, 8)
+  var stops = (not word) and 0x8080808080808080ULL
+  if stops == 0 then
+    -- 9 or 10 byte varint (e.g., any negative int)
+    return self:_read_varint_u64_slow()
+  end
+  var nbytes = cttz64(stops, true) / 8 + 1
+  var x = word and (stops ^ (stops - 1)) and 0x7f7f7f7f7f7f7f7fULL
+  x = ((x and 0x7f007f007f007f00ULL) >> 1) or (x and 0x007f007f007f007fULL)
+  x = ((x and 0x3fff00003fff0000ULL) >> 2) or (x and 0x00003fff00003fffULL)
+  x = ((x and 0x0fffffff00000000ULL) >> 4) or (x and 0x000000000fffffffULL)
+  self.pos = self.pos + nbytes
+  return x
+end
+
+-- the number of varints in a run of packed varints
+terra m.count_varints(data: &uint8, len: size_t): size_t
+  var count: size_t = 0
+  for i = 0, len do
+    count = count + ((data[i] >> 7) ^ 1)
+  end
+  return count
+end
+
+local ctlz64 = terralib.intrinsic("llvm.ctlz.i64", {uint64, bool} -> uint64)
+
+-- the number of bytes val takes as a varint
+terra m.varint_size(val: uint64): uint32
+  var nbits = 64 - ctlz64(val or 1, true)
+  return (nbits + 6) / 7
+end
+
 terra buffer_t:write_varint_u64(val: uint64): uint32
   var dest = self.data
   var pos = self.pos
@@ -266,14 +307,7 @@ local struct marker_t {
 }
 
 terra marker_t:byte_len(): uint32
-  var v = self.val
-  if v == 0 then return 1 end
-  var nb: uint32 = 0
-  while v > 0 do
-    v = v >> 7
-    nb = nb + 1
-  end
-  return nb
+  return m.varint_size(self.val)
 end
 
 local struct encode_state_t {
@@ -339,4 +373,74 @@ terra encode_state_t:write_varint_u64(val: uint64): uint32
   return self.buff:write_varint_u64(val)
 end
 
+-- Single pass encoding: a message's compute_size records the length of
+-- every nested message and packed field, in the order they will be
+-- written, and its sized encoder then takes them back in that same
+-- order. So every length prefix is known before its contents are
+-- written, and the output goes straight into buff, which can be exactly
+-- the computed size (no markers, no compress).
+local struct sized_encode_state_t {
+  buff: buffer_t;
+  sizes: Vec(uint64);
+  next_size: size_t;
+}
+m.sized_encode_state_t = sized_encode_state_t
+
+terra sized_encode_state_t:init()
+  self.buff:init()
+  self.sizes:init()
+  self.next_size = 0
+end
+
+terra sized_encode_state_t:release()
+  self.sizes:release()
+end
+
+terra sized_encode_state_t:clear_sizes()
+  self.sizes:clear()
+  self.next_size = 0
+end
+
+-- encode into [dest, dest + len), e.g., a caller- or zmq-owned buffer
+terra sized_encode_state_t:target(dest: &uint8, len: size_t)
+  self.buff.data = dest
+  self.buff.len = len
+  self.buff.pos = 0
+  self.buff.flags = 0
+end
+
+terra sized_encode_state_t:reserve_size(): size_t
+  self.sizes:push_val(0)
+  return self.sizes.size - 1
+end
+
+terra sized_encode_state_t:set_size(idx: size_t, val: uint64)
+  self.sizes.data[idx] = val
+end
+
+-- (if the sizes have run out, e.g. the message changed between
+-- compute_size and encoding, flags an error on the buffer and
+-- returns 0)
+terra sized_encode_state_t:take_size(): uint64
+  if self.next_size >= self.sizes.size then
+    self.buff.flags = FLAG_ERROR
+    return 0
+  end
+  var val = self.sizes.data[self.next_size]
+  self.next_size = self.next_size + 1
+  return val
+end
+
+terra sized_encode_state_t:write_raw_bytes(data: &uint8, len: size_t): int64
+  return self.buff:write_raw_bytes(data, len)
+end
+
+terra sized_encode_state_t:write_key(field_number: uint32, wire_type: uint32): uint32
+  return self.buff:write_key(field_number, wire_type)
+end
+
+terra sized_encode_state_t:write_varint_u64(val: uint64): uint32
+  return self.buff:write_varint_u64(val)
+end
+
 return m
\ No newline at end of file
@@ -0,0 +1,93 @@
+local m = {}
+
+local function test_arena(jape)
+  local test, expect = jape.test, jape.expect
+  local substrate = require("substrate")
+  local Arena = substrate.Arena
+
+  local terra is_aligned(ptr: &uint8, align: uint64): bool
+    return ([uint64](ptr) and (align - 1)) == 0
+  end
+
+  local terra distance(a: &uint8, b: &uint8): int64
+    return b - a
+  end
+
+  local arena
+  jape.before_each(function()
+    arena = terralib.new(Arena)
+    arena:init()
+    arena:configure(1024, 16)
+  end)
+
+  jape.after_each(function()
+    arena:release()
+    arena = nil
+  end)
+
+  test("alignment", function()
+    local a = arena:alloc(3, 0)
+    local b = arena:alloc(5, 0)
+    local c = arena:alloc(7, 64)
+    expect(is_aligned(a, 16)):to_be_truthy()
+    expect(is_aligned(b, 16)):to_be_truthy()
+    expect(is_aligned(c, 64)):to_be_truthy()
+  end)
+
+  test("bump", function()
+    local a = arena:alloc(16, 0)
+    local b = arena:alloc(16, 0)
+    expect(tonumber(distance(a, b))):to_be(16)
+  end)
+
+  test("free pops last allocation", function()
+    local a = arena:alloc(32, 0)
+    local allocated = tonumber(arena.bytes_allocated)
+    arena:free(a)
+    expect(tonumber(arena.bytes_allocated) < allocated):to_be_truthy()
+    local b = arena:alloc(32, 0)
+    expect(tonumber(distance(a, b))):to_be(0)
+    expect(tonumber(arena.bytes_allocated)):to_be(allocated)
+  end)
+
+  test("mark and rewind", function()
+    arena:alloc(100, 0)
+    local mark = arena:mark()
+    local a = arena:alloc(100, 0)
+    for _ = 1, 50 do arena:alloc(100, 0) end -- spills into new chunks
+    arena:rewind(mark)
+    local b = arena:alloc(100, 0)
+    expect(tonumber(distance(a, b))):to_be(0)
+  end)
+
+  test("reset reuses chunks", function()
+    for _ = 1, 10 do arena:alloc(1000, 0) end
+    local reserved = tonumber(arena:reserved_bytes())
+    expect(tonumber(arena.high_water) >= 10000):to_be_truthy()
+    arena:reset()
+    expect(tonumber(arena.bytes_allocated)):to_be(0)
+    for _ = 1, 10 do arena:alloc(1000, 0) end
+    expect(tonumber(arena:reserved_bytes())):to_be(reserved)
+  end)
+
+  test("realloc in place", function()
+    local a = arena:alloc(64, 0)
+    local b = arena:realloc(a, 64, 256, 0)
+    expect(tonumber(distance(a, b))):to_be(0)
+    local c = arena:alloc(16, 0)
+    local d = arena:realloc(b, 256, 512, 0) -- no longer the last allocation
+    expect(tonumber(distance(b, d)) ~= 0):to_be_truthy()
+  end)
+
+  test("oversized allocation", function()
+    local a = arena:alloc(1024*10, 0)
+    expect(is_aligned(a, 16)):to_be_truthy()
+    expect(tonumber(arena.bytes_allocated) >= 1024*10):to_be_truthy()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("arena", test_arena)
+end
+
+return m
@@ -55,10 +55,142 @@ local function test_arrays(jape)
     expect(v.size):to_be(1)
     expect(v.data[0]):to_be(111)
   end)
+
+  test("growth preserves contents", function()
+    for idx = 4, 10000 do
+      v:push_val(10 + idx)
+    end
+    expect(v.size):to_be(10000)
+    local ok = true
+    for idx = 0, 9999 do
+      if v.data[idx] ~= 11 + idx then ok = false end
+    end
+    expect(ok):to_be_truthy()
+    v:resize_capacity(5)
+    expect(v.size):to_be(5)
+    expect(v.data[4]):to_be(15)
+  end)
+end
+
+local function test_small_vecs(jape)
+  local test, expect = jape.test, jape.expect
+  local substrate = require("substrate")
+  local ffi = require("ffi")
+
+  test("inline storage", function()
+    local v = terralib.new(substrate.SmallVec(int32, 4))
+    v:init()
+    for idx = 1, 4 do v:push_val(idx) end
+    expect(v:is_inline()):to_be_truthy()
+    v:push_val(5)
+    expect(v:is_inline()):to_be_falsy()
+    expect(v.size):to_be(5)
+    for idx = 0, 4 do
+      expect(v:get_val(idx)):to_be(idx+1)
+    end
+    v:release()
+  end)
+
+  test("copy", function()
+    local a = terralib.new(substrate.SmallVec(int32, 2))
+    local b = terralib.new(substrate.SmallVec(int32, 2))
+    a:init()
+    b:init()
+    for idx = 1, 10 do a:push_val(idx) end
+    b:copy(a)
+    expect(b.size):to_be(10)
+    expect(b:get_val(9)):to_be(10)
+    a:release()
+    b:release()
+  end)
+
+  test("small strings", function()
+    local s = terralib.new(substrate.SmallString(16))
+    s:init()
+    s:copy_cstr("hello")
+    expect(s:is_inline()):to_be_truthy()
+    expect(s:equals_cstr("hello")):to_be_truthy()
+    s:copy_cstr("a considerably longer string")
+    expect(s:is_inline()):to_be_falsy()
+    expect(ffi.string(s:get_data(), s.size)):to_be("a considerably longer string")
+    s:release()
+  end)
+end
+
+-- an allocator whose reallocations fail above a limit
+local function failing_cfg()
+  local libc = require("substrate/libc.t")
+  local cfg = {}
+  for k, v in pairs(require("substrate/cfg.t").configure()) do cfg[k] = v end
+  local limit = global(uint64, 0)
+  local nlogged = global(uint32, 0)
+  local terra failing_realloc(ptr: &opaque, nbytes: uint64): &opaque
+    if nbytes > limit then return nil end
+    return libc.std.realloc(ptr, nbytes)
+  end
+  cfg.REALLOCATE = function(T, ptr, old_count, new_count)
+    return `[&T](failing_realloc(ptr, new_count * sizeof(T)))
+  end
+  cfg.LOG = function(fmt, ...)
+    return quote nlogged = nlogged + 1 end
+  end
+  local terra set_limit(nbytes: uint64) limit = nbytes end
+  local terra get_nlogged(): uint32 return nlogged end
+  return cfg, set_limit, get_nlogged
+end
+
+local function test_failed_growth(jape)
+  local test, expect = jape.test, jape.expect
+  local array = require("substrate/array.t")
+
+  test("vec keeps its block when growing fails", function()
+    local cfg, set_limit, get_nlogged = failing_cfg()
+    local FailVec = array._Array(int32, {allow_growth = true, cfg = cfg,
+                                     typename = "FailVec"})
+    local v = terralib.new(FailVec)
+    v:init()
+    set_limit(4 * 4)
+    for idx = 1, 4 do v:push_val(idx) end
+    local data, capacity = v.data, v.capacity
+    v:resize_capacity(100)
+    expect(get_nlogged()):to_be(1)
+    expect(v.data == data):to_be_truthy()
+    expect(tonumber(v.capacity)):to_be(tonumber(capacity))
+    expect(tonumber(v.size)):to_be(4)
+    expect(v:get_val(3)):to_be(4)
+    set_limit(100 * 4)
+    v:resize_capacity(100)
+    expect(tonumber(v.capacity)):to_be(100)
+    expect(v:get_val(3)):to_be(4)
+    v:release()
+  end)
+
+  test("small vec keeps its heap block when growing fails", function()
+    local cfg, set_limit, get_nlogged = failing_cfg()
+    local FailSmallVec = array._SmallVec(int32, 2, {cfg = cfg,
+                                         typename = "FailSmallVec"})
+    local v = terralib.new(FailSmallVec)
+    v:init()
+    for idx = 1, 3 do v:push_val(idx) end -- spills to the heap
+    local heap, capacity = v.heap, v.capacity
+    v:fit_capacity(100)
+    expect(get_nlogged()):to_be(1)
+    expect(v.heap == heap):to_be_truthy()
+    expect(tonumber(v.capacity)):to_be(tonumber(capacity))
+    expect(v:get_val(2)):to_be(3)
+    set_limit(1000)
+    v:fit_capacity(100)
+    expect(tonumber(v.capacity) >= 100):to_be_truthy()
+    expect(v:get_val(2)):to_be(3)
+    v:release()
+  end)
 end
 
 function m.init(jape)
-  (jape or require("dev/jape.t")).describe("arrays", test_arrays)
+  jape = jape or require("dev/jape.t")
+  jape.describe("arrays", test_arrays)
+  jape.describe("small vecs", test_small_vecs)
+  jape.describe("failed growth", test_failed_growth)
 end
 
 return m
\ No newline at end of file
@@ -0,0 +1,131 @@
+local m = {}
+
+local function test_hashmaps(jape)
+  local test, expect = jape.test, jape.expect
+  local substrate = require("substrate")
+
+  test("insert and find", function()
+    local map = terralib.new(substrate.HashMap(uint32, float))
+    map:init()
+    for idx = 0, 999 do
+      map:put_val(idx, idx * 0.5)
+    end
+    expect(map.size):to_be(1000)
+    local ok = true
+    for idx = 0, 999 do
+      local v = map:find_val(idx)
+      if v == nil or v[0] ~= idx * 0.5 then ok = false end
+    end
+    expect(ok):to_be_truthy()
+    expect(map:find_val(1000) == nil):to_be_truthy()
+    map:release()
+  end)
+
+  test("overwrite", function()
+    local map = terralib.new(substrate.HashMap(int32, int32))
+    map:init()
+    map:put_val(7, 1)
+    map:put_val(7, 2)
+    expect(map.size):to_be(1)
+    expect(map:find_val(7)[0]):to_be(2)
+    map:release()
+  end)
+
+  test("remove", function()
+    local map = terralib.new(substrate.HashMap(uint32, uint32))
+    map:init()
+    for idx = 0, 499 do map:put_val(idx, idx) end
+    for idx = 0, 499, 2 do
+      expect(map:remove_val(idx)):to_be_truthy()
+    end
+    expect(map:remove_val(0)):to_be_falsy()
+    expect(map.size):to_be(250)
+    local ok = true
+    for idx = 0, 499 do
+      local present = map:contains_val(idx)
+      if present ~= (idx % 2 == 1) then ok = false end
+    end
+    expect(ok):to_be_truthy()
+    map:release()
+  end)
+
+  test("iteration", function()
+    local map = terralib.new(substrate.HashMap(uint32, uint32))
+    map:init()
+    for idx = 1, 100 do map:put_val(idx, idx) end
+    local sum = 0
+    local slot = map:next_slot(0)
+    while slot < map.capacity do
+      sum = sum + map:val_at(slot)[0]
+      slot = map:next_slot(slot + 1)
+    end
+    expect(sum):to_be(5050)
+    map:release()
+  end)
+
+  test("string keys", function()
+    local String = substrate.String
+    local set = terralib.new(substrate.HashSet(String))
+    set:init()
+    local key = terralib.new(String)
+    key:init()
+    for _, word in ipairs{"apple", "banana", "apple", "cherry"} do
+      key:release() -- (Strings don't grow)
+      key:copy_cstr(word)
+      set:insert(key)
+    end
+    expect(set.size):to_be(3)
+    key:release()
+    key:copy_cstr("banana")
+    expect(set:contains(key)):to_be_truthy()
+    key:release()
+    key:copy_cstr("durian")
+    expect(set:contains(key)):to_be_falsy()
+    key:release()
+    set:release()
+  end)
+
+  test("copy", function()
+    local Map = substrate.HashMap(uint32, uint32)
+    local a, b = terralib.new(Map), terralib.new(Map)
+    a:init()
+    b:init()
+    for idx = 1, 50 do a:put_val(idx, idx * 2) end
+    b:copy(a)
+    expect(b.size):to_be(50)
+    expect(b:find_val(25)[0]):to_be(50)
+    a:release()
+    b:release()
+  end)
+
+  test("pointer keys and values", function()
+    local items = terralib.new(uint32[10])
+    local set = terralib.new(substrate.HashSet(&uint32))
+    set:init()
+    for idx = 0, 9 do set:insert_val(items + idx) end
+    expect(set:insert_val(items + 3)):to_be_falsy()
+    expect(set.size):to_be(10)
+    expect(set:contains_val(items + 9)):to_be_truthy()
+    expect(set:contains_val(items + 10)):to_be_falsy()
+    set:release()
+
+    local Map = substrate.HashMap(uint32, &uint32)
+    local map, map2 = terralib.new(Map), terralib.new(Map)
+    map:init()
+    map2:init()
+    for idx = 0, 9 do
+      local ptr = terralib.new((&uint32)[1], {items + idx})
+      map:put(terralib.new(uint32[1], {idx}), ptr)
+    end
+    map2:copy(map)
+    expect(map2:find_val(4)[0] == items + 4):to_be_truthy()
+    map:release()
+    map2:release()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("hashmaps", test_hashmaps)
+end
+
+return m
@@ -0,0 +1,70 @@
+local m = {}
+
+local function test_pool(jape)
+  local test, expect = jape.test, jape.expect
+  local substrate = require("substrate")
+  local Pool, PoolCache = substrate.Pool, substrate.PoolCache
+
+  local terra is_aligned(ptr: &uint8, align: uint64): bool
+    return ([uint64](ptr) and (align - 1)) == 0
+  end
+
+  local terra same_ptr(a: &uint8, b: &uint8): bool
+    return a == b
+  end
+
+  local pool, cache
+  jape.before_each(function()
+    pool = terralib.new(Pool)
+    pool:init()
+    cache = terralib.new(PoolCache)
+    cache:init(pool)
+  end)
+
+  jape.after_each(function()
+    cache:release()
+    pool:release()
+    cache, pool = nil, nil
+  end)
+
+  test("alignment", function()
+    for _, size in ipairs{1, 7, 16, 33, 100, 1000, 40000} do
+      local p = cache:alloc(size)
+      expect(is_aligned(p, 16)):to_be_truthy()
+      expect(tonumber(cache:block_capacity(p)) >= size):to_be_truthy()
+      cache:free(p)
+    end
+  end)
+
+  test("reuses freed blocks", function()
+    local a = cache:alloc(24)
+    cache:free(a)
+    local b = cache:alloc(30) -- same size class
+    expect(same_ptr(a, b)):to_be_truthy()
+    cache:free(b)
+  end)
+
+  test("stats", function()
+    local ptrs = {}
+    for idx = 1, 1000 do ptrs[idx] = cache:alloc(100) end
+    local big = cache:alloc(100000)
+    cache:sync_stats()
+    local stats = pool:get_stats()
+    expect(tonumber(stats.bytes_requested)):to_be(100*1000 + 100000)
+    expect(tonumber(stats.large_allocations)):to_be(1)
+    expect(stats.fragmentation >= 0.0):to_be_truthy()
+    for idx = 1, 1000 do cache:free(ptrs[idx]) end
+    cache:free(big)
+    cache:sync_stats()
+    stats = pool:get_stats()
+    expect(tonumber(stats.bytes_requested)):to_be(0)
+    expect(tonumber(stats.bytes_in_use)):to_be(0)
+    expect(tonumber(stats.high_water) >= 200000):to_be_truthy()
+  end)
+end
+
+function m.init(jape)
+  (jape or require("dev/jape.t")).describe("pool", test_pool)
+end
+
+return m
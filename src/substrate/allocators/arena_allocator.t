@@ -0,0 +1,103 @@
+-- substrate/allocators/arena_allocator.t
+--
+-- allocator that bumps out of a single global arena
+-- (individual frees are no-ops; call .new_frame() or
+--  use .SCOPED to reclaim memory in bulk)
+--
+-- Allocations are serialized by a spinlock, so any thread may
+-- allocate. But .new_frame() and .SCOPED reclaim every thread's
+-- allocations, so they should only be used (from the main thread)
+-- while no other thread is allocating or using arena memory.
+--
+-- cfg options:
+--   arena_chunk_size: size of each arena chunk in bytes
+--   arena_alignment: alignment of every allocation (power of two)
+
+local function build(cfg)
+  local arena_mod = require("substrate/arena.t")
+  local atomic = require("substrate/atomic.t")
+  -- (pass cfg through: we're called from inside configure, so the
+  -- default configure() would recurse)
+  local Arena = arena_mod._build({cfg = cfg}).Arena
+  local size_t = cfg.size_t
+  local alloc = {}
+
+  local arena = global(Arena)
+  local lock = global(atomic.SpinLock) -- (zeroed = unlocked)
+  local chunk_size = cfg.arena_chunk_size or 0
+  local alignment = cfg.arena_alignment or 0
+
+  -- (call with the lock held)
+  local terra get_arena(): &Arena
+    -- the global starts out zeroed, so configure it on first use
+    if arena.chunk_size == 0 then
+      arena:init()
+      arena:configure(chunk_size, alignment)
+    end
+    return &arena
+  end
+
+  local terra locked_alloc(nbytes: size_t, zeroed: bool): &uint8
+    lock:lock()
+    var ret: &uint8
+    if zeroed then
+      ret = get_arena():alloc_zeroed(nbytes, 0)
+    else
+      ret = get_arena():alloc(nbytes, 0)
+    end
+    lock:unlock()
+    return ret
+  end
+
+  local terra locked_free(ptr: &uint8)
+    lock:lock()
+    get_arena():free(ptr)
+    lock:unlock()
+  end
+
+  local terra locked_realloc(ptr: &uint8, old_nbytes: size_t, new_nbytes: size_t): &uint8
+    lock:lock()
+    var ret = get_arena():realloc(ptr, old_nbytes, new_nbytes, 0)
+    lock:unlock()
+    return ret
+  end
+
+  function alloc.ALLOCATE(T, count)
+    count = count or 1
+    return `[&T](locked_alloc(count * sizeof(T), false))
+  end
+
+  function alloc.ALLOCATE_ZEROED(T, count)
+    count = count or 1
+    return `[&T](locked_alloc(count * sizeof(T), true))
+  end
+
+  function alloc.FREE(ptr)
+    return quote locked_free([&uint8](ptr)) end
+  end
+
+  function alloc.REALLOCATE(T, ptr, old_count, new_count)
+    return `[&T](locked_realloc([&uint8](ptr),
+      old_count * sizeof(T), new_count * sizeof(T)))
+  end
+
+  -- frees everything allocated since the last frame
+  terra alloc.new_frame()
+    lock:lock()
+    get_arena():reset()
+    lock:unlock()
+  end
+
+  -- frees everything allocated within body
+  function alloc.SCOPED(body)
+    return arena_mod.arena_scoped(`get_arena(), body)
+  end
+
+  alloc.arena = arena
+  alloc.lock = lock
+  alloc.get_arena = get_arena -- (doesn't lock)
+
+  return alloc
+end
+
+return build
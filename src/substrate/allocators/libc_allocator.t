@@ -26,6 +26,10 @@ local function build(cfg)
     return quote c.std.free(ptr) end
   end
 
+  function alloc.REALLOCATE(T, ptr, old_count, new_count)
+    return `[&T](c.std.realloc(ptr, new_count * sizeof(T)))
+  end
+
   return alloc
 end
 
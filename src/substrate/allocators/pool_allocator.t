@@ -0,0 +1,126 @@
+-- substrate/allocators/pool_allocator.t
+--
+-- size-class pooled allocator (see substrate/pool.t)
+--
+-- All allocations come from a single global Pool, but each thread
+-- allocates through its own PoolCache (magazines), which is created
+-- on that thread's first allocation, kept in thread local storage,
+-- and returned to the pool when the thread exits.
+
+local function build(cfg)
+  local pool_mod = require("substrate/pool.t")
+  local libc = require("substrate/libc.t")
+  local atomic = require("substrate/atomic.t")
+  local threads = require("osnative/threads.t")
+  local Pool, PoolCache = pool_mod.Pool, pool_mod.PoolCache
+  local alloc = {}
+
+  -- (globals start out zeroed, i.e., unlocked and uninitialized)
+  local pool = global(Pool)
+  local init_lock = global(atomic.SpinLock)
+  local initialized = global(uint32)
+  local cache_key = global(threads.TlsKey)
+
+  local terra release_cache(p: &opaque)
+    var cache = [&PoolCache](p)
+    cache:release()
+    libc.std.free(cache)
+  end
+
+  local terra init_pool()
+    init_lock:lock()
+    if initialized == 0 then
+      pool:init()
+      cache_key = threads.create_tls_key(release_cache)
+      atomic.exchange(&initialized, 1)
+    end
+    init_lock:unlock()
+  end
+
+  -- the calling thread's cache (nil if there's no memory for one)
+  local terra get_cache(): &PoolCache
+    if atomic.load(&initialized) == 0 then init_pool() end
+    var cache = [&PoolCache](cache_key:get())
+    if cache == nil then
+      cache = [&PoolCache](libc.std.malloc(sizeof(PoolCache)))
+      if cache == nil then return nil end
+      cache:init(&pool)
+      cache_key:set(cache)
+    end
+    return cache
+  end
+
+  -- runs body (a function of a &PoolCache) on the calling thread's
+  -- cache, or, if that can't be created, on a temporary cache that
+  -- hands its blocks straight back to the pool
+  local function with_cache(body)
+    return quote
+      var cache = get_cache()
+      var tmp: PoolCache
+      if cache == nil then
+        tmp:init(&pool)
+        cache = &tmp
+      end
+      var ret = [body(cache)]
+      if cache == &tmp then tmp:release() end
+    in
+      ret
+    end
+  end
+
+  local terra pool_alloc(nbytes: uint64, zeroed: bool): &uint8
+    return [with_cache(function(cache)
+      return quote
+        var p: &uint8
+        if zeroed then p = cache:alloc_zeroed(nbytes) else p = cache:alloc(nbytes) end
+      in
+        p
+      end
+    end)]
+  end
+
+  local terra pool_free(ptr: &uint8)
+    [with_cache(function(cache)
+      return quote cache:free(ptr) in true end
+    end)]
+  end
+
+  local terra pool_realloc(ptr: &uint8, nbytes: uint64): &uint8
+    return [with_cache(function(cache)
+      return `cache:realloc(ptr, nbytes)
+    end)]
+  end
+
+  function alloc.ALLOCATE(T, count)
+    count = count or 1
+    return `[&T](pool_alloc(count * sizeof(T), false))
+  end
+
+  function alloc.ALLOCATE_ZEROED(T, count)
+    count = count or 1
+    return `[&T](pool_alloc(count * sizeof(T), true))
+  end
+
+  function alloc.FREE(ptr)
+    return quote pool_free([&uint8](ptr)) end
+  end
+
+  function alloc.REALLOCATE(T, ptr, old_count, new_count)
+    return `[&T](pool_realloc([&uint8](ptr), new_count * sizeof(T)))
+  end
+
+  -- (only includes other threads' allocations as of their last
+  -- exchange with the pool)
+  terra alloc.get_stats(): pool_mod.PoolStats
+    var cache = get_cache()
+    if cache ~= nil then cache:sync_stats() end
+    return pool:get_stats()
+  end
+
+  alloc.pool = pool
+  alloc.get_cache = get_cache
+
+  return alloc
+end
+
+return build
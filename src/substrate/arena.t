@@ -0,0 +1,260 @@
+-- substrate/arena.t
+--
+-- bump/arena allocator: allocations are a pointer bump into large
+-- chunks, and memory is only reclaimed in bulk (:rewind, :reset)
+
+local m = {}
+local lazy = require("./lazyload.t")
+
+local _built = nil
+
+-- note: the arena deliberately does not go through cfg.ALLOCATE/FREE
+-- (it is itself used to provide those); it only takes LOG from cfg
+function m._build(options)
+  if _built then return _built end
+
+  options = options or {}
+  local cfg = options.cfg or require("./cfg.t").configure()
+  local LOG = cfg.LOG
+  local libc = require("./libc.t")
+  local intrinsics = require("./intrinsics.t")
+  local size_t = libc.std.size_t
+
+  local DEFAULT_ALIGNMENT = 16
+  local DEFAULT_CHUNK_SIZE = 1024*1024
+
+  local struct ArenaChunk {
+    next: &ArenaChunk;
+    capacity: size_t;
+    used: size_t;
+  }
+
+  terra ArenaChunk:base(): &uint8
+    return [&uint8](self) + sizeof(ArenaChunk)
+  end
+
+  -- returns nil if the chunk doesn't have enough space left
+  terra ArenaChunk:bump(nbytes: size_t, align: size_t): &uint8
+    var base = [uint64](self:base())
+    var aligned = (base + self.used + align - 1) and not (align - 1)
+    var offset = aligned - base
+    if offset + nbytes > self.capacity then return nil end
+    self.used = offset + nbytes
+    return [&uint8](aligned)
+  end
+
+  local struct ArenaMark {
+    chunk: &ArenaChunk;
+    used: size_t;
+  }
+
+  local struct Arena {
+    head: &ArenaChunk;
+    spare: &ArenaChunk;
+    last_alloc: &uint8;
+    chunk_size: size_t;
+    alignment: size_t;
+    bytes_allocated: size_t;
+    high_water: size_t;
+  }
+
+  terra Arena:init()
+    self.head = nil
+    self.spare = nil
+    self.last_alloc = nil
+    self.chunk_size = DEFAULT_CHUNK_SIZE
+    self.alignment = DEFAULT_ALIGNMENT
+    self.bytes_allocated = 0
+    self.high_water = 0
+  end
+
+  terra Arena:configure(chunk_size: size_t, alignment: size_t)
+    if chunk_size > 0 then self.chunk_size = chunk_size end
+    if alignment > 0 then
+      -- alignment must be a power of two
+      if (alignment and (alignment - 1)) ~= 0 then
+        [LOG("Arena alignment %d is not a power of two!", alignment)]
+        return
+      end
+      self.alignment = alignment
+    end
+  end
+
+  local terra free_chunk_list(chunk: &ArenaChunk)
+    while chunk ~= nil do
+      var next = chunk.next
+      libc.std.free(chunk)
+      chunk = next
+    end
+  end
+
+  terra Arena:release()
+    free_chunk_list(self.head)
+    free_chunk_list(self.spare)
+    var chunk_size, alignment = self.chunk_size, self.alignment
+    self:init()
+    -- zero-initialized arenas (e.g., globals) fall back to defaults
+    self:configure(chunk_size, alignment)
+  end
+
+  terra Arena:_push_chunk(min_capacity: size_t): &ArenaChunk
+    if self.chunk_size == 0 then self.chunk_size = DEFAULT_CHUNK_SIZE end
+    -- try to reuse a spare chunk from a previous reset
+    var prev: &ArenaChunk = nil
+    var cur = self.spare
+    while cur ~= nil do
+      if cur.capacity >= min_capacity then
+        if prev == nil then self.spare = cur.next else prev.next = cur.next end
+        break
+      end
+      prev = cur
+      cur = cur.next
+    end
+    if cur == nil then
+      var capacity = intrinsics.max(self.chunk_size, min_capacity)
+      cur = [&ArenaChunk](libc.std.malloc(sizeof(ArenaChunk) + capacity))
+      if cur == nil then return nil end
+      cur.capacity = capacity
+    end
+    cur.used = 0
+    cur.next = self.head
+    self.head = cur
+    return cur
+  end
+
+  terra Arena:alloc(nbytes: size_t, align: size_t): &uint8
+    if align == 0 then align = self.alignment end
+    if align == 0 then align = DEFAULT_ALIGNMENT end
+    var chunk = self.head
+    var prev_used: size_t = 0
+    var ret: &uint8 = nil
+    if chunk ~= nil then
+      prev_used = chunk.used
+      ret = chunk:bump(nbytes, align)
+    end
+    if ret == nil then
+      chunk = self:_push_chunk(nbytes + align)
+      if chunk == nil then return nil end
+      prev_used = 0
+      ret = chunk:bump(nbytes, align)
+    end
+    self.last_alloc = ret
+    -- (includes alignment padding, so that rewinds balance exactly)
+    self.bytes_allocated = self.bytes_allocated + (chunk.used - prev_used)
+    if self.bytes_allocated > self.high_water then
+      self.high_water = self.bytes_allocated
+    end
+    return ret
+  end
+
+  terra Arena:alloc_zeroed(nbytes: size_t, align: size_t): &uint8
+    var ret = self:alloc(nbytes, align)
+    if ret ~= nil then intrinsics.memset(ret, 0, nbytes) end
+    return ret
+  end
+
+  -- individual frees are no-ops, except that the most recent
+  -- allocation can be popped off the top of the arena
+  terra Arena:free(ptr: &uint8)
+    if ptr == nil or ptr ~= self.last_alloc then return end
+    var chunk = self.head
+    var used = [size_t](ptr - chunk:base())
+    self.bytes_allocated = self.bytes_allocated - (chunk.used - used)
+    chunk.used = used
+    self.last_alloc = nil
+  end
+
+  -- grows/shrinks in place if ptr is the most recent allocation
+  -- and there is room left in its chunk; otherwise copies
+  terra Arena:realloc(ptr: &uint8, old_nbytes: size_t, new_nbytes: size_t, align: size_t): &uint8
+    if ptr ~= nil and ptr == self.last_alloc then
+      var chunk = self.head
+      var offset = [size_t](ptr - chunk:base())
+      if offset + new_nbytes <= chunk.capacity then
+        self.bytes_allocated = self.bytes_allocated - (chunk.used - offset) + new_nbytes
+        if self.bytes_allocated > self.high_water then
+          self.high_water = self.bytes_allocated
+        end
+        chunk.used = offset + new_nbytes
+        return ptr
+      end
+    end
+    var ret = self:alloc(new_nbytes, align)
+    if ret ~= nil and ptr ~= nil then
+      intrinsics.memcpy(ret, ptr, intrinsics.min(old_nbytes, new_nbytes))
+    end
+    return ret
+  end
+
+  terra Arena:mark(): ArenaMark
+    if self.head == nil then
+      return ArenaMark{nil, 0}
+    end
+    return ArenaMark{self.head, self.head.used}
+  end
+
+  -- frees everything allocated since the mark was taken
+  terra Arena:rewind(mark: ArenaMark)
+    while self.head ~= nil and self.head ~= mark.chunk do
+      var chunk = self.head
+      self.bytes_allocated = self.bytes_allocated - chunk.used
+      self.head = chunk.next
+      chunk.next = self.spare
+      self.spare = chunk
+    end
+    if self.head ~= nil then
+      self.bytes_allocated = self.bytes_allocated - (self.head.used - mark.used)
+      self.head.used = mark.used
+    end
+    self.last_alloc = nil
+  end
+
+  -- frees all allocations, but retains chunks for reuse
+  terra Arena:reset()
+    self:rewind(ArenaMark{nil, 0})
+    self.bytes_allocated = 0
+  end
+
+  terra Arena:reserved_bytes(): size_t
+    var total: size_t = 0
+    var chunk = self.head
+    while chunk ~= nil do
+      total = total + chunk.capacity
+      chunk = chunk.next
+    end
+    chunk = self.spare
+    while chunk ~= nil do
+      total = total + chunk.capacity
+      chunk = chunk.next
+    end
+    return total
+  end
+
+  -- runs body and then frees everything it allocated from arena
+  local function SCOPED(arena, body)
+    return quote
+      var _mark = arena:mark()
+      [body]
+      arena:rewind(_mark)
+    end
+  end
+
+  _built = {
+    Arena = Arena,
+    ArenaMark = ArenaMark,
+    SCOPED = SCOPED,
+  }
+  return _built
+end
+
+local lazy_items = {
+  Arena = function() return m._build().Arena end,
+  ArenaMark = function() return m._build().ArenaMark end,
+  arena_scoped = function() return m._build().SCOPED end,
+}
+
+m.exported_names = {
+  "Arena", "ArenaMark", "arena_scoped"
+}
+
+return lazy.lazy_table(m, lazy_items)
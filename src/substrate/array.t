@@ -45,6 +45,7 @@ function m._Array(T, options)
 
   local size_t = cfg.size_t
   local ALLOCATE = cfg.ALLOCATE
+  local REALLOCATE = cfg.REALLOCATE
   local FREE = cfg.FREE
   local ASSERT = cfg.ASSERT
   local LOG = cfg.LOG
@@ -76,26 +77,53 @@ function m._Array(T, options)
     return (self.data ~= nil) and (self.size > 0)
   end
 
+  local move_by_memcpy = derive.is_plain_data(T) or T:ispointer()
+                         or (T.substrate and T.substrate.allow_move_by_memcpy)
+
   if options.allow_growth then
-    terra Array:resize_capacity(new_capacity: size_t)
-      if new_capacity == self.capacity then return end
-      --[LOG("Resizing capacity to %d", `new_capacity)]
-      -- TODO: realloc this?
-      var new_data = [ALLOCATE(T, `new_capacity)]
-      var ncopy = self.size
-      if ncopy > new_capacity then ncopy = new_capacity end
-      if ncopy > 0 then
-        [derive.move_array(`new_data, `self.data, `ncopy)]
-      end
-      if self.size > ncopy then
-        var nrelease = self.size - ncopy
-        [derive.release_array_contents(`self.data + ncopy, `nrelease)]
+    if move_by_memcpy then
+      -- elements can be moved as raw bytes, so let the allocator
+      -- grow the block in place when it can
+      terra Array:resize_capacity(new_capacity: size_t)
+        if new_capacity == self.capacity then return end
+        if self.size > new_capacity then
+          [derive.release_array_contents(`self.data + new_capacity, `self.size - new_capacity)]
+          self.size = new_capacity
+        end
+        if new_capacity == 0 then
+          [FREE(`self.data)]
+          self.data = nil
+        else
+          var new_data = [REALLOCATE(T, `self.data, `self.capacity, `new_capacity)]
+          if new_data == nil then
+            -- (REALLOCATE leaves the old block intact on failure)
+            [LOG("Failed to resize capacity to %d", `new_capacity)]
+            return
+          end
+          self.data = new_data
+        end
+        self.capacity = new_capacity
       end
-      [FREE(`self.data)]
-      self.data = new_data
-      self.capacity = new_capacity
-      if self.size > self.capacity then
-        self.size = self.capacity
+    else
+      terra Array:resize_capacity(new_capacity: size_t)
+        if new_capacity == self.capacity then return end
+        --[LOG("Resizing capacity to %d", `new_capacity)]
+        var new_data = [ALLOCATE(T, `new_capacity)]
+        var ncopy = self.size
+        if ncopy > new_capacity then ncopy = new_capacity end
+        if ncopy > 0 then
+          [derive.move_array(`new_data, `self.data, `ncopy)]
+        end
+        if self.size > ncopy then
+          var nrelease = self.size - ncopy
+          [derive.release_array_contents(`self.data + ncopy, `nrelease)]
+        end
+        [FREE(`self.data)]
+        self.data = new_data
+        self.capacity = new_capacity
+        if self.size > self.capacity then
+          self.size = self.capacity
+        end
       end
     end
 
@@ -276,13 +304,222 @@ m.Vec = terralib.memoize(function(T)
   return m._Array(T, {allow_growth = true, typename = "Vec"})
 end)
 
+-- like a Vec, but the first N elements are stored inline in the
+-- struct itself, and only spill over to the heap past that
+function m._SmallVec(T, N, options)
+  assert(T, "No type provided!")
+  assert(type(N) == "number" and N > 0, "SmallVec needs an inline count > 0")
+  options = options or {}
+  local cfg = options.cfg or require("./cfg.t").configure()
+  local derive = require("./derive.t")
+  local intrinsics = require("./intrinsics.t")
+
+  local size_t = cfg.size_t
+  local ALLOCATE = cfg.ALLOCATE
+  local REALLOCATE = cfg.REALLOCATE
+  local FREE = cfg.FREE
+  local ASSERT = cfg.ASSERT
+  local LOG = cfg.LOG
+
+  local Slice = options.slice_t or m.Slice(T)
+  local ByteSlice = m.Slice(uint8)
+
+  local is_pod_or_pointer = derive.is_plain_data(T) or T:ispointer()
+  local move_by_memcpy = is_pod_or_pointer
+                         or (T.substrate and T.substrate.allow_move_by_memcpy)
+
+  -- note: there is deliberately no data pointer into storage,
+  -- so that the SmallVec itself stays movable by memcpy
+  local struct SmallVec {
+    size: size_t;
+    capacity: size_t;
+    heap: &T;
+    storage: T[N];
+  }
+
+  terra SmallVec:init()
+    self.size = 0
+    self.capacity = N
+    self.heap = nil
+  end
+
+  terra SmallVec:get_data(): &T
+    if self.heap ~= nil then return self.heap end
+    return &(self.storage[0])
+  end
+
+  terra SmallVec:is_inline(): bool
+    return self.heap == nil
+  end
+
+  terra SmallVec:release()
+    var data = self:get_data()
+    [derive.release_array_contents(`data, `self.size)]
+    if self.heap ~= nil then
+      [FREE(`self.heap)]
+    end
+    self:init()
+  end
+
+  terra SmallVec:has_content(): bool
+    return self.size > 0
+  end
+
+  terra SmallVec:fit_capacity(needed_capacity: size_t)
+    if needed_capacity <= self.capacity then return end
+    var newcap = self.capacity * 2
+    while newcap < needed_capacity do
+      newcap = newcap * 2
+    end
+    escape
+      if move_by_memcpy then
+        emit(quote
+          if self.heap ~= nil then
+            var new_heap = [REALLOCATE(T, `self.heap, `self.capacity, `newcap)]
+            if new_heap == nil then
+              [LOG("Failed to grow capacity to %d", `newcap)]
+              return
+            end
+            self.heap = new_heap
+            self.capacity = newcap
+            return
+          end
+        end)
+      end
+    end
+    var new_data = [ALLOCATE(T, `newcap)]
+    if new_data == nil then
+      [LOG("Failed to grow capacity to %d", `newcap)]
+      return
+    end
+    if self.size > 0 then
+      var data = self:get_data()
+      [derive.move_array(`new_data, `data, `self.size)]
+    end
+    if self.heap ~= nil then
+      [FREE(`self.heap)]
+    end
+    self.heap = new_data
+    self.capacity = newcap
+  end
+
+  terra SmallVec:resize(newsize: size_t)
+    self:fit_capacity(newsize)
+    var data = self:get_data()
+    if newsize < self.size then
+      [derive.release_array_contents(`data + newsize, `self.size - newsize)]
+    elseif newsize > self.size then
+      [derive.init_array_contents(`data + self.size, `newsize - self.size)]
+    end
+    self.size = newsize
+  end
+
+  terra SmallVec:clear()
+    self:resize(0)
+  end
+
+  terra SmallVec:as_bytes(): ByteSlice
+    return ByteSlice{data = [&uint8](self:get_data()), size = self.size*sizeof(T)}
+  end
+
+  terra SmallVec:size_bytes(): size_t
+    return self.size * sizeof(T)
+  end
+
+  terra SmallVec:slice(start: size_t, stop: size_t): Slice
+    [ASSERT(`start <= self.size and stop <= self.size, "OOB slice!")]
+    [ASSERT(`stop >= start, "slice stop must come after start!")]
+    return Slice{data = self:get_data()+start, size = stop - start}
+  end
+
+  terra SmallVec:as_slice(): Slice
+    return Slice{data = self:get_data(), size = self.size}
+  end
+
+  terra SmallVec:push_new(): &T
+    self:fit_capacity(self.size + 1)
+    var ret: &T = self:get_data() + self.size
+    self.size = self.size + 1
+    [derive.init_array_contents(`ret, 1)]
+    return ret
+  end
+
+  terra SmallVec:get_ref(idx: size_t): &T
+    [ASSERT(`idx >= 0 and idx < self.size, "OOB array access!")]
+    return self:get_data() + idx
+  end
+
+  local is_copyable = is_pod_or_pointer or (T.methods and T.methods.copy)
+
+  if is_copyable then
+    terra SmallVec:copy_raw(src: &T, count: size_t)
+      self:clear()
+      self:fit_capacity(count)
+      var data = self:get_data()
+      escape
+        if not is_pod_or_pointer then
+          emit(derive.init_array_contents(`data, `count))
+        end
+      end
+      [derive.copy_array(`data, `src, `count)]
+      self.size = count
+    end
+
+    terra SmallVec:copy(rhs: &SmallVec)
+      self:copy_raw(rhs:get_data(), rhs.size)
+    end
+
+    terra SmallVec:copy_slice(rhs: Slice)
+      self:copy_raw(rhs.data, rhs.size)
+    end
+  end
+
+  if is_pod_or_pointer then
+    terra SmallVec:push_val(val: T)
+      self:fit_capacity(self.size + 1)
+      self:get_data()[self.size] = val
+      self.size = self.size + 1
+    end
+
+    terra SmallVec:get_val(idx: size_t): T
+      [ASSERT(`idx >= 0 and idx < self.size, "OOB array access!")]
+      return self:get_data()[idx]
+    end
+
+    terra SmallVec:push_bytes(bytes: &uint8, len: size_t)
+      [ASSERT(`len % sizeof(T) == 0, "len of pushed bytes is not a multiple of object type!")]
+      var nitems: size_t = len / sizeof(T)
+      self:fit_capacity(self.size + nitems)
+      intrinsics.memcpy(
+        [&uint8](self:get_data() + self.size),
+        bytes,
+        nitems * sizeof(T)
+      )
+      self.size = self.size + nitems
+    end
+  end
+
+  SmallVec.substrate = {
+    allow_move_by_memcpy = move_by_memcpy
+  }
+
+  util.set_template_name(SmallVec, options.typename or "SmallVec", T, N)
+
+  return SmallVec
+end
+
+m.SmallVec = terralib.memoize(function(T, N)
+  return m._SmallVec(T, N, {typename = "SmallVec"})
+end)
+
 local lazy_items = {
   ByteArray = function() return m.Array(uint8) end,
   ByteSlice = function() return m.Slice(uint8) end,
 }
 
 m.exported_names = {
-  "Vec", "Array", "Slice", "_Array", "_Slice", "ByteArray", "ByteSlice"
+  "Vec", "Array", "Slice", "SmallVec", "_Array", "_Slice", "_SmallVec",
+  "ByteArray", "ByteSlice"
 }
 
 return lazy.lazy_table(m, lazy_items)
\ No newline at end of file
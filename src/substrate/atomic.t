@@ -0,0 +1,89 @@
+-- substrate/atomic.t
+--
+-- thin wrappers around terra's atomics, and a basic spinlock
+
+local m = {}
+local lazy = require("./lazyload.t")
+
+-- (values are cast to the pointed-to type, since atomicrmw
+--  requires an exact type match)
+local function target_type(addr)
+  local T = addr:gettype()
+  assert(T:ispointer(), "atomic operations require a pointer!")
+  return T.type
+end
+
+m.fetch_add = macro(function(addr, val)
+  local T = target_type(addr)
+  return `terralib.atomicrmw("add", addr, [T](val), {ordering = "seq_cst"})
+end)
+
+m.fetch_sub = macro(function(addr, val)
+  local T = target_type(addr)
+  return `terralib.atomicrmw("sub", addr, [T](val), {ordering = "seq_cst"})
+end)
+
+m.exchange = macro(function(addr, val)
+  local T = target_type(addr)
+  return `terralib.atomicrmw("xchg", addr, [T](val), {ordering = "seq_cst"})
+end)
+
+m.load = macro(function(addr)
+  local T = target_type(addr)
+  return `terralib.atomicrmw("add", addr, [T](0), {ordering = "seq_cst"})
+end)
+
+-- returns true if *addr was expected (and has been replaced by desired)
+m.compare_exchange = macro(function(addr, expected, desired)
+  local T = target_type(addr)
+  return quote
+    var res = terralib.cmpxchg(addr, [T](expected), [T](desired), {
+      success_ordering = "seq_cst", failure_ordering = "seq_cst"
+    })
+  in
+    res._1
+  end
+end)
+
+m.fence = macro(function()
+  return quote terralib.fence({ordering = "seq_cst"}) end
+end)
+
+local _built = nil
+function m._build()
+  if _built then return _built end
+
+  local struct SpinLock {
+    locked: uint32;
+  }
+
+  terra SpinLock:init()
+    self.locked = 0
+  end
+
+  terra SpinLock:try_lock(): bool
+    return m.exchange(&self.locked, 1) == 0
+  end
+
+  terra SpinLock:lock()
+    while m.exchange(&self.locked, 1) ~= 0 do
+      -- wait until the lock looks free before retrying the exchange
+      while m.load(&self.locked) ~= 0 do end
+    end
+  end
+
+  terra SpinLock:unlock()
+    m.exchange(&self.locked, 0)
+  end
+
+  _built = {SpinLock = SpinLock}
+  return _built
+end
+
+local lazy_items = {
+  SpinLock = function() return m._build().SpinLock end,
+}
+
+m.exported_names = {"SpinLock"}
+
+return lazy.lazy_table(m, lazy_items)
@@ -20,6 +20,29 @@ local function _make_assert()
   end
 end
 
+-- generic REALLOCATE for allocators that don't provide one;
+-- like all REALLOCATEs, only valid for memcpy-movable types
+-- (as with realloc, if the allocation fails the old block is left
+-- intact and nil is returned)
+local function _make_reallocate(cfg)
+  local intrinsics = require("./intrinsics.t")
+  local ALLOCATE, FREE = cfg.ALLOCATE, cfg.FREE
+  return function(T, ptr, old_count, new_count)
+    return quote
+      var _old: &T = ptr
+      var _old_count, _new_count = old_count, new_count
+      var _new = [ALLOCATE(T, `_new_count)]
+      if _old ~= nil and _new ~= nil then
+        var _ncopy = intrinsics.min(_old_count, _new_count)
+        intrinsics.memcpy([&uint8](_new), [&uint8](_old), _ncopy * sizeof(T))
+        [FREE(`_old)]
+      end
+    in
+      _new
+    end
+  end
+end
+
 local function _fill_defaults(cfg)
   if not cfg.ASSERT then
     if cfg.no_asserts then
@@ -51,6 +74,11 @@ local function _fill_defaults(cfg)
     cfg.ALLOCATE = assert(allocator.ALLOCATE, "allocator module has no ALLOCATE!")
     cfg.ALLOCATE_ZEROED = assert(allocator.ALLOCATE_ZEROED, "allocator module has no ALLOCATE_ZEROED!")
     cfg.FREE = assert(allocator.FREE, "allocator module has no FREE!")
+    cfg.REALLOCATE = allocator.REALLOCATE
+  end
+
+  if not cfg.REALLOCATE then
+    cfg.REALLOCATE = _make_reallocate(cfg)
   end
 end
 
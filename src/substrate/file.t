@@ -91,8 +91,7 @@ function m._build(options)
       [LOG("Buffer too small: %d < %d", `targetsize, nread)]
       return 0
     end
-    libc.io.fread(target, 1, nread, self.file)
-    return nread
+    return libc.io.fread(target, 1, nread, self.file)
   end
 
   terra File:read_into(target: &ByteArray, pos: size_t, len: size_t): bool
@@ -0,0 +1,410 @@
+-- substrate/hashmap.t
+--
+-- open addressing (Robin Hood / linear probing) hash maps and sets
+--
+-- Entries in a probe run are kept ordered by their ideal slot, so
+-- lookups can stop as soon as they pass an entry that is closer to
+-- home than the probe itself, and removals backward-shift instead
+-- of leaving tombstones.
+
+local m = {}
+local util = require("./util.t")
+
+local INITIAL_CAPACITY = 16
+local MAX_PROBE = 255 -- probe distances are stored as uint8
+local HASH_SEED = 0x5ab57a7e
+
+-- default hash: K:hash() if present, slice contents for arrays and
+-- strings, and raw bytes for plain data. Note that raw bytes include
+-- any padding in a struct, so padded keys need to be zeroed before
+-- their fields are set (or given :hash and :equals methods).
+function m.default_hash(K)
+  local murmur = require("procgen/murmur.t")
+  local derive = require("./derive.t")
+  if K.methods and K.methods.hash then
+    return function(key) return `key:hash() end
+  elseif K.methods and K.methods.as_slice then
+    return function(key)
+      return quote
+        var slice = key:as_slice()
+        var h = murmur.murmur_128(slice:as_u8(), slice:size_bytes(), HASH_SEED)
+      in
+        h.u64[0]
+      end
+    end
+  end
+  assert(derive.is_plain_data(K) or K:ispointer(),
+    "Don't know how to hash " .. tostring(K) .. ": add a :hash method")
+  return function(key)
+    return quote
+      var h = murmur.murmur_128([&uint8](key), sizeof(K), HASH_SEED)
+    in
+      h.u64[0]
+    end
+  end
+end
+
+-- default equality: K:equals(&K) if present, slice contents for
+-- arrays and strings, == for primitives/pointers, and bytes otherwise
+-- (including padding, as for the hash)
+function m.default_equals(K)
+  local derive = require("./derive.t")
+  local libc = require("./libc.t")
+  if K.methods and K.methods.equals then
+    return function(a, b) return `a:equals(b) end
+  elseif K.methods and K.methods.as_slice then
+    return function(a, b)
+      return quote
+        var sa, sb = a:as_slice(), b:as_slice()
+      in
+        sa.size == sb.size and
+          libc.string.memcmp(sa.data, sb.data, sa:size_bytes()) == 0
+      end
+    end
+  elseif K:isprimitive() or K:ispointer() then
+    return function(a, b) return `@a == @b end
+  end
+  assert(derive.is_plain_data(K),
+    "Don't know how to compare " .. tostring(K) .. ": add an :equals method")
+  return function(a, b)
+    return `libc.string.memcmp(a, b, sizeof(K)) == 0
+  end
+end
+
+-- (derive.copy doesn't handle pointers)
+local function copy_entry_part(T, dest, src)
+  local derive = require("./derive.t")
+  if derive.is_plain_data(T) or T:ispointer() then
+    return quote @dest = @src end
+  end
+  return derive.copy(dest, src)
+end
+
+local function is_movable(T)
+  local derive = require("./derive.t")
+  return derive.is_plain_data(T) or T:ispointer()
+    or (T.substrate and T.substrate.allow_move_by_memcpy)
+end
+
+-- V == nil builds a set
+function m._HashTable(K, V, options)
+  assert(K, "No key type provided!")
+  options = options or {}
+  local cfg = options.cfg or require("./cfg.t").configure()
+  local derive = require("./derive.t")
+
+  local size_t = cfg.size_t
+  local ALLOCATE = cfg.ALLOCATE
+  local ALLOCATE_ZEROED = cfg.ALLOCATE_ZEROED
+  local FREE = cfg.FREE
+  local ASSERT = cfg.ASSERT
+
+  local HASH = (options.hash or m.default_hash)(K)
+  local EQUALS = (options.equals or m.default_equals)(K)
+
+  -- entries are shuffled around by plain struct assignment
+  assert(is_movable(K), "HashTable keys must be movable by memcpy: " .. tostring(K))
+  assert((not V) or is_movable(V), "HashTable values must be movable by memcpy: " .. tostring(V))
+
+  local struct Entry {
+    key: K;
+  }
+  if V then
+    Entry.entries:insert({field = "val", type = V})
+  end
+
+  local struct HashTable {
+    size: size_t;
+    capacity: size_t;
+    -- per slot: 0 if empty, else (probe distance + 1)
+    meta: &uint8;
+    entries: &Entry;
+  }
+  derive.derive_init(HashTable)
+
+  local terra hash_key(key: &K): uint64
+    return [HASH(key)]
+  end
+
+  local terra keys_equal(a: &K, b: &K): bool
+    return [EQUALS(a, b)]
+  end
+
+  terra HashTable:_release_entry(idx: size_t)
+    var entry = &self.entries[idx]
+    [derive.release_array_contents(`&entry.key, 1)]
+    escape
+      if V then
+        emit(derive.release_array_contents(`&entry.val, 1))
+      end
+    end
+  end
+
+  -- releases all entries, but keeps the allocated capacity
+  terra HashTable:clear()
+    for idx = 0, self.capacity do
+      if self.meta[idx] ~= 0 then
+        self:_release_entry(idx)
+        self.meta[idx] = 0
+      end
+    end
+    self.size = 0
+  end
+
+  terra HashTable:release()
+    if self.meta ~= nil then
+      self:clear()
+      [FREE(`self.meta)]
+      [FREE(`self.entries)]
+    end
+    self:init()
+  end
+
+  -- returns slot index of key, or -1 if not present
+  terra HashTable:_find(key: &K): int64
+    if self.size == 0 then return -1 end
+    var mask = self.capacity - 1
+    var idx = hash_key(key) and mask
+    var dist: uint32 = 0
+    while true do
+      var meta = self.meta[idx]
+      if meta == 0 or [uint32](meta) - 1 < dist then return -1 end
+      if keys_equal(&self.entries[idx].key, key) then return idx end
+      idx = (idx + 1) and mask
+      dist = dist + 1
+    end
+  end
+
+  -- claims a slot for a new entry with hash h, shifting the rest of the
+  -- probe run forward by one; returns -1 if probe distances would
+  -- overflow (the caller should grow and retry)
+  terra HashTable:_claim_slot(h: uint64): int64
+    var mask = self.capacity - 1
+    var idx = h and mask
+    var dist: uint32 = 0
+    while true do
+      if dist + 1 >= MAX_PROBE then return -1 end
+      var meta = self.meta[idx]
+      if meta == 0 then
+        self.meta[idx] = dist + 1
+        return idx
+      end
+      if [uint32](meta) - 1 < dist then break end
+      idx = (idx + 1) and mask
+      dist = dist + 1
+    end
+    -- find the end of the run, checking that nothing overflows
+    var last = idx
+    while self.meta[last] ~= 0 do
+      if self.meta[last] + 1 >= MAX_PROBE then return -1 end
+      last = (last + 1) and mask
+    end
+    while last ~= idx do
+      var prev = (last - 1) and mask
+      self.entries[last] = self.entries[prev]
+      self.meta[last] = self.meta[prev] + 1
+      last = prev
+    end
+    self.meta[idx] = dist + 1
+    return idx
+  end
+
+  terra HashTable:_rehash(new_capacity: size_t)
+    var old_meta, old_entries, old_capacity = self.meta, self.entries, self.capacity
+    while true do
+      self.meta = [ALLOCATE_ZEROED(uint8, `new_capacity)]
+      self.entries = [ALLOCATE(Entry, `new_capacity)]
+      self.capacity = new_capacity
+      var ok = true
+      for idx = 0, old_capacity do
+        if old_meta[idx] ~= 0 then
+          var slot = self:_claim_slot(hash_key(&old_entries[idx].key))
+          if slot < 0 then ok = false; break end
+          self.entries[slot] = old_entries[idx]
+        end
+      end
+      if ok then break end
+      -- (only possible with a very poor hash function)
+      [FREE(`self.meta)]
+      [FREE(`self.entries)]
+      new_capacity = new_capacity * 2
+    end
+    if old_meta ~= nil then
+      [FREE(`old_meta)]
+      [FREE(`old_entries)]
+    end
+  end
+
+  -- makes room for at least n entries without rehashing
+  terra HashTable:reserve(n: size_t)
+    var cap = self.capacity
+    if cap == 0 then cap = INITIAL_CAPACITY end
+    -- max load factor of 7/8
+    while n * 8 > cap * 7 do cap = cap * 2 end
+    if cap ~= self.capacity then self:_rehash(cap) end
+  end
+
+  -- returns (slot index, true if newly inserted); new keys are copied
+  -- in, but new values are only initialized
+  terra HashTable:_insert(key: &K): {size_t, bool}
+    var existing = self:_find(key)
+    if existing >= 0 then return existing, false end
+    self:reserve(self.size + 1)
+    var h = hash_key(key)
+    var slot = self:_claim_slot(h)
+    while slot < 0 do
+      self:_rehash(self.capacity * 2)
+      slot = self:_claim_slot(h)
+    end
+    var entry = &self.entries[slot]
+    [derive.init_array_contents(`&entry.key, 1)]
+    [copy_entry_part(K, `&entry.key, key)]
+    escape
+      if V then
+        emit(derive.init_array_contents(`&entry.val, 1))
+      end
+    end
+    self.size = self.size + 1
+    return slot, true
+  end
+
+  terra HashTable:contains(key: &K): bool
+    return self:_find(key) >= 0
+  end
+
+  terra HashTable:remove(key: &K): bool
+    var idx = self:_find(key)
+    if idx < 0 then return false end
+    self:_release_entry(idx)
+    -- backward shift the rest of the run
+    var mask = self.capacity - 1
+    var cur: size_t = idx
+    var next = (cur + 1) and mask
+    while self.meta[next] > 1 do
+      self.entries[cur] = self.entries[next]
+      self.meta[cur] = self.meta[next] - 1
+      cur = next
+      next = (next + 1) and mask
+    end
+    self.meta[cur] = 0
+    self.size = self.size - 1
+    return true
+  end
+
+  -- iteration: for (idx = t:next_slot(0); idx < t.capacity; idx = t:next_slot(idx+1))
+  terra HashTable:next_slot(idx: size_t): size_t
+    while idx < self.capacity and self.meta[idx] == 0 do
+      idx = idx + 1
+    end
+    return idx
+  end
+
+  terra HashTable:key_at(idx: size_t): &K
+    [ASSERT(`idx < self.capacity and self.meta[idx] ~= 0, "Empty hash slot!")]
+    return &self.entries[idx].key
+  end
+
+  if V then
+    -- returns nil if key is not present
+    terra HashTable:find(key: &K): &V
+      var idx = self:_find(key)
+      if idx < 0 then return nil end
+      return &self.entries[idx].val
+    end
+
+    -- returns the value for key, inserting an initialized one if needed
+    terra HashTable:get_or_insert(key: &K): &V
+      var idx, _ = self:_insert(key)
+      return &self.entries[idx].val
+    end
+
+    terra HashTable:val_at(idx: size_t): &V
+      [ASSERT(`idx < self.capacity and self.meta[idx] ~= 0, "Empty hash slot!")]
+      return &self.entries[idx].val
+    end
+
+    if derive.is_plain_data(V) or V:ispointer() or (V.methods and V.methods.copy) then
+      terra HashTable:put(key: &K, val: &V)
+        var dest = self:get_or_insert(key)
+        [copy_entry_part(V, dest, val)]
+      end
+    end
+  else
+    -- returns true if key was newly added
+    terra HashTable:insert(key: &K): bool
+      var _, inserted = self:_insert(key)
+      return inserted
+    end
+  end
+
+  -- by-value versions for plain keys
+  if derive.is_plain_data(K) or K:ispointer() then
+    terra HashTable:contains_val(key: K): bool
+      return self:contains(&key)
+    end
+
+    terra HashTable:remove_val(key: K): bool
+      return self:remove(&key)
+    end
+
+    if V then
+      terra HashTable:find_val(key: K): &V
+        return self:find(&key)
+      end
+
+      terra HashTable:get_or_insert_val(key: K): &V
+        return self:get_or_insert(&key)
+      end
+
+      if derive.is_plain_data(V) or V:ispointer() then
+        terra HashTable:put_val(key: K, val: V)
+          @(self:get_or_insert(&key)) = val
+        end
+      end
+    else
+      terra HashTable:insert_val(key: K): bool
+        return self:insert(&key)
+      end
+    end
+  end
+
+  terra HashTable:copy(rhs: &HashTable)
+    self:clear()
+    self:reserve(rhs.size)
+    var idx = rhs:next_slot(0)
+    while idx < rhs.capacity do
+      var slot, _ = self:_insert(&rhs.entries[idx].key)
+      escape
+        if V then
+          emit(copy_entry_part(V, `&self.entries[slot].val, `&rhs.entries[idx].val))
+        end
+      end
+      idx = rhs:next_slot(idx + 1)
+    end
+  end
+
+  HashTable.substrate = {
+    allow_move_by_memcpy = true
+  }
+
+  if V then
+    util.set_template_name(HashTable, options.typename or "HashMap", K, V)
+  else
+    util.set_template_name(HashTable, options.typename or "HashSet", K)
+  end
+
+  return HashTable
+end
+
+m.HashMap = terralib.memoize(function(K, V)
+  assert(V, "HashMap needs a value type!")
+  return m._HashTable(K, V, {typename = "HashMap"})
+end)
+
+m.HashSet = terralib.memoize(function(K)
+  return m._HashTable(K, nil, {typename = "HashSet"})
+end)
+
+m.exported_names = {"HashMap", "HashSet", "_HashTable"}
+
+return m
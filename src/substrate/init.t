@@ -20,6 +20,10 @@ add_exports("./array.t")
 add_exports("./box.t")
 add_exports("./string.t")
 add_exports("./file.t")
+add_exports("./arena.t")
+add_exports("./pool.t")
+add_exports("./atomic.t")
+add_exports("./hashmap.t")
 add_namespace("./libc.t", "libc")
 add_namespace("./intrinsics.t", "intrinsics")
 add_namespace("./derive.t", "derive")
@@ -0,0 +1,400 @@
+-- substrate/pool.t
+--
+-- size-class pool allocator: small allocations are rounded up to one
+-- of a fixed set of size classes and served from per-class free lists
+-- carved out of larger slabs; large allocations fall through to libc.
+--
+-- A Pool is shared, and guarded by a spinlock. Each thread should
+-- allocate through its own PoolCache, which keeps a small 'magazine'
+-- of free blocks per size class and only touches the shared Pool to
+-- exchange blocks in batches.
+
+local m = {}
+local lazy = require("./lazyload.t")
+
+local MIN_SIZE = 16
+local MAX_SIZE = 32768
+local HEADER_SIZE = 16
+local SLAB_BYTES = 65536
+local MIN_SLAB_BLOCKS = 8
+local MAGAZINE_SIZE = 32
+
+-- 16 byte steps up to 128, then four classes per doubling
+function m.make_size_classes(max_size)
+  local classes = {}
+  for size = MIN_SIZE, 128, MIN_SIZE do
+    table.insert(classes, size)
+  end
+  local base = 128
+  while base < max_size do
+    local step = base / 4
+    for i = 1, 4 do
+      table.insert(classes, base + i*step)
+    end
+    base = base * 2
+  end
+  return classes
+end
+
+local _built = nil
+
+-- note: like the arena, the pool only depends on libc, since
+-- it is itself used to provide cfg.ALLOCATE/FREE
+function m._build()
+  if _built then return _built end
+
+  local libc = require("./libc.t")
+  local intrinsics = require("./intrinsics.t")
+  local atomic = require("./atomic.t")
+  local SpinLock = atomic.SpinLock
+  local size_t = libc.std.size_t
+
+  local CLASS_SIZES = m.make_size_classes(MAX_SIZE)
+  local NCLASSES = #CLASS_SIZES
+  local LARGE_CLASS = 0xFFFFFFFF
+
+  -- lookup from ceil(size / MIN_SIZE) to size class
+  local lut = {}
+  local cur_class = 0
+  for idx = 0, MAX_SIZE / MIN_SIZE do
+    while CLASS_SIZES[cur_class+1] < idx * MIN_SIZE do
+      cur_class = cur_class + 1
+    end
+    lut[idx+1] = cur_class
+  end
+  local class_lut = terralib.constant(uint8[#lut], lut)
+
+  local block_sizes, slab_blocks = {}, {}
+  for idx, size in ipairs(CLASS_SIZES) do
+    block_sizes[idx] = size + HEADER_SIZE
+    slab_blocks[idx] = math.max(MIN_SLAB_BLOCKS,
+                                math.floor(SLAB_BYTES / block_sizes[idx]))
+  end
+  local class_block_sizes = terralib.constant(size_t[NCLASSES], block_sizes)
+  local class_slab_blocks = terralib.constant(size_t[NCLASSES], slab_blocks)
+
+  -- precedes every allocation
+  local struct PoolHeader {
+    size: size_t;
+    class: uint32;
+    _pad: uint32;
+  }
+  assert(terralib.sizeof(PoolHeader) == HEADER_SIZE)
+
+  local struct FreeBlock {
+    next: &FreeBlock;
+  }
+
+  local struct Slab {
+    next: &Slab;
+    nbytes: size_t;
+  }
+  assert(terralib.sizeof(Slab) % MIN_SIZE == 0)
+
+  local struct PoolClass {
+    free: &FreeBlock;
+    nfree: size_t;
+    ncarved: size_t;
+  }
+
+  local struct PoolStats {
+    bytes_requested: int64;
+    bytes_in_use: int64;
+    bytes_reserved: int64;
+    high_water: int64;
+    large_allocations: int64;
+    -- fraction of reserved memory not holding requested bytes
+    fragmentation: double;
+    -- fraction of in-use blocks lost to size class rounding
+    internal_fragmentation: double;
+  }
+
+  local struct Pool {
+    lock: SpinLock;
+    classes: PoolClass[NCLASSES];
+    slabs: &Slab;
+    bytes_requested: int64;
+    bytes_in_use: int64;
+    bytes_reserved: int64;
+    high_water: int64;
+    large_allocations: int64;
+  }
+
+  terra Pool:init()
+    self.lock:init()
+    for idx = 0, NCLASSES do
+      self.classes[idx].free = nil
+      self.classes[idx].nfree = 0
+      self.classes[idx].ncarved = 0
+    end
+    self.slabs = nil
+    self.bytes_requested = 0
+    self.bytes_in_use = 0
+    self.bytes_reserved = 0
+    self.high_water = 0
+    self.large_allocations = 0
+  end
+
+  -- frees all slabs: any outstanding small allocations become invalid
+  terra Pool:release()
+    var slab = self.slabs
+    while slab ~= nil do
+      var next = slab.next
+      libc.std.free(slab)
+      slab = next
+    end
+    self:init()
+  end
+
+  -- (assumes lock is held)
+  terra Pool:_carve_slab(class: uint32): bool
+    var block_size = class_block_sizes[class]
+    var nblocks = class_slab_blocks[class]
+    var nbytes = sizeof(Slab) + block_size * nblocks
+    var slab = [&Slab](libc.std.malloc(nbytes))
+    if slab == nil then return false end
+    slab.next = self.slabs
+    slab.nbytes = nbytes
+    self.slabs = slab
+    self.bytes_reserved = self.bytes_reserved + [int64](nbytes)
+    var pc = &self.classes[class]
+    var base = [&uint8](slab) + sizeof(Slab)
+    for idx = 0, nblocks do
+      var block = [&FreeBlock](base + idx*block_size)
+      block.next = pc.free
+      pc.free = block
+    end
+    pc.nfree = pc.nfree + nblocks
+    pc.ncarved = pc.ncarved + nblocks
+    return true
+  end
+
+  -- (assumes lock is held)
+  terra Pool:_apply_deltas(requested: int64, in_use: int64, reserved: int64, nlarge: int64)
+    self.bytes_requested = self.bytes_requested + requested
+    self.bytes_in_use = self.bytes_in_use + in_use
+    self.bytes_reserved = self.bytes_reserved + reserved
+    self.large_allocations = self.large_allocations + nlarge
+    if self.bytes_in_use > self.high_water then
+      self.high_water = self.bytes_in_use
+    end
+  end
+
+  terra Pool:get_stats(): PoolStats
+    self.lock:lock()
+    var ret = PoolStats{
+      bytes_requested = self.bytes_requested,
+      bytes_in_use = self.bytes_in_use,
+      bytes_reserved = self.bytes_reserved,
+      high_water = self.high_water,
+      large_allocations = self.large_allocations,
+      fragmentation = 0.0,
+      internal_fragmentation = 0.0
+    }
+    self.lock:unlock()
+    if ret.bytes_reserved > 0 then
+      ret.fragmentation = 1.0 - [double](ret.bytes_requested) / [double](ret.bytes_reserved)
+    end
+    if ret.bytes_in_use > 0 then
+      ret.internal_fragmentation = 1.0 - [double](ret.bytes_requested) / [double](ret.bytes_in_use)
+    end
+    return ret
+  end
+
+  local struct Magazine {
+    count: uint32;
+    items: (&FreeBlock)[MAGAZINE_SIZE];
+  }
+
+  -- stats are accumulated locally and only pushed to the
+  -- pool when blocks are exchanged (or on :sync_stats), so
+  -- pool-level stats lag by at most a magazine's worth
+  local struct PoolCache {
+    pool: &Pool;
+    mags: Magazine[NCLASSES];
+    d_requested: int64;
+    d_in_use: int64;
+    d_reserved: int64;
+    d_large: int64;
+  }
+
+  terra PoolCache:init(pool: &Pool)
+    self.pool = pool
+    for idx = 0, NCLASSES do
+      self.mags[idx].count = 0
+    end
+    self.d_requested = 0
+    self.d_in_use = 0
+    self.d_reserved = 0
+    self.d_large = 0
+  end
+
+  -- (assumes pool lock is held)
+  terra PoolCache:_push_deltas()
+    self.pool:_apply_deltas(self.d_requested, self.d_in_use, self.d_reserved, self.d_large)
+    self.d_requested = 0
+    self.d_in_use = 0
+    self.d_reserved = 0
+    self.d_large = 0
+  end
+
+  terra PoolCache:sync_stats()
+    self.pool.lock:lock()
+    self:_push_deltas()
+    self.pool.lock:unlock()
+  end
+
+  terra PoolCache:_refill(class: uint32)
+    var mag = &self.mags[class]
+    var pool = self.pool
+    pool.lock:lock()
+    var pc = &pool.classes[class]
+    if pc.nfree == 0 then pool:_carve_slab(class) end
+    while mag.count < MAGAZINE_SIZE / 2 and pc.free ~= nil do
+      mag.items[mag.count] = pc.free
+      mag.count = mag.count + 1
+      pc.free = pc.free.next
+      pc.nfree = pc.nfree - 1
+    end
+    self:_push_deltas()
+    pool.lock:unlock()
+  end
+
+  terra PoolCache:_flush(class: uint32, count: uint32)
+    var mag = &self.mags[class]
+    var pool = self.pool
+    pool.lock:lock()
+    var pc = &pool.classes[class]
+    while count > 0 and mag.count > 0 do
+      mag.count = mag.count - 1
+      var block = mag.items[mag.count]
+      block.next = pc.free
+      pc.free = block
+      pc.nfree = pc.nfree + 1
+      count = count - 1
+    end
+    self:_push_deltas()
+    pool.lock:unlock()
+  end
+
+  -- returns all cached blocks to the pool (call before a thread exits)
+  terra PoolCache:release()
+    if self.pool == nil then return end
+    for class = 0, NCLASSES do
+      self:_flush(class, MAGAZINE_SIZE)
+    end
+  end
+
+  terra PoolCache:alloc(nbytes: size_t): &uint8
+    if nbytes > MAX_SIZE then
+      var total = nbytes + HEADER_SIZE
+      var header = [&PoolHeader](libc.std.malloc(total))
+      if header == nil then return nil end
+      header.size = nbytes
+      header.class = LARGE_CLASS
+      self.d_requested = self.d_requested + [int64](nbytes)
+      self.d_in_use = self.d_in_use + [int64](total)
+      self.d_reserved = self.d_reserved + [int64](total)
+      self.d_large = self.d_large + 1
+      return [&uint8](header) + HEADER_SIZE
+    end
+    var class: uint32 = class_lut[(nbytes + (MIN_SIZE-1)) / MIN_SIZE]
+    var mag = &self.mags[class]
+    if mag.count == 0 then
+      self:_refill(class)
+      if mag.count == 0 then return nil end
+    end
+    mag.count = mag.count - 1
+    var header = [&PoolHeader](mag.items[mag.count])
+    header.size = nbytes
+    header.class = class
+    self.d_requested = self.d_requested + [int64](nbytes)
+    self.d_in_use = self.d_in_use + [int64](class_block_sizes[class])
+    return [&uint8](header) + HEADER_SIZE
+  end
+
+  terra PoolCache:alloc_zeroed(nbytes: size_t): &uint8
+    var ret = self:alloc(nbytes)
+    if ret ~= nil then intrinsics.memset(ret, 0, nbytes) end
+    return ret
+  end
+
+  terra PoolCache:free(ptr: &uint8)
+    if ptr == nil then return end
+    var header = [&PoolHeader](ptr - HEADER_SIZE)
+    self.d_requested = self.d_requested - [int64](header.size)
+    if header.class == LARGE_CLASS then
+      var total = header.size + HEADER_SIZE
+      self.d_in_use = self.d_in_use - [int64](total)
+      self.d_reserved = self.d_reserved - [int64](total)
+      self.d_large = self.d_large - 1
+      libc.std.free(header)
+      return
+    end
+    var class = header.class
+    self.d_in_use = self.d_in_use - [int64](class_block_sizes[class])
+    var mag = &self.mags[class]
+    if mag.count == MAGAZINE_SIZE then
+      self:_flush(class, MAGAZINE_SIZE / 2)
+    end
+    var block = [&FreeBlock](header)
+    mag.items[mag.count] = block
+    mag.count = mag.count + 1
+  end
+
+  -- reuses the existing block when the new size still fits in it
+  terra PoolCache:realloc(ptr: &uint8, nbytes: size_t): &uint8
+    if ptr == nil then return self:alloc(nbytes) end
+    var header = [&PoolHeader](ptr - HEADER_SIZE)
+    var old_size = header.size
+    if header.class == LARGE_CLASS then
+      if nbytes > MAX_SIZE then
+        var new_header = [&PoolHeader](libc.std.realloc(header, nbytes + HEADER_SIZE))
+        if new_header == nil then return nil end
+        new_header.size = nbytes
+        var delta = [int64](nbytes) - [int64](old_size)
+        self.d_requested = self.d_requested + delta
+        self.d_in_use = self.d_in_use + delta
+        self.d_reserved = self.d_reserved + delta
+        return [&uint8](new_header) + HEADER_SIZE
+      end
+    elseif nbytes <= class_block_sizes[header.class] - HEADER_SIZE then
+      header.size = nbytes
+      self.d_requested = self.d_requested + [int64](nbytes) - [int64](old_size)
+      return ptr
+    end
+    var ret = self:alloc(nbytes)
+    if ret ~= nil then
+      intrinsics.memcpy(ret, ptr, intrinsics.min(old_size, nbytes))
+      self:free(ptr)
+    end
+    return ret
+  end
+
+  -- usable size of an allocation (>= requested size)
+  terra PoolCache:block_capacity(ptr: &uint8): size_t
+    var header = [&PoolHeader](ptr - HEADER_SIZE)
+    if header.class == LARGE_CLASS then return header.size end
+    return class_block_sizes[header.class] - HEADER_SIZE
+  end
+
+  _built = {
+    Pool = Pool,
+    PoolCache = PoolCache,
+    PoolStats = PoolStats,
+    CLASS_SIZES = CLASS_SIZES,
+  }
+  return _built
+end
+
+local lazy_items = {
+  Pool = function() return m._build().Pool end,
+  PoolCache = function() return m._build().PoolCache end,
+  PoolStats = function() return m._build().PoolStats end,
+}
+
+m.exported_names = {
+  "Pool", "PoolCache", "PoolStats"
+}
+
+return lazy.lazy_table(m, lazy_items)
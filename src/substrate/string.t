@@ -52,6 +52,27 @@ function m._build(options)
   return _built
 end
 
+-- a String that stores up to N chars inline before touching the heap
+m.SmallString = terralib.memoize(function(N)
+  local built = m._build()
+  local StringSlice = built.StringSlice
+
+  local SmallString = require("./array.t")._SmallVec(int8, N, {
+    slice_t = StringSlice
+  })
+  SmallString.name = "SmallString<" .. tostring(N) .. ">"
+
+  terra SmallString:copy_cstr(str: &int8)
+    self:copy_slice(built.wrap_c_str(str))
+  end
+
+  terra SmallString:equals_cstr(rhs: &int8): bool
+    return self:as_slice():equals_cstr(rhs)
+  end
+
+  return SmallString
+end)
+
 local lazy_items = {
   String = function() return m._build().String end,
   StringSlice = function() return m._build().StringSlice end,
@@ -60,7 +81,7 @@ local lazy_items = {
 }
   
 m.exported_names = {
-  "String", "StringSlice", "wrap_c_str", "as_string_slice"
+  "String", "StringSlice", "SmallString", "wrap_c_str", "as_string_slice"
 }
 
 return lazy.lazy_table(m, lazy_items)
\ No newline at end of file
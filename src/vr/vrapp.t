@@ -122,6 +122,7 @@ function VRApp:ecs_init()
   end
   ECS:add_system(graphics.RenderSystem())
   if self.stats then ECS:add_system(graphics.DebugTextStats()) end
+  truss.on_quit(function() ECS:release() end)
   self:init_pipeline()
 end
 